@@ -19,4 +19,6 @@
 #define ERR_DIR_EXISTS      -12     // cannot create directory if it exists
 #define ERR_DIR_NONEMPTY    -13     // cannot remove non empty directory
 
+#define ERR_READ_ONLY       -14     // file system is a snapshot mounted read only
+
 #endif
\ No newline at end of file
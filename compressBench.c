@@ -0,0 +1,128 @@
+/* Compression benchmark
+ * Measures codec throughput on the demo file content, and tinyFS write and
+ * read throughput and block usage for files with and without compression
+ * usage: compressBench [-m], -m runs on a memory disk to leave out disk I/O
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "TinyFS_errno.h"
+#include "lz.h"
+
+#define BENCH_DISK "compressBench.dsk"
+#define BENCH_CODEC_BYTES (64*1024*1024)
+#define BENCH_FS_BYTES (1024*1024)
+#define BENCH_DISK_SIZE (MAX_BLOCKS*BLOCKSIZE)
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// fills buffer with repeats of phrase, like the demo program does
+static void fillPhrase(char *phrase, char *buffer, int size){
+    int len = strlen(phrase);
+    int i;
+    for (i=0;i<size;i++)
+        buffer[i] = phrase[i % len];
+}
+
+// prints compression ratio and MB/s of compressing and decompressing buffer
+static void benchCodec(char *label, char *buffer, int size){
+    unsigned char *packed = malloc(size+size/255+16);
+    unsigned char *unpacked = malloc(size);
+    int reps = BENCH_CODEC_BYTES / size;
+    int zSize = 0;
+    int i;
+
+    double start = now();
+    for (i=0;i<reps;i++)
+        zSize = lzCompress((unsigned char *)buffer, size, packed, size+size/255+16);
+    double packTime = now()-start;
+
+    start = now();
+    for (i=0;i<reps;i++)
+        lzDecompress(packed, zSize, unpacked, size);
+    double unpackTime = now()-start;
+
+    if (memcmp(buffer, unpacked, size))
+        printf("%s: round trip mismatch\n", label);
+    printf("%-12s %8d %8d %10.1f %10.1f\n", label, size, zSize,
+        (double)reps*size/packTime/1e6, (double)reps*size/unpackTime/1e6);
+    free(packed);
+    free(unpacked);
+}
+
+// writes and reads back a file on a fresh disk, prints MB/s and data blocks used
+static void benchFile(char *buffer, int size, int compress){
+    tfs_mkfs(BENCH_DISK, BENCH_DISK_SIZE);
+    tfs_mount(BENCH_DISK);
+    fileDescriptor fd = tfs_openFile("afile");
+    tfs_setCompression(fd, compress);
+    int freeBefore = countFreeBlocks();
+    int reps = BENCH_FS_BYTES / size;
+    int i, b;
+
+    double start = now();
+    for (i=0;i<reps;i++){
+        if (tfs_writeFile(fd, buffer, size) < 0 || tfs_fsync(fd) < 0){
+            printf("%8d %-4s write failed\n", size, compress ? "lz" : "off");
+            tfs_unmount();
+            return;
+        }
+    }
+    double writeTime = now()-start;
+    int used = freeBefore-countFreeBlocks();
+
+    // reopen each pass so nothing is served from a previous pass
+    char c;
+    start = now();
+    for (i=0;i<reps;i++){
+        tfs_closeFile(fd);
+        fd = tfs_openFile("afile");
+        for (b=0;b<size;b++)
+            tfs_readByte(fd, &c);
+    }
+    double readTime = now()-start;
+
+    printf("%8d %-4s %8d %10.1f %10.1f\n", size, compress ? "lz" : "off", used,
+        (double)reps*size/writeTime/1e6, (double)reps*size/readTime/1e6);
+    tfs_unmount();
+}
+
+int main(int argc, char **argv){
+    if (argc > 1 && !strcmp(argv[1], "-m"))
+        tfs_setDiskFlags(DISK_MEMORY);
+    int sizes[] = {200, 1000, 10000, 60000};
+    int nSizes = sizeof(sizes)/sizeof(sizes[0]);
+    char *aContent = malloc(60000);
+    char *bContent = malloc(60000);
+    char *random = malloc(60000);
+    int i;
+    fillPhrase("hello world from (a) file ", aContent, 60000);
+    fillPhrase("(b) file content ", bContent, 60000);
+    for (i=0;i<60000;i++)
+        random[i] = rand();
+
+    printf("%-12s %8s %8s %10s %10s\n", "codec", "bytes", "packed", "pack MB/s", "unpack MB/s");
+    benchCodec("afile", aContent, 60000);
+    benchCodec("bfile", bContent, 60000);
+    benchCodec("random", random, 60000);
+
+    printf("\n%8s %-4s %8s %10s %10s\n", "bytes", "mode", "blocks", "write MB/s", "read MB/s");
+    for (i=0;i<nSizes;i++){
+        benchFile(aContent, sizes[i], 0);
+        benchFile(aContent, sizes[i], 1);
+    }
+
+    free(aContent);
+    free(bContent);
+    free(random);
+    return 0;
+}
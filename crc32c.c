@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#endif
+
+// reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crcTable[8][256];
+static int crcTableReady;
+static uint32_t (*crcImpl)(uint32_t, const void *, size_t);
+
+// builds the slice-by-8 tables for the portable implementation
+static void crc32cInitTable(void){
+    int i, j;
+    for (i=0;i<256;i++){
+        uint32_t crc = i;
+        for (j=0;j<8;j++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        crcTable[0][i] = crc;
+    }
+    for (i=0;i<256;i++){
+        for (j=1;j<8;j++)
+            crcTable[j][i] = (crcTable[j-1][i] >> 8) ^ crcTable[0][crcTable[j-1][i] & 0xFF];
+    }
+    crcTableReady = 1;
+}
+
+// table driven CRC32C, processes 8 bytes per step
+uint32_t crc32cPortable(uint32_t crc, const void *buf, size_t len){
+    if (!crcTableReady)
+        crc32cInitTable();
+
+    const unsigned char *p = buf;
+    crc = ~crc;
+    while (len >= 8){
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p+4, 4);
+        lo ^= crc;
+        crc = crcTable[7][lo & 0xFF] ^ crcTable[6][(lo >> 8) & 0xFF] ^
+              crcTable[5][(lo >> 16) & 0xFF] ^ crcTable[4][lo >> 24] ^
+              crcTable[3][hi & 0xFF] ^ crcTable[2][(hi >> 8) & 0xFF] ^
+              crcTable[1][(hi >> 16) & 0xFF] ^ crcTable[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xFF];
+    return ~crc;
+}
+
+#ifdef CRC32C_X86
+// CRC32C using the SSE4.2 crc32 instruction
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(uint32_t crc, const void *buf, size_t len){
+    const unsigned char *p = buf;
+    crc = ~crc;
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8){
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4){
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        len -= 4;
+    }
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return ~crc;
+}
+
+int crc32cHasHardware(void){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#else
+uint32_t crc32cHardware(uint32_t crc, const void *buf, size_t len){
+    return crc32cPortable(crc, buf, len);
+}
+
+int crc32cHasHardware(void){
+    return 0;
+}
+#endif
+
+// CRC32C of buf continuing from crc (0 to start)
+// picks the hardware instruction at first use when the CPU supports it
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len){
+    if (!crcImpl)
+        crcImpl = crc32cHasHardware() ? crc32cHardware : crc32cPortable;
+    return crcImpl(crc, buf, len);
+}
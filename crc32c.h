@@ -0,0 +1,12 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32cPortable(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32cHardware(uint32_t crc, const void *buf, size_t len);
+int crc32cHasHardware(void);
+
+#endif
@@ -0,0 +1,100 @@
+/* Checksum overhead benchmark
+ * Measures CRC32C cost per block for several block sizes, and the cost of
+ * verifying checksums in readBlock on a tinyFS sized disk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinyFS.h"
+#include "libDisk.h"
+#include "crc32c.h"
+
+#define BENCH_BYTES (64*1024*1024)
+#define BENCH_DISK "crcBench.dsk"
+#define BENCH_DISK_BLOCKS 255
+#define BENCH_READ_PASSES 200
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// returns nanoseconds per block for a checksum function
+double benchCrc(uint32_t (*fn)(uint32_t, const void *, size_t), unsigned char *buffer, int blockSize){
+    int nBlocks = BENCH_BYTES / blockSize;
+    volatile uint32_t sink = 0;
+    double start = now();
+    int b;
+    for (b=0;b<nBlocks;b++)
+        sink ^= fn(0, buffer+(b % 64)*blockSize, blockSize);
+    return (now()-start) * 1e9 / nBlocks;
+}
+
+// returns nanoseconds per block for copying, as a reference point
+double benchCopy(unsigned char *buffer, int blockSize){
+    int nBlocks = BENCH_BYTES / blockSize;
+    unsigned char *dest = malloc(blockSize);
+    double start = now();
+    int b;
+    for (b=0;b<nBlocks;b++){
+        memcpy(dest, buffer+(b % 64)*blockSize, blockSize);
+        __asm__ volatile("" : : "r"(dest) : "memory");
+    }
+    double elapsed = now()-start;
+    free(dest);
+    return elapsed * 1e9 / nBlocks;
+}
+
+// returns microseconds per pass of reading a whole disk block by block
+double benchReads(int disk, int verify){
+    unsigned char block[BLOCKSIZE];
+    setDiskVerify(disk, verify);
+    double start = now();
+    int pass, b;
+    for (pass=0;pass<BENCH_READ_PASSES;pass++){
+        for (b=0;b<BENCH_DISK_BLOCKS;b++){
+            if (readBlock(disk, b, block) < 0)
+                return -1;
+        }
+    }
+    return (now()-start) * 1e6 / BENCH_READ_PASSES;
+}
+
+int main(){
+    int sizes[] = {64, 128, 256, 512, 1024, 4096};
+    int nSizes = sizeof(sizes)/sizeof(sizes[0]);
+    unsigned char *buffer = malloc(64*4096);
+    int i;
+    for (i=0;i<64*4096;i++)
+        buffer[i] = rand();
+
+    printf("hardware crc32c: %s\n\n", crc32cHasHardware() ? "sse4.2" : "not available");
+    printf("%-10s %12s %12s %12s\n", "block", "copy ns", "portable ns", "hardware ns");
+    for (i=0;i<nSizes;i++){
+        printf("%-10d %12.1f %12.1f %12.1f\n", sizes[i],
+            benchCopy(buffer, sizes[i]),
+            benchCrc(crc32cPortable, buffer, sizes[i]),
+            benchCrc(crc32cHardware, buffer, sizes[i]));
+    }
+
+    int disk = openDisk(BENCH_DISK, BENCH_DISK_BLOCKS*BLOCKSIZE);
+    if (disk < 0){
+        printf("failed to create disk\n");
+        return -1;
+    }
+    for (i=0;i<BENCH_DISK_BLOCKS;i++)
+        writeBlock(disk, i, buffer+(i % 64)*BLOCKSIZE);
+
+    double plain = benchReads(disk, 0);
+    double verified = benchReads(disk, 1);
+    printf("\nreadBlock pass over %d blocks: %.1f us unverified, %.1f us verified (%.1f%% overhead)\n",
+        BENCH_DISK_BLOCKS, plain, verified, (verified-plain) * 100 / plain);
+
+    closeDisk(disk);
+    free(buffer);
+    return 0;
+}
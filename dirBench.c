@@ -0,0 +1,122 @@
+/* Directory lookup benchmark
+ * Measures block reads and latency of path lookups against directory size,
+ * for hashed directories and for the same directories scanned linearly
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "libDisk.h"
+#include "TinyFS_errno.h"
+
+#define BENCH_DISK "dirBench.dsk"
+#define BENCH_DISK_SIZE (MAX_BLOCKS*BLOCKSIZE)
+#define BENCH_SAMPLES 32
+#define BENCH_WARM_PASSES 1000
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// creates /d with count empty files, returns the directory's inode block
+static int makeDir(int count){
+    tfs_mkfs(BENCH_DISK, BENCH_DISK_SIZE);
+    tfs_mount(BENCH_DISK);
+    tfsBatchOp *ops = malloc((count+1) * sizeof(tfsBatchOp));
+    char (*names)[16] = malloc(count * 16);
+    ops[0].op = BATCH_MKDIR;
+    ops[0].path = "/d";
+    int i;
+    for (i=0;i<count;i++){
+        sprintf(names[i], "/d/f%d", i);
+        ops[i+1].op = BATCH_CREATE;
+        ops[i+1].path = names[i];
+    }
+    tfs_batch(ops, count+1);
+    free(ops);
+    free(names);
+
+    tfsStat st;
+    tfs_stat("/d", &st);
+    tfs_unmount();
+    return st.inodeBlock;
+}
+
+// clears the hashed flag of a directory on the unmounted disk, entries stay in their slots
+static void makeLinear(int dirIdx){
+    unsigned char block[BLOCKSIZE];
+    int disk = openDisk(BENCH_DISK, 0);
+    readBlock(disk, dirIdx, block);
+    block[OFFSET_I_FLAGS] &= ~FLAG_I_HASHED;
+    writeBlock(disk, dirIdx, block);
+    closeDisk(disk);
+}
+
+// looks up name on a freshly mounted disk, adds block reads and seconds taken
+static void coldLookup(char *name, long *reads, double *seconds){
+    tfs_mount(BENCH_DISK);
+    diskStats before, after;
+    tfsStat st;
+    tfs_diskStats(&before);
+    double start = now();
+    tfs_stat(name, &st);
+    *seconds += now()-start;
+    tfs_diskStats(&after);
+    *reads += after.reads-before.reads;
+    tfs_unmount();
+}
+
+static void bench(int count, int linear){
+    int dirIdx = makeDir(count);
+    if (linear)
+        makeLinear(dirIdx);
+
+    char name[16];
+    long reads = 0, missReads = 0;
+    double seconds = 0, missSeconds = 0;
+    int i;
+    for (i=0;i<BENCH_SAMPLES;i++){
+        sprintf(name, "/d/f%d", rand() % count);
+        coldLookup(name, &reads, &seconds);
+        sprintf(name, "/d/x%d", i);
+        coldLookup(name, &missReads, &missSeconds);
+    }
+
+    // warm lookups are served from the inode attribute cache
+    tfsStat st;
+    tfs_mount(BENCH_DISK);
+    for (i=0;i<count;i++){
+        sprintf(name, "/d/f%d", i);
+        tfs_stat(name, &st);
+    }
+    double start = now();
+    for (i=0;i<BENCH_WARM_PASSES;i++){
+        sprintf(name, "/d/f%d", i % count);
+        tfs_stat(name, &st);
+    }
+    double warm = (now()-start) / BENCH_WARM_PASSES;
+    tfs_unmount();
+
+    printf("%8d %-7s %10.1f %10.1f %10.1f %10.1f %10.2f\n", count, linear ? "linear" : "hashed",
+        (double)reads/BENCH_SAMPLES, seconds/BENCH_SAMPLES*1e6,
+        (double)missReads/BENCH_SAMPLES, missSeconds/BENCH_SAMPLES*1e6, warm*1e6);
+}
+
+int main(){
+    int sizes[] = {16, 64, 128, 200, DIR_SLOTS};
+    int nSizes = sizeof(sizes)/sizeof(sizes[0]);
+    int i;
+    printf("%8s %-7s %10s %10s %10s %10s %10s\n", "entries", "layout",
+        "hit reads", "hit us", "miss reads", "miss us", "warm us");
+    for (i=0;i<nSizes;i++){
+        bench(sizes[i], 0);
+        bench(sizes[i], 1);
+    }
+    return 0;
+}
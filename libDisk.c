@@ -1,85 +1,1074 @@
+#define _GNU_SOURCE             // O_DIRECT
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <aio.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "libDisk.h"
 #include "tinyFS.h"
+#include "crc32c.h"
 
-int openDisk(char *filename, int nBytes){
-    int disk;
-    if (nBytes == 0){
-        disk = open(filename, O_RDWR);
-        if (disk < 0){
-            perror("open");
-            return -1;  //ERROR CODE, file doesn't exist
-        }
+// open disks, a disk number is its index + 1
+static diskEntry disks[MAX_DISKS];
+
+// memory disks by name
+static memoryDisk memoryDisks[MAX_MEMORY_DISKS];
+
+// block I/O of all disks together
+static diskStats totalStats;
+
+// returns the entry for an open disk number, NULL if not open
+static diskEntry *getDisk(int disk){
+    if (disk < 1 || disk > MAX_DISKS || !disks[disk-1].open){
+        printf("Error: disk %d is not open\n", disk);
+        return NULL;
     }
-    else if (nBytes < BLOCKSIZE){
-        return -1; // ERROR CODE, block size too small
+    return disks+disk-1;
+}
+
+// checks a block range against the size of the disk
+static int checkRange(diskEntry *d, int bNum, int nBlocks){
+    if (bNum < 0 || nBlocks < 1 || bNum+nBlocks > d->nBlocks){
+        printf("Error: block %d out of range\n", bNum+nBlocks-1);
+        return -1;
     }
-    else{
-        disk = open(filename, O_CREAT|O_RDWR, S_IRWXU|S_IRUSR|S_IRUSR);
-        if (disk < 0){
+    return 0;
+}
+
+// keeps copies of blocks in memory during a batch, dirty ones are written by endDiskBatch
+static int holdBlocks(diskEntry *d, int bNum, int nBlocks, unsigned char *blocks, int dirty){
+    int b;
+    for (b=0;b<nBlocks;b++){
+        if (!d->held[bNum+b] && !(d->held[bNum+b] = malloc(BLOCKSIZE))){
+            perror("malloc");
+            return -1; // ERROR CODE, no memory for held blocks
+        }
+        memcpy(d->held[bNum+b], blocks+b*BLOCKSIZE, BLOCKSIZE);
+        if (dirty)
+            d->heldDirty[bNum+b] = 1;
+    }
+    return 0;
+}
+
+// loads or creates the checksum file next to a disk
+// a disk without a checksum file is used without checksums
+static int openChecksums(diskEntry *d, char *filename, int create){
+    char crcName[DISK_NAME_MAX+12];
+    snprintf(crcName, sizeof(crcName), "%s.crc", filename);
+
+    d->crcFd = open(crcName, create ? O_CREAT|O_RDWR|O_TRUNC : O_RDWR, S_IRUSR|S_IWUSR);
+    if (d->crcFd < 0){
+        if (create){
             perror("open");
-            return -1;  //ERROR CODE, failed to create file
+            return -1; // ERROR CODE, failed to create checksum file
         }
+        return 0;
+    }
+
+    d->crcTable = malloc(d->nBlocks * sizeof(uint32_t));
+    if (!d->crcTable){
+        perror("malloc");
+        return -1; // ERROR CODE, no memory for checksums
+    }
 
-        int numBlocks = nBytes / BLOCKSIZE;
+    if (create){
         unsigned char zeros[BLOCKSIZE];
         memset(zeros, 0, BLOCKSIZE);
-
+        uint32_t zeroCrc = crc32c(0, zeros, BLOCKSIZE);
         int b;
-        for (b = 0;b<numBlocks;b++){
-            if (write(disk, zeros, BLOCKSIZE) < BLOCKSIZE){
-                perror("write");
-                return -1; // ERROR CODE, failed to write to disk
-            }
+        for (b=0;b<d->nBlocks;b++)
+            d->crcTable[b] = zeroCrc;
+        if (pwrite(d->crcFd, d->crcTable, d->nBlocks * sizeof(uint32_t), 0) < d->nBlocks * sizeof(uint32_t)){
+            perror("write");
+            return -1; // ERROR CODE, failed to write checksums
         }
+    }
+    else if (pread(d->crcFd, d->crcTable, d->nBlocks * sizeof(uint32_t), 0) < d->nBlocks * sizeof(uint32_t)){
+        printf("Warning: checksum file %s does not match disk, checksums disabled\n", crcName);
+        free(d->crcTable);
+        d->crcTable = NULL;
+        close(d->crcFd);
+        d->crcFd = -1;
+    }
+    return 0;
+}
 
-        if (lseek(disk, 0, SEEK_SET) != 0){
-            perror("lseek");
-            return -1; // ERROR CODE, failed seek
+// compares blocks read from disk against their stored checksums
+static int verifyChecksums(diskEntry *d, int bNum, int nBlocks, unsigned char *blocks){
+    if (!d->crcTable || !d->verify)
+        return 0;
+    int b;
+    for (b=0;b<nBlocks;b++){
+        if (crc32c(0, blocks+b*BLOCKSIZE, BLOCKSIZE) != d->crcTable[bNum+b]){
+            printf("Error: checksum mismatch on block %d\n", bNum+b);
+            return -1; // ERROR CODE, corrupt block
         }
     }
-    return disk;
+    return 0;
 }
 
-int closeDisk(int disk){
-    if (close(disk) == -1){
-        perror("close");
-        return -1; // ERROR CODE, failed to close
+// recomputes and stores checksums of blocks written to disk
+static int updateChecksums(diskEntry *d, int bNum, int nBlocks, unsigned char *blocks){
+    if (!d->crcTable)
+        return 0;
+    int b;
+    for (b=0;b<nBlocks;b++)
+        d->crcTable[bNum+b] = crc32c(0, blocks+b*BLOCKSIZE, BLOCKSIZE);
+    int len = nBlocks * sizeof(uint32_t);
+    if (pwrite(d->crcFd, d->crcTable+bNum, len, bNum * sizeof(uint32_t)) < len){
+        perror("write");
+        return -1; // ERROR CODE, failed to write checksums
     }
     return 0;
 }
 
+// returns the pool buffer holding chunk, least recently used buffers are reused
+// with load set a chunk that isn't in the pool is read from the disk
+static unsigned char *poolChunk(diskEntry *d, int chunk, int load){
+    int i;
+    int slot = 0;
+    for (i=0;i<DISK_POOL_CHUNKS;i++){
+        if (d->poolTag[i] == chunk){
+            slot = i;
+            break;
+        }
+        if (d->poolAge[i] < d->poolAge[slot])
+            slot = i;
+    }
+    unsigned char *buffer = d->pool + slot*DISK_ALIGN;
+    d->poolAge[slot] = ++d->poolClock;
+    if (d->poolTag[slot] == chunk)
+        return buffer;
+    d->poolTag[slot] = -1;
+    if (load && pread(d->fd, buffer, DISK_ALIGN, (off_t)chunk*DISK_ALIGN) < DISK_ALIGN){
+        perror("read");
+        return NULL;
+    }
+    d->poolTag[slot] = chunk;
+    return buffer;
+}
 
-int readBlock(int disk, int bNum, void *block){
+// grows the aligned scratch buffer to hold size bytes
+static int growScratch(diskEntry *d, int size){
+    if (d->scratchSize >= size)
+        return 0;
+    free(d->scratch);
+    d->scratch = NULL;
+    d->scratchSize = 0;
+    if (posix_memalign((void **)&d->scratch, DISK_ALIGN, size)){
+        printf("Error: no memory for aligned buffer\n");
+        return -1; // ERROR CODE, no memory for aligned buffer
+    }
+    d->scratchSize = size;
+    return 0;
+}
+
+// moves bytes [start, end) of the disk file between memory and disk with O_DIRECT
+// whole chunks go to O_DIRECT, a transfer within one chunk is served by the pool,
+// larger ones use the scratch buffer and refresh chunks the pool holds
+// the end of the disk that isn't a whole chunk goes through the page cache,
+// so an aligned write can't grow the file
+static int directIO(diskEntry *d, off_t start, off_t end, unsigned char *data, int isWrite){
+    off_t directEnd = (off_t)d->nBlocks*BLOCKSIZE / DISK_ALIGN * DISK_ALIGN;
+    if (end > directEnd){
+        off_t from = start > directEnd ? start : directEnd;
+        ssize_t n = isWrite ? pwrite(d->bufFd, data+(from-start), end-from, from)
+                          : pread(d->bufFd, data+(from-start), end-from, from);
+        if (n < end-from){
+            perror(isWrite ? "write" : "read");
+            return -1; // ERROR CODE, failed transfer at the end of the disk
+        }
+        end = from;
+    }
+    if (start >= end)
+        return 0;
+
+    int first = start / DISK_ALIGN;
+    int last = (end-1) / DISK_ALIGN;
+    int offset = start - (off_t)first*DISK_ALIGN;
+    int len = end-start;
+    if (first == last){
+        unsigned char *chunk = poolChunk(d, first, !isWrite || len < DISK_ALIGN);
+        if (!chunk)
+            return -1; // ERROR CODE, failed to read chunk
+        if (!isWrite){
+            memcpy(data, chunk+offset, len);
+            return 0;
+        }
+        memcpy(chunk+offset, data, len);
+        if (pwrite(d->fd, chunk, DISK_ALIGN, (off_t)first*DISK_ALIGN) < DISK_ALIGN){
+            perror("write");
+            memset(d->poolTag, -1, sizeof(d->poolTag));
+            return -1; // ERROR CODE, failed to write chunk
+        }
+        return 0;
+    }
+
+    int size = (last-first+1)*DISK_ALIGN;
+    if (growScratch(d, size))
+        return -1; // ERROR CODE, no memory for aligned buffer
+    if (!isWrite){
+        if (pread(d->fd, d->scratch, size, (off_t)first*DISK_ALIGN) < size){
+            perror("read");
+            return -1; // ERROR CODE, failed to read
+        }
+        memcpy(data, d->scratch+offset, len);
+        return 0;
+    }
+
+    // partly written chunks at either end keep their other blocks
+    unsigned char *chunk;
+    if (offset){
+        if (!(chunk = poolChunk(d, first, 1)))
+            return -1; // ERROR CODE, failed to read chunk
+        memcpy(d->scratch, chunk, DISK_ALIGN);
+    }
+    if (end % DISK_ALIGN){
+        if (!(chunk = poolChunk(d, last, 1)))
+            return -1; // ERROR CODE, failed to read chunk
+        memcpy(d->scratch+size-DISK_ALIGN, chunk, DISK_ALIGN);
+    }
+    memcpy(d->scratch+offset, data, len);
+    int i;
+    for (i=0;i<DISK_POOL_CHUNKS;i++){
+        if (d->poolTag[i] >= first && d->poolTag[i] <= last)
+            memcpy(d->pool+i*DISK_ALIGN, d->scratch+(d->poolTag[i]-first)*DISK_ALIGN, DISK_ALIGN);
+    }
+    if (pwrite(d->fd, d->scratch, size, (off_t)first*DISK_ALIGN) < size){
+        perror("write");
+        memset(d->poolTag, -1, sizeof(d->poolTag));
+        return -1; // ERROR CODE, failed to write
+    }
+    return 0;
+}
+
+// returns the memory disk called name, NULL if there is none
+static memoryDisk *findMemoryDisk(char *name){
+    int i;
+    for (i=0;i<MAX_MEMORY_DISKS;i++){
+        if (memoryDisks[i].used && !strcmp(memoryDisks[i].name, name))
+            return memoryDisks+i;
+    }
+    return NULL;
+}
+
+// unmaps a memory disk and frees its entry
+static void freeMemoryDisk(memoryDisk *m){
+    munmap(m->data, m->mapSize);
+    memset(m, 0, sizeof(memoryDisk));
+}
+
+// creates a zeroed memory disk of nBlocks blocks called name, replacing one that isn't open
+// with huge set it is mapped with huge pages, or transparent huge pages if none are reserved
+static memoryDisk *createMemoryDisk(char *name, int nBlocks, int huge){
+    memoryDisk *m = findMemoryDisk(name);
+    if (m && m->openCount){
+        printf("Error: memory disk %s is open\n", name);
+        return NULL; // ERROR CODE, disk in use
+    }
+    if (m)
+        freeMemoryDisk(m);
+    int i = 0;
+    while (i < MAX_MEMORY_DISKS && memoryDisks[i].used)
+        i++;
+    if (i == MAX_MEMORY_DISKS){
+        printf("Error: too many memory disks\n");
+        return NULL; // ERROR CODE, memory disk table full
+    }
+    m = memoryDisks+i;
+
+    size_t size = (size_t)nBlocks*BLOCKSIZE;
+    void *data = MAP_FAILED;
+    if (huge){
+        m->mapSize = (size + DISK_HUGE_PAGE-1) / DISK_HUGE_PAGE * DISK_HUGE_PAGE;
+        data = mmap(NULL, m->mapSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    }
+    if (data == MAP_FAILED){
+        m->mapSize = size;
+        data = mmap(NULL, m->mapSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED){
+            perror("mmap");
+            m->mapSize = 0;
+            return NULL; // ERROR CODE, no memory for the disk
+        }
+        if (huge)
+            madvise(data, m->mapSize, MADV_HUGEPAGE);
+    }
+    m->data = data;
+    m->used = 1;
+    m->nBlocks = nBlocks;
+    strcpy(m->name, name);
+    return m;
+}
+
+// adds the simulated device time of one disk call to the stats of a modeled disk
+// calls of a batch flush share their latency in groups of the queue depth
+static void modelIO(diskEntry *d, int bNum, int nBlocks){
+    if (!d->modeled)
+        return;
+    diskModel *m = &d->model;
+    long ns = 0;
+    if (d->queued < 0 || m->queueDepth < 2 || d->queued % m->queueDepth == 0)
+        ns += m->latencyNs;
+    if (d->queued >= 0)
+        d->queued++;
+    if (bNum != d->head)
+        ns += m->seekNs + m->seekBlockNs * (bNum > d->head ? bNum-d->head : d->head-bNum);
+    if (m->bytesPerSec)
+        ns += (long)nBlocks*BLOCKSIZE * 1000000000 / m->bytesPerSec;
+    d->head = bNum+nBlocks;
+    d->stats.deviceNs += ns;
+    totalStats.deviceNs += ns;
+    if (m->sleep){
+        struct timespec ts = {ns / 1000000000, ns % 1000000000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+// fills cbs with the pieces of a transfer of a striped disk, one per stripe it touches
+// stripe s is on member s % members at stripe s / members, returns the number of pieces
+static int stripePieces(diskEntry *d, int bNum, int nBlocks, unsigned char *data, int isWrite, struct aiocb *cbs){
+    int unit = d->stripeBlocks;
+    int i = 0;
+    int b = bNum;
+    while (b < bNum+nBlocks){
+        int stripe = b / unit;
+        int count = unit - b % unit;
+        if (count > bNum+nBlocks-b)
+            count = bNum+nBlocks-b;
+        memset(cbs+i, 0, sizeof(struct aiocb));
+        cbs[i].aio_fildes = d->memberFd[stripe % d->members];
+        cbs[i].aio_offset = ((off_t)(stripe / d->members) * unit + b % unit) * BLOCKSIZE;
+        cbs[i].aio_buf = data + (b-bNum)*BLOCKSIZE;
+        cbs[i].aio_nbytes = count*BLOCKSIZE;
+        cbs[i].aio_lio_opcode = isWrite ? LIO_WRITE : LIO_READ;
+        i++;
+        b += count;
+    }
+    return i;
+}
+
+// issues pieces together with lio_listio, so different members work in parallel
+static int stripeSubmit(struct aiocb *cbs, int pieces, int isWrite){
+    int retVal = 0;
+    if (pieces == 1){
+        ssize_t n = isWrite ? pwrite(cbs->aio_fildes, (void *)cbs->aio_buf, cbs->aio_nbytes, cbs->aio_offset)
+                            : pread(cbs->aio_fildes, (void *)cbs->aio_buf, cbs->aio_nbytes, cbs->aio_offset);
+        if (n < (ssize_t)cbs->aio_nbytes)
+            retVal = -1; // ERROR CODE, failed transfer
+    }
+    else{
+        struct aiocb **list = malloc(pieces * sizeof(struct aiocb *));
+        if (!list){
+            perror("malloc");
+            return -1; // ERROR CODE, no memory for the transfer list
+        }
+        int i;
+        for (i=0;i<pieces;i++)
+            list[i] = cbs+i;
+        if (lio_listio(LIO_WAIT, list, pieces, NULL) < 0 && errno != EIO)
+            perror("lio_listio");
+        for (i=0;i<pieces;i++){
+            while (aio_error(list[i]) == EINPROGRESS)
+                aio_suspend((const struct aiocb **)list+i, 1, NULL);
+            if (aio_error(list[i]) || aio_return(list[i]) < (ssize_t)list[i]->aio_nbytes)
+                retVal = -1; // ERROR CODE, failed transfer
+        }
+        free(list);
+    }
+    if (retVal)
+        perror(isWrite ? "write" : "read");
+    return retVal;
+}
+
+// moves blocks of a striped disk, the pieces of a transfer are issued together
+static int stripeIO(diskEntry *d, int bNum, int nBlocks, unsigned char *data, int isWrite){
+    int unit = d->stripeBlocks;
+    int pieces = (bNum % unit + nBlocks + unit-1) / unit;
+    struct aiocb *cbs = calloc(pieces, sizeof(struct aiocb));
+    if (!cbs){
+        perror("calloc");
+        return -1; // ERROR CODE, no memory for the transfer list
+    }
+    stripePieces(d, bNum, nBlocks, data, isWrite, cbs);
+    int retVal = stripeSubmit(cbs, pieces, isWrite);
+    free(cbs);
+    return retVal;
+}
+
+// reads blocks from the disk file and verifies them
+static int readDisk(diskEntry *d, int bNum, int nBlocks, void *blocks){
     int byteOffset = bNum * BLOCKSIZE;
-    if (lseek(disk, byteOffset, SEEK_SET) != byteOffset){
+    if (d->memory)
+        memcpy(blocks, d->memory->data+byteOffset, nBlocks*BLOCKSIZE);
+    else if (d->direct){
+        if (directIO(d, byteOffset, byteOffset + nBlocks*BLOCKSIZE, blocks, 0))
+            return -1; // ERROR CODE, failed to read
+    }
+    else if (d->members){
+        if (stripeIO(d, bNum, nBlocks, blocks, 0))
+            return -1; // ERROR CODE, failed to read
+    }
+    else if (lseek(d->fd, byteOffset, SEEK_SET) != byteOffset){
         perror("lseek");
         return -1; // ERROR CODE, failed seek
     }
-    if (read(disk, block, BLOCKSIZE) < BLOCKSIZE){
+    else if (read(d->fd, blocks, nBlocks * BLOCKSIZE) < nBlocks * BLOCKSIZE){
         perror("read");
         return -1; // ERROR CODE, failed to read
     }
-    return 0;
+    d->stats.reads += nBlocks;
+    d->stats.readCalls++;
+    totalStats.reads += nBlocks;
+    totalStats.readCalls++;
+    modelIO(d, bNum, nBlocks);
+    return verifyChecksums(d, bNum, nBlocks, blocks);
 }
 
+// counts blocks written to the disk file and updates their checksums
+static int wroteDisk(diskEntry *d, int bNum, int nBlocks, unsigned char *blocks){
+    d->stats.writes += nBlocks;
+    d->stats.writeCalls++;
+    totalStats.writes += nBlocks;
+    totalStats.writeCalls++;
+    modelIO(d, bNum, nBlocks);
+    return updateChecksums(d, bNum, nBlocks, blocks);
+}
 
-int writeBlock(int disk, int bNum, void *block){
+// writes blocks to the disk file and updates their checksums
+static int writeDisk(diskEntry *d, int bNum, int nBlocks, void *blocks){
     int byteOffset = bNum * BLOCKSIZE;
-    if (lseek(disk, byteOffset, SEEK_SET) != byteOffset){
+    if (d->memory)
+        memcpy(d->memory->data+byteOffset, blocks, nBlocks*BLOCKSIZE);
+    else if (d->direct){
+        if (directIO(d, byteOffset, byteOffset + nBlocks*BLOCKSIZE, blocks, 1))
+            return -1; // ERROR CODE, failed to write
+    }
+    else if (d->members){
+        if (stripeIO(d, bNum, nBlocks, blocks, 1))
+            return -1; // ERROR CODE, failed to write
+    }
+    else if (lseek(d->fd, byteOffset, SEEK_SET) != byteOffset){
         perror("lseek");
         return -1; // ERROR CODE, failed seek
     }
-    if (write(disk, block, BLOCKSIZE) < BLOCKSIZE){
+    else if (write(d->fd, blocks, nBlocks * BLOCKSIZE) < nBlocks * BLOCKSIZE){
         perror("write");
         return -1; // ERROR CODE, failed to write
     }
+    return wroteDisk(d, bNum, nBlocks, blocks);
+}
+
+int openDisk(char *filename, int nBytes){
+    return openDiskFlags(filename, nBytes, 0);
+}
+
+// opens the direct descriptor and aligned buffers of a disk opened with DISK_DIRECT
+// file systems without O_DIRECT keep using the page cache
+static int openDirect(diskEntry *d, char *filename){
+    int fd = open(filename, O_RDWR|O_DIRECT);
+    if (fd < 0){
+        printf("Warning: O_DIRECT not supported for %s, using the page cache\n", filename);
+        return 0;
+    }
+    if (posix_memalign((void **)&d->pool, DISK_ALIGN, DISK_POOL_CHUNKS*DISK_ALIGN)){
+        printf("Error: no memory for aligned buffers\n");
+        close(fd);
+        return -1; // ERROR CODE, no memory for aligned buffers
+    }
+    memset(d->poolTag, -1, sizeof(d->poolTag));
+    d->bufFd = d->fd;
+    d->fd = fd;
+    d->direct = 1;
+    return 0;
+}
+
+// opens the memory disk called name, creating it with nBytes zeroed bytes unless nBytes is 0
+static int openMemoryDisk(diskEntry *d, char *name, int nBytes, int flags){
+    memoryDisk *m;
+    if (nBytes == 0){
+        m = findMemoryDisk(name);
+        if (!m){
+            printf("Error: no memory disk named %s\n", name);
+            return -1; // ERROR CODE, memory disk doesn't exist
+        }
+    }
+    else if (nBytes < BLOCKSIZE)
+        return -1; // ERROR CODE, block size too small
+    else if (!(m = createMemoryDisk(name, nBytes / BLOCKSIZE, flags & DISK_HUGE)))
+        return -1; // ERROR CODE, failed to create memory disk
+
+    m->openCount++;
+    d->memory = m;
+    d->nBlocks = m->nBlocks;
+    d->fd = -1;
+    d->open = 1;
     return 0;
 }
 
+// opens the file of a disk, or creates it with nBlocks zeroed blocks unless nBlocks is 0
+// sets fileBlocks to the size of the file in blocks
+static int openBackingFile(char *filename, int nBlocks, int *fileBlocks){
+    int disk;
+    if (nBlocks == 0){
+        disk = open(filename, O_RDWR);
+        if (disk < 0){
+            perror("open");
+            return -1;  //ERROR CODE, file doesn't exist
+        }
+        struct stat st;
+        if (fstat(disk, &st) < 0){
+            perror("fstat");
+            close(disk);
+            return -1;  //ERROR CODE, can't get disk size
+        }
+        *fileBlocks = st.st_size / BLOCKSIZE;
+        return disk;
+    }
+
+    disk = open(filename, O_CREAT|O_RDWR, S_IRWXU|S_IRUSR|S_IRUSR);
+    if (disk < 0){
+        perror("open");
+        return -1;  //ERROR CODE, failed to create file
+    }
+
+    unsigned char zeros[BLOCKSIZE];
+    memset(zeros, 0, BLOCKSIZE);
+
+    int b;
+    for (b = 0;b<nBlocks;b++){
+        if (write(disk, zeros, BLOCKSIZE) < BLOCKSIZE){
+            perror("write");
+            close(disk);
+            return -1; // ERROR CODE, failed to write to disk
+        }
+    }
+
+    // drop anything left from an older, larger disk
+    if (ftruncate(disk, nBlocks * BLOCKSIZE) < 0){
+        perror("ftruncate");
+        close(disk);
+        return -1; // ERROR CODE, failed to resize disk
+    }
+
+    if (lseek(disk, 0, SEEK_SET) != 0){
+        perror("lseek");
+        close(disk);
+        return -1; // ERROR CODE, failed seek
+    }
+    *fileBlocks = nBlocks;
+    return disk;
+}
+
+// opens a disk striped over the comma separated files in names, creating them unless nBytes is 0
+// members are the same size, a multiple of the largest stripe unit, so any unit maps within them
+// checksums are kept next to the first member as <first>.stripe.crc, so it can't be mistaken
+// for the checksums of the member on its own
+static int openStriped(diskEntry *d, char *names, int nBytes, int flags){
+    if (flags & DISK_DIRECT){
+        printf("Error: striped disks can't use O_DIRECT\n");
+        return -1; // ERROR CODE, unsupported flags
+    }
+    char list[DISK_NAME_MAX+1];
+    strcpy(list, names);
+    char *member[DISK_MAX_MEMBERS];
+    int count = 0;
+    char *save;
+    char *name = strtok_r(list, ",", &save);
+    while (name && count < DISK_MAX_MEMBERS){
+        member[count++] = name;
+        name = strtok_r(NULL, ",", &save);
+    }
+    if (name || count < 2){
+        printf("Error: a striped disk needs 2 to %d files\n", DISK_MAX_MEMBERS);
+        return -1; // ERROR CODE, bad member list
+    }
+
+    int span = count * DISK_MAX_STRIPE;
+    int memberBlocks = nBytes ? (nBytes/BLOCKSIZE + span-1) / span * DISK_MAX_STRIPE : 0;
+    int i, size;
+    for (i=0;i<count;i++){
+        d->memberFd[i] = openBackingFile(member[i], memberBlocks, &size);
+        if (d->memberFd[i] >= 0 && i && size != d->nBlocks / i){
+            printf("Error: %s is not the size of %s\n", member[i], member[0]);
+            close(d->memberFd[i]);
+            d->memberFd[i] = -1;
+        }
+        if (d->memberFd[i] < 0){
+            while (i--)
+                close(d->memberFd[i]);
+            return -1; // ERROR CODE, failed to open a member
+        }
+        d->nBlocks += size;
+    }
+    d->fd = d->memberFd[0];
+    d->members = count;
+    d->stripeBlocks = DISK_STRIPE_BLOCKS;
+    char crcBase[DISK_NAME_MAX+8];
+    snprintf(crcBase, sizeof(crcBase), "%s.stripe", member[0]);
+    if (openChecksums(d, crcBase, nBytes != 0) < 0){
+        for (i=0;i<count;i++)
+            close(d->memberFd[i]);
+        free(d->crcTable);
+        if (d->crcFd >= 0)
+            close(d->crcFd);
+        return -1; // ERROR CODE, failed to set up checksums
+    }
+    d->open = 1;
+    return 0;
+}
+
+// openDisk with flags, DISK_DIRECT moves whole aligned chunks with O_DIRECT
+// instead of going through the host page cache
+// DISK_MEMORY opens the memory disk called filename, no file is touched
+// a comma separated list of files opens a disk striped over them, see setDiskStripe
+int openDiskFlags(char *filename, int nBytes, int flags){
+    if (strlen(filename) > DISK_NAME_MAX){
+        printf("Error: disk name too long\n");
+        return -1; // ERROR CODE, name too long
+    }
+
+    int diskIdx = 0;
+    while (diskIdx < MAX_DISKS && disks[diskIdx].open)
+        diskIdx++;
+    if (diskIdx == MAX_DISKS){
+        printf("Error: too many open disks\n");
+        return -1; // ERROR CODE, disk table full
+    }
+    diskEntry *d = disks+diskIdx;
+    memset(d, 0, sizeof(diskEntry));
+    d->crcFd = -1;
+    d->bufFd = -1;
+    d->verify = 1;
+    d->queued = -1;
+    if (flags & DISK_MEMORY)
+        return openMemoryDisk(d, filename, nBytes, flags) < 0 ? -1 : diskIdx+1;
+
+    if (nBytes != 0 && nBytes < BLOCKSIZE)
+        return -1; // ERROR CODE, block size too small
+    if (strchr(filename, ','))
+        return openStriped(d, filename, nBytes, flags) < 0 ? -1 : diskIdx+1;
+
+    int disk = openBackingFile(filename, nBytes / BLOCKSIZE, &d->nBlocks);
+    if (disk < 0)
+        return -1; // ERROR CODE, failed to open or create the disk file
+    d->fd = disk;
+    if (openChecksums(d, filename, nBytes != 0) < 0 || ((flags & DISK_DIRECT) && openDirect(d, filename) < 0)){
+        close(disk);
+        free(d->crcTable);
+        if (d->crcFd >= 0)
+            close(d->crcFd);
+        return -1; // ERROR CODE, failed to set up checksums or aligned buffers
+    }
+    d->open = 1;
+    return diskIdx+1;
+}
+
+int closeDisk(int disk){
+    diskEntry *d = getDisk(disk);
+    if (!d)
+        return -1; // ERROR CODE, disk not open
+    if (endDiskBatch(disk) < 0)
+        return -1; // ERROR CODE, failed to write held blocks
+    d->open = 0;
+    if (d->memory){
+        d->memory->openCount--;
+        d->memory = NULL;
+        return 0;
+    }
+    free(d->crcTable);
+    d->crcTable = NULL;
+    if (d->crcFd >= 0)
+        close(d->crcFd);
+    free(d->pool);
+    free(d->scratch);
+    d->pool = NULL;
+    d->scratch = NULL;
+    if (d->bufFd >= 0)
+        close(d->bufFd);
+    int i;
+    for (i=1;i<d->members;i++)
+        close(d->memberFd[i]);
+    if (close(d->fd) == -1){
+        perror("close");
+        return -1; // ERROR CODE, failed to close
+    }
+    return 0;
+}
+
+
+int readBlock(int disk, int bNum, void *block){
+    return readBlocks(disk, bNum, 1, block);
+}
+
+// reads nBlocks consecutive blocks starting at bNum with a single read
+// during a batch held blocks are copied from memory and the rest are read and held
+int readBlocks(int disk, int bNum, int nBlocks, void *blocks){
+    diskEntry *d = getDisk(disk);
+    if (!d || checkRange(d, bNum, nBlocks))
+        return -1; // ERROR CODE, bad disk or block
+    if (!d->held)
+        return readDisk(d, bNum, nBlocks, blocks);
+
+    unsigned char *out = blocks;
+    int b = 0;
+    while (b < nBlocks){
+        if (d->held[bNum+b]){
+            memcpy(out+b*BLOCKSIZE, d->held[bNum+b], BLOCKSIZE);
+            b++;
+            continue;
+        }
+        int run = 1;
+        while (b+run < nBlocks && !d->held[bNum+b+run])
+            run++;
+        if (readDisk(d, bNum+b, run, out+b*BLOCKSIZE))
+            return -1; // ERROR CODE, failed to read
+        if (holdBlocks(d, bNum+b, run, out+b*BLOCKSIZE, 0))
+            return -1; // ERROR CODE, no memory for held blocks
+        b += run;
+    }
+    return 0;
+}
+
+
+int writeBlock(int disk, int bNum, void *block){
+    return writeBlocks(disk, bNum, 1, block);
+}
+
+// writes nBlocks consecutive blocks starting at bNum with a single write
+// during a batch the blocks are only held in memory until endDiskBatch
+int writeBlocks(int disk, int bNum, int nBlocks, void *blocks){
+    diskEntry *d = getDisk(disk);
+    if (!d || checkRange(d, bNum, nBlocks))
+        return -1; // ERROR CODE, bad disk or block
+    if (d->held)
+        return holdBlocks(d, bNum, nBlocks, blocks, 1);
+    return writeDisk(d, bNum, nBlocks, blocks);
+}
+
+// turns checksum verification on reads on or off, checksums are still updated on writes
+// returns 1 if the disk has checksums
+int setDiskVerify(int disk, int verify){
+    diskEntry *d = getDisk(disk);
+    if (!d)
+        return -1; // ERROR CODE, disk not open
+    d->verify = verify;
+    return d->crcTable != NULL;
+}
+
+// times the I/O of a disk as if it went to the device model describes, NULL stops timing
+// the simulated time is added to the deviceNs stat, the I/O itself still goes to the disk
+int setDiskModel(int disk, diskModel *model){
+    diskEntry *d = getDisk(disk);
+    if (!d)
+        return -1; // ERROR CODE, disk not open
+    if (model && (model->latencyNs < 0 || model->seekNs < 0 || model->seekBlockNs < 0
+        || model->bytesPerSec < 0 || model->queueDepth < 0)){
+        printf("Error: invalid device model\n");
+        return -1; // ERROR CODE, negative model parameter
+    }
+    d->modeled = model != NULL;
+    if (model)
+        d->model = *model;
+    return 0;
+}
+
+// fills model with a typical device: "hdd" (7200 rpm disk), "ssd" (SATA flash) or "nvme"
+int getDiskModel(char *name, diskModel *model){
+    memset(model, 0, sizeof(diskModel));
+    if (!strcmp(name, "hdd")){
+        model->latencyNs = 100000;
+        model->seekNs = 5000000;
+        model->seekBlockNs = 20000;
+        model->bytesPerSec = 150000000;
+        model->queueDepth = 4;
+    }
+    else if (!strcmp(name, "ssd")){
+        model->latencyNs = 80000;
+        model->bytesPerSec = 500000000;
+        model->queueDepth = 32;
+    }
+    else if (!strcmp(name, "nvme")){
+        model->latencyNs = 20000;
+        model->bytesPerSec = 3000000000;
+        model->queueDepth = 64;
+    }
+    else{
+        printf("Error: unknown device model %s\n", name);
+        return -1; // ERROR CODE, unknown model name
+    }
+    return 0;
+}
+
+// sets the number of consecutive blocks a striped disk keeps on one member before the next,
+// a power of two up to DISK_MAX_STRIPE, it must be the unit the disk was written with
+// returns 1 if the disk is striped, 0 if it is a single file and the unit doesn't apply
+int setDiskStripe(int disk, int stripeBlocks){
+    diskEntry *d = getDisk(disk);
+    if (!d)
+        return -1; // ERROR CODE, disk not open
+    if (stripeBlocks < 1 || stripeBlocks > DISK_MAX_STRIPE || (stripeBlocks & (stripeBlocks-1))){
+        printf("Error: stripe unit must be a power of two up to %d blocks\n", DISK_MAX_STRIPE);
+        return -1; // ERROR CODE, invalid stripe unit
+    }
+    if (!d->members)
+        return 0;
+    d->stripeBlocks = stripeBlocks;
+    return 1;
+}
+
+// copies the I/O counters of a disk, blocks served from a batch aren't counted
+int getDiskStats(int disk, diskStats *stats){
+    diskEntry *d = getDisk(disk);
+    if (!d)
+        return -1; // ERROR CODE, disk not open
+    *stats = d->stats;
+    return 0;
+}
+
+// block I/O of every disk since the program started, including disks already closed
+void getTotalDiskStats(diskStats *stats){
+    *stats = totalStats;
+}
+
+// starts a batch, blocks read or written until endDiskBatch are kept in memory
+// so each block is read at most once and written at most once
+int beginDiskBatch(int disk){
+    diskEntry *d = getDisk(disk);
+    if (!d)
+        return -1; // ERROR CODE, disk not open
+    if (d->held)
+        return 0;
+    d->held = calloc(d->nBlocks, sizeof(unsigned char *));
+    d->heldDirty = calloc(d->nBlocks, 1);
+    if (!d->held || !d->heldDirty){
+        perror("calloc");
+        free(d->held);
+        free(d->heldDirty);
+        d->held = NULL;
+        d->heldDirty = NULL;
+        return -1; // ERROR CODE, no memory for held blocks
+    }
+    return 0;
+}
+
+// writes the held dirty blocks of a striped disk, every run goes in one lio_listio so the
+// runs on different members are written in parallel, run is a disk sized buffer
+static int flushStriped(diskEntry *d, unsigned char *run){
+    int unit = d->stripeBlocks;
+    int pieces = 0;
+    int b = 0;
+    while (b < d->nBlocks){
+        if (!d->heldDirty[b]){
+            b++;
+            continue;
+        }
+        int count = 0;
+        while (b+count < d->nBlocks && d->heldDirty[b+count]){
+            memcpy(run+(b+count)*BLOCKSIZE, d->held[b+count], BLOCKSIZE);
+            count++;
+        }
+        pieces += (b % unit + count + unit-1) / unit;
+        b += count;
+    }
+    if (!pieces)
+        return 0;
+
+    struct aiocb *cbs = calloc(pieces, sizeof(struct aiocb));
+    if (!cbs){
+        perror("calloc");
+        return -1; // ERROR CODE, no memory for the transfer list
+    }
+    int n = 0;
+    for (b=0;b<d->nBlocks;b++){
+        if (d->heldDirty[b] && (b == 0 || !d->heldDirty[b-1])){
+            int count = 1;
+            while (b+count < d->nBlocks && d->heldDirty[b+count])
+                count++;
+            n += stripePieces(d, b, count, run+b*BLOCKSIZE, 1, cbs+n);
+        }
+    }
+    int retVal = stripeSubmit(cbs, pieces, 1);
+    free(cbs);
+
+    // each run counts as a write call, as it would without the shared submit
+    for (b=0;b<d->nBlocks && !retVal;b++){
+        if (d->heldDirty[b] && (b == 0 || !d->heldDirty[b-1])){
+            int count = 1;
+            while (b+count < d->nBlocks && d->heldDirty[b+count])
+                count++;
+            retVal = wroteDisk(d, b, count, run+b*BLOCKSIZE);
+        }
+    }
+    return retVal;
+}
+
+// ends a batch, writes the blocks changed during it with one write per run of consecutive blocks
+// on a striped disk all runs are issued together, see flushStriped
+int endDiskBatch(int disk){
+    diskEntry *d = getDisk(disk);
+    if (!d)
+        return -1; // ERROR CODE, disk not open
+    if (!d->held)
+        return 0;
+
+    int retVal = 0;
+    unsigned char *run = malloc(d->nBlocks * BLOCKSIZE);
+    if (!run){
+        perror("malloc");
+        retVal = -1; // ERROR CODE, no memory to write held blocks
+    }
+    int b = 0;
+    d->queued = 0;
+    if (run && d->members)
+        retVal = flushStriped(d, run);
+    while (run && !d->members && b < d->nBlocks){
+        if (!d->heldDirty[b]){
+            b++;
+            continue;
+        }
+        int count = 0;
+        while (b+count < d->nBlocks && d->heldDirty[b+count]){
+            memcpy(run+count*BLOCKSIZE, d->held[b+count], BLOCKSIZE);
+            count++;
+        }
+        if (writeDisk(d, b, count, run)){
+            retVal = -1; // ERROR CODE, failed to write held blocks
+            break;
+        }
+        b += count;
+    }
+    d->queued = -1;
+    free(run);
+
+    for (b=0;b<d->nBlocks;b++)
+        free(d->held[b]);
+    free(d->held);
+    free(d->heldDirty);
+    d->held = NULL;
+    d->heldDirty = NULL;
+    return retVal;
+}
+
+// loads the file filename into the memory disk called name with one streaming read
+// the blocks are verified against the file's checksums when it has them
+int loadMemoryDisk(char *name, char *filename, int flags){
+    if (strlen(name) > DISK_NAME_MAX || strlen(filename) > DISK_NAME_MAX){
+        printf("Error: disk name too long\n");
+        return -1; // ERROR CODE, name too long
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        perror("open");
+        return -1; // ERROR CODE, file doesn't exist
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < BLOCKSIZE){
+        printf("Error: %s is not a disk image\n", filename);
+        close(fd);
+        return -1; // ERROR CODE, not a disk image
+    }
+    memoryDisk *m = createMemoryDisk(name, st.st_size / BLOCKSIZE, flags & DISK_HUGE);
+    if (!m){
+        close(fd);
+        return -1; // ERROR CODE, failed to create memory disk
+    }
+    size_t size = (size_t)m->nBlocks*BLOCKSIZE;
+    size_t done = 0;
+    while (done < size){
+        ssize_t n = read(fd, m->data+done, size-done);
+        if (n <= 0){
+            perror("read");
+            close(fd);
+            freeMemoryDisk(m);
+            return -1; // ERROR CODE, failed to read image
+        }
+        done += n;
+    }
+    close(fd);
+
+    // a temporary entry to reuse the checksum file handling
+    diskEntry d;
+    memset(&d, 0, sizeof(diskEntry));
+    d.nBlocks = m->nBlocks;
+    d.verify = 1;
+    int retVal = openChecksums(&d, filename, 0);
+    if (retVal == 0)
+        retVal = verifyChecksums(&d, 0, m->nBlocks, m->data);
+    free(d.crcTable);
+    if (d.crcFd >= 0)
+        close(d.crcFd);
+    if (retVal < 0){
+        freeMemoryDisk(m);
+        return -1; // ERROR CODE, corrupt image
+    }
+    return 0;
+}
+
+// writes the memory disk called name to the file filename with one streaming write
+// the checksum file next to it is rewritten to match
+int saveMemoryDisk(char *name, char *filename){
+    memoryDisk *m = findMemoryDisk(name);
+    if (!m){
+        printf("Error: no memory disk named %s\n", name);
+        return -1; // ERROR CODE, memory disk doesn't exist
+    }
+    if (strlen(filename) > DISK_NAME_MAX){
+        printf("Error: disk name too long\n");
+        return -1; // ERROR CODE, name too long
+    }
+    int fd = open(filename, O_CREAT|O_WRONLY|O_TRUNC, S_IRUSR|S_IWUSR);
+    if (fd < 0){
+        perror("open");
+        return -1; // ERROR CODE, failed to create file
+    }
+    size_t size = (size_t)m->nBlocks*BLOCKSIZE;
+    size_t done = 0;
+    while (done < size){
+        ssize_t n = write(fd, m->data+done, size-done);
+        if (n <= 0){
+            perror("write");
+            close(fd);
+            return -1; // ERROR CODE, failed to write image
+        }
+        done += n;
+    }
+    if (close(fd) < 0){
+        perror("close");
+        return -1; // ERROR CODE, failed to close image
+    }
+
+    diskEntry d;
+    memset(&d, 0, sizeof(diskEntry));
+    d.nBlocks = m->nBlocks;
+    int retVal = openChecksums(&d, filename, 1);
+    if (retVal == 0)
+        retVal = updateChecksums(&d, 0, m->nBlocks, m->data);
+    free(d.crcTable);
+    if (d.crcFd >= 0)
+        close(d.crcFd);
+    return retVal;
+}
+
+// frees the memory disk called name, it must not be open
+int dropMemoryDisk(char *name){
+    memoryDisk *m = findMemoryDisk(name);
+    if (!m){
+        printf("Error: no memory disk named %s\n", name);
+        return -1; // ERROR CODE, memory disk doesn't exist
+    }
+    if (m->openCount){
+        printf("Error: memory disk %s is open\n", name);
+        return -1; // ERROR CODE, disk in use
+    }
+    freeMemoryDisk(m);
+    return 0;
+}
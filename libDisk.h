@@ -1,9 +1,96 @@
 #ifndef LIBDISK_H
 #define LIBDISK_H
 
+#include <stdint.h>
+
+#define MAX_DISKS 16
+#define DISK_NAME_MAX 255
+
+#define DISK_DIRECT 0x01        // openDiskFlags: bypass the host page cache with O_DIRECT
+#define DISK_ALIGN 4096         // O_DIRECT offset, length and buffer alignment
+#define DISK_POOL_CHUNKS 16     // aligned chunks kept per direct disk for small I/O
+#define DISK_MEMORY 0x02        // openDiskFlags: the disk is a named image in memory, not a file
+#define DISK_HUGE 0x04          // memory disks are backed by huge pages when the host has them
+#define DISK_HUGE_PAGE (2*1024*1024)
+#define MAX_MEMORY_DISKS 16
+#define DISK_MAX_MEMBERS 8      // backing files of a striped disk, named as "a.dsk,b.dsk"
+#define DISK_STRIPE_BLOCKS 16   // default stripe unit, consecutive blocks kept on one member
+#define DISK_MAX_STRIPE 64      // largest stripe unit, members are sized in multiples of it
+
+// block I/O that reached the disk file since it was opened
+struct diskStats_s{
+    long reads;             // blocks read
+    long writes;            // blocks written
+    long readCalls;
+    long writeCalls;
+    long deviceNs;          // simulated device time, see setDiskModel
+} typedef diskStats;
+
+// storage device a disk is timed as, see setDiskModel and getDiskModel
+struct diskModel_s{
+    long latencyNs;         // cost of every disk call
+    long seekNs;            // extra cost of a call that doesn't start where the previous one ended
+    long seekBlockNs;       // extra cost per block between the two
+    long bytesPerSec;       // transfer rate, 0 for no transfer cost
+    int queueDepth;         // calls of one batch flush that are in flight together and share one latency
+    int sleep;              // sleep for the simulated time too, so wall clock time follows the device
+} typedef diskModel;
+
+// disk image kept in an anonymous memory region, it outlives closeDisk until dropped
+struct memoryDisk_s{
+    int used;
+    char name[DISK_NAME_MAX+1];
+    unsigned char *data;
+    size_t mapSize;         // bytes mapped, rounded up to the page size
+    int nBlocks;
+    int openCount;
+} typedef memoryDisk;
+
+struct diskEntry_s{
+    int open;
+    int fd;
+    int nBlocks;
+    uint32_t *crcTable;     // CRC32C per block, NULL if the disk has no checksum file
+    int crcFd;              // checksum file, kept next to the disk as <name>.crc
+    int verify;             // verify checksums on reads
+    unsigned char **held;   // blocks kept in memory during a batch, NULL when not batching
+    unsigned char *heldDirty;   // held blocks not yet written to disk
+    diskStats stats;
+    int direct;             // fd was opened with O_DIRECT, I/O goes through aligned buffers
+    int bufFd;              // page cache descriptor for the end of the disk that isn't a whole chunk
+    unsigned char *pool;    // DISK_POOL_CHUNKS aligned chunks, written through
+    int poolTag[DISK_POOL_CHUNKS];  // chunk held by each pool buffer, -1 if none
+    long poolAge[DISK_POOL_CHUNKS];
+    long poolClock;
+    unsigned char *scratch; // aligned buffer for transfers spanning several chunks
+    int scratchSize;
+    memoryDisk *memory;     // image of a DISK_MEMORY disk, NULL for files
+    diskModel model;
+    int modeled;            // I/O is timed on model
+    int head;               // block after the last one transferred, where a call needs no seek
+    int queued;             // calls issued so far by the batch flush in progress, -1 outside one
+    int members;            // backing files of a striped disk, 0 for a single file
+    int memberFd[DISK_MAX_MEMBERS];     // memberFd[0] is also fd
+    int stripeBlocks;       // stripe unit of a striped disk
+} typedef diskEntry;
+
 int openDisk(char *filename, int nBytes);
+int openDiskFlags(char *filename, int nBytes, int flags);
 int closeDisk(int disk);
 int readBlock(int disk, int bNum, void *block);
 int writeBlock(int disk, int bNum, void *block);
+int readBlocks(int disk, int bNum, int nBlocks, void *blocks);
+int writeBlocks(int disk, int bNum, int nBlocks, void *blocks);
+int setDiskVerify(int disk, int verify);
+int setDiskStripe(int disk, int stripeBlocks);
+int beginDiskBatch(int disk);
+int endDiskBatch(int disk);
+int getDiskStats(int disk, diskStats *stats);
+void getTotalDiskStats(diskStats *stats);
+int setDiskModel(int disk, diskModel *model);
+int getDiskModel(char *name, diskModel *model);
+int loadMemoryDisk(char *name, char *filename, int flags);
+int saveMemoryDisk(char *name, char *filename);
+int dropMemoryDisk(char *name);
 
-#endif
\ No newline at end of file
+#endif
@@ -5,21 +5,56 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include "tinyFS.h"
 #include "libTinyFS.h"
 #include "libDisk.h"
 #include "TinyFS_errno.h"
+#include "lz.h"
+#include "crc32c.h"
 
 // GLOBALS --------------------------------------------------------------------
 static int mount;
 static openFileTable fileTable;
+static inodeAttr attrCache[MAX_BLOCKS];
+static unsigned char superCache[BLOCKSIZE];     // copy of the superblock on disk
+static unsigned char freeLink[MAX_BLOCKS];      // free chain links, valid for free blocks
+static unsigned char statBlocks[MAX_BLOCKS*BLOCKSIZE];  // blocks tfs_statBulk read, at their block number
+static int numBlocks;
+static int pendingBytes;                        // buffered write bytes not yet on disk
+static uint16_t refCount[MAX_BLOCKS];           // file links to each data block
+static uint32_t ddHash[MAX_BLOCKS];             // payload hash of indexed data blocks
+static unsigned char ddNext[MAX_BLOCKS];        // next block in the same hash bucket
+static unsigned char ddIndexed[MAX_BLOCKS];
+static unsigned char *ddBuckets;                // first block of each hash bucket
+static int ddNumBuckets;
+static int ddCount;                             // blocks in the dedup index
+static int ddBudget = DD_DEFAULT_BUDGET;
+static int rootBlock;                           // root of the mounted tree, a snapshot root if read only
+static int readOnly;
+static int dataOffset = OFFSET_D_DATA;          // start of file bytes in a data block
+static int dataPayload = BLOCKSIZE-OFFSET_D_DATA;   // file bytes per data block
+static int diskFlags;                           // openDiskFlags flags for disks opened from now on
+static diskModel deviceModel;                   // device model for disks opened from now on
+static int deviceModeled;
+static int stripeBlocks = DISK_STRIPE_BLOCKS;   // stripe unit of striped disks made from now on
 
 // ESSENTIAL INTERFACE FUNCTIONS ----------------------------------------------
 
 // Allocates space for filesystem, formats superblock and root inode
 // Assigns rest of blocks as free
 int tfs_mkfs(char *filename, int nBytes){
+    return tfs_mkfsFeatures(filename, nBytes, 0);
+}
+
+// tfs_mkfs with format options, FEATURE_S_RAW_DATA stores data blocks without a header
+// so every data block holds BLOCKSIZE bytes of the file
+int tfs_mkfsFeatures(char *filename, int nBytes, int features){
+    if (features & ~FEATURE_S_RAW_DATA){
+        printf("Error: unknown format feature\n");
+        return ERR_INVALID_FS_SIZE;
+    }
     uint32_t nBlocks = nBytes / BLOCKSIZE;
     if (nBlocks < 2){
         printf("Error: tfs_mkfs nBytes too small to create file system\n");
@@ -31,7 +66,7 @@ int tfs_mkfs(char *filename, int nBytes){
     }
     
     int disk;
-    if ((disk = openDisk(filename, nBytes)) < 0)
+    if ((disk = openFsDisk(filename, nBytes)) < 0)
         return ERR_DISK_OPERATION;
 
     unsigned char blockTemp[BLOCKSIZE];
@@ -44,7 +79,10 @@ int tfs_mkfs(char *filename, int nBytes){
     blockTemp[OFFSET_LINK] = ROOT_BLOCK;    // root inode block
     if (nBlocks > 2)
         blockTemp[OFFSET_S_FREE] = 2;       // free block start
-    memcpy(blockTemp+OFFSET_S_SIZE, &nBlocks, LEN_S_SIZE);
+    blockTemp[OFFSET_S_FEATURES] = features;
+    if (setDiskStripe(disk, stripeBlocks) == 1)
+        blockTemp[OFFSET_S_STRIPE] = stripeBlocks;
+    setSuperSize(blockTemp, nBlocks);
     if (writeBlock(disk, b++, blockTemp))
         return ERR_DISK_OPERATION;
 
@@ -54,6 +92,7 @@ int tfs_mkfs(char *filename, int nBytes){
     blockTemp[OFFSET_MAGIC] = 0x44;         // magic number
     blockTemp[OFFSET_I_NAME] = '/';         // root name
     blockTemp[OFFSET_I_DIR] = 1;            // dir flag
+    blockTemp[OFFSET_I_FLAGS] = FLAG_I_HASHED;
     if (writeBlock(disk, b++, blockTemp))
         return ERR_DISK_OPERATION;
 
@@ -82,7 +121,7 @@ int tfs_mount(char *diskname){
             return ERR_DISK_OPERATION;
     }
 
-    if ((mount = openDisk(diskname, 0)) < 0){
+    if ((mount = openFsDisk(diskname, 0)) < 0){
         mount = 0;
         return ERR_DISK_OPERATION;
     }
@@ -91,64 +130,168 @@ int tfs_mount(char *diskname){
     unsigned char blockTemp[BLOCKSIZE];
     if (readBlock(mount, 0, blockTemp)){
         closeDisk(mount);
+        mount = 0;
         return ERR_DISK_OPERATION;
     }
     
-    uint32_t nBlocks;
-    memcpy(&nBlocks, blockTemp+OFFSET_S_SIZE, LEN_S_SIZE);
+    // block 0 is on the first member whatever the stripe unit, the rest needs the unit
+    if (blockTemp[OFFSET_S_STRIPE] && setDiskStripe(mount, blockTemp[OFFSET_S_STRIPE]) < 0){
+        closeDisk(mount);
+        mount = 0;
+        return ERR_DISK_OPERATION;
+    }
+
+    uint32_t nBlocks = getSuperSize(blockTemp);
     if (nBlocks < 2){
         printf("Error: tfs_mount number of blocks too small to mount file system\n");
         closeDisk(mount);
+        mount = 0;
         return ERR_INVALID_FS_SIZE;
     }
     if (nBlocks > 255){
         printf("Error: tfs_mount number of blocks must not exceed 255\n");
         closeDisk(mount);
+        mount = 0;
         return ERR_INVALID_FS_SIZE;
     }
-
-    // verify file system blocks
+    memcpy(superCache, blockTemp, BLOCKSIZE);
+    numBlocks = nBlocks;
+    setDataFormat(superCache[OFFSET_S_FEATURES]);
+    memset(refCount, 0, sizeof(refCount));
+    dedupReset();
+
+    // raw data blocks have no header to verify, they are found through the inodes linking them
+    unsigned char mark[MAX_BLOCKS];
+    memset(mark, 0, MAX_BLOCKS);
     int b;
+    if (superCache[OFFSET_S_FEATURES] & FEATURE_S_RAW_DATA){
+        int retVal = markTree(ROOT_BLOCK, mark);
+        for (b=0;retVal >= 0 && b<MAX_SNAPSHOTS;b++){
+            int snapRoot = superCache[OFFSET_S_SNAPS + b*LEN_S_SNAP + LEN_I_NAME];
+            if (snapRoot && snapRoot < nBlocks && !mark[snapRoot])
+                retVal = markTree(snapRoot, mark);
+        }
+        if (retVal < 0){
+            closeDisk(mount);
+            mount = 0;
+            return retVal;
+        }
+    }
+
+    // verify file system blocks, remember free chain links
+    // count file links to data blocks and index data blocks for dedup
     for (b=0;b<nBlocks;b++){
         if (readBlock(mount, b, blockTemp)){
             closeDisk(mount);
+            mount = 0;
             return ERR_DISK_OPERATION;
         }
+        if (mark[b] == MARK_DATA){
+            if (superCache[OFFSET_S_FEATURES] & FEATURE_S_DEDUP)
+                dedupInsert(b, dedupHash(blockTemp));
+            continue;
+        }
         if (b == 0 && blockTemp[OFFSET_TYPE] != TYPE_S){
             printf("Error: tfs_mount first block not superblock\n");
             closeDisk(mount);
+            mount = 0;
             return ERR_FS_INTEGRITY;
         }
         if (blockTemp[OFFSET_MAGIC] != 0x44){
             printf("Error: tfs_mount magic number not found\n");
             closeDisk(mount);
+            mount = 0;
             return ERR_FS_INTEGRITY;
         } 
+        if (blockTemp[OFFSET_TYPE] == TYPE_F)
+            freeLink[b] = blockTemp[OFFSET_LINK];
+        else if (blockTemp[OFFSET_TYPE] == TYPE_D && (superCache[OFFSET_S_FEATURES] & FEATURE_S_DEDUP))
+            dedupInsert(b, dedupHash(blockTemp+dataOffset));
+        else if (blockTemp[OFFSET_TYPE] == TYPE_I && !blockTemp[OFFSET_I_DIR]
+                && !(blockTemp[OFFSET_I_FLAGS] & FLAG_I_INLINE)){
+            int i;
+            for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++)
+                refCount[blockTemp[i+OFFSET_I_LINKS]]++;
+        }
     }
+    refCount[0] = 0;
 
-    // create open file table
-    fileTable.table = calloc(FT_SIZE_INC, sizeof(openFileEntry));
-    if (!fileTable.table){
-        perror("calloc");
-        return ERR_NO_MEMORY;
+    // data blocks nothing links to can't be shared
+    for (b=0;b<nBlocks;b++){
+        if (!refCount[b])
+            dedupRemove(b);
     }
-    fileTable.currSize = 0;
-    fileTable.maxSize = FT_SIZE_INC;
-    fileTable.nextFd = 1;
 
-    return 0;
+    rootBlock = ROOT_BLOCK;
+    readOnly = 0;
+    return createFileTable();
+}
+
+// mounts a snapshot read only, its files can be read while the live file system is in use
+// only the superblock is read, blocks a snapshot reaches are never changed in place
+int tfs_mountSnapshot(char *diskname, char *name){
+    if (mount){
+        if (tfs_unmount())
+            return ERR_DISK_OPERATION;
+    }
+
+    if ((mount = openFsDisk(diskname, 0)) < 0){
+        mount = 0;
+        return ERR_DISK_OPERATION;
+    }
+    if (readBlock(mount, 0, superCache)
+        || (superCache[OFFSET_S_STRIPE] && setDiskStripe(mount, superCache[OFFSET_S_STRIPE]) < 0)){
+        closeDisk(mount);
+        mount = 0;
+        return ERR_DISK_OPERATION;
+    }
+    uint32_t nBlocks = getSuperSize(superCache);
+    if (superCache[OFFSET_TYPE] != TYPE_S || superCache[OFFSET_MAGIC] != 0x44 || nBlocks < 2 || nBlocks > 255){
+        printf("Error: tfs_mountSnapshot superblock is damaged\n");
+        closeDisk(mount);
+        mount = 0;
+        return ERR_FS_INTEGRITY;
+    }
+    numBlocks = nBlocks;
+    setDataFormat(superCache[OFFSET_S_FEATURES]);
+
+    int snapIdx = findSnapshot(name);
+    if (snapIdx < 0){
+        printf("Error: snapshot not found\n");
+        closeDisk(mount);
+        mount = 0;
+        return ERR_FILE_NOT_FOUND;
+    }
+    rootBlock = superCache[OFFSET_S_SNAPS + snapIdx*LEN_S_SNAP + LEN_I_NAME];
+    readOnly = 1;
+    memset(refCount, 0, sizeof(refCount));
+    dedupReset();
+    return createFileTable();
 }
 
 // closes mount
 int tfs_unmount(void){
+    int retVal = flushAllPending();
+    if (retVal < 0)
+        return retVal;
+
     if (closeDisk(mount))
         return ERR_DISK_OPERATION; 
     
+    int i;
+    for (i=0;i<fileTable.maxSize;i++)
+        resetFileEntry(fileTable.table+i);
     free(fileTable.table);
     fileTable.currSize = 0;
     fileTable.maxSize = 0;
+    memset(attrCache, 0, sizeof(attrCache));
+    free(ddBuckets);
+    ddBuckets = NULL;
+    ddNumBuckets = 0;
+    ddCount = 0;
 
     mount = 0;
+    readOnly = 0;
     return 0;
 }
 
@@ -171,75 +314,63 @@ fileDescriptor tfs_openFile(char *name){
 }
 
 // close file, remove entry from open file table
+// buffered content is written to disk first
 int tfs_closeFile(fileDescriptor FD){
     int i = searchFileTable(FD);
     if (i < 0)
         return ERR_FD_NOT_FOUND;
-    fileTable.table[i].fd = 0;
-    fileTable.table[i].byteOffset = 0;
-    fileTable.table[i].inodeBlock = 0;
+    int retVal = flushFileEntry(fileTable.table+i);
+    resetFileEntry(fileTable.table+i);
+    if (retVal < 0)
+        return retVal;
     return 0;
 }
 
-// sets content of open file on disk to buffer, removes existing content
+// sets content of open file to buffer, removes existing content
+// content is buffered, blocks are allocated and written on close, fsync or buffer pressure
 int tfs_writeFile(fileDescriptor FD, char *buffer, int size){
     int tableIdx = searchFileTable(FD);
     if (tableIdx < 0)
         return ERR_FD_NOT_FOUND;
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
 
     else if (checkInodeExists(fileTable.table[tableIdx].inodeBlock) < 1){
         printf("Error: file descriptor points to invalid inode\n");
         return ERR_FILE_NOT_FOUND;
     }
 
-    unsigned char inodeBlock[BLOCKSIZE];
-    if (readBlock(mount, fileTable.table[tableIdx].inodeBlock, inodeBlock))
-        return ERR_DISK_OPERATION;
-
-    int retVal = deleteFileContent(fileTable.table[tableIdx].inodeBlock);
+    // compressed files are limited by what fits once compressed, checked on flush
+    inodeAttr attr;
+    int retVal = getInodeAttr(fileTable.table[tableIdx].inodeBlock, &attr);
     if (retVal < 0)
         return retVal;
-    
-    unsigned char dataBlock[BLOCKSIZE];
-    memset(dataBlock, 0, BLOCKSIZE);
-    dataBlock[OFFSET_TYPE] = TYPE_D;
-    dataBlock[OFFSET_MAGIC] = 0x44;
-    int dataBlockSize = BLOCKSIZE-OFFSET_D_DATA;
-    int dataStart = 0;
-
-    int linkOffset = OFFSET_I_LINKS;
-    while (linkOffset < BLOCKSIZE && dataStart < size){
-        if ((size-dataStart) < dataBlockSize){
-            dataBlockSize = size-dataStart;
-            memset(dataBlock+OFFSET_D_DATA,0,BLOCKSIZE-OFFSET_D_DATA);
-        }
-        
-        memcpy(dataBlock+OFFSET_D_DATA,buffer+dataStart,dataBlockSize);
-        int freeIdx = getFreeBlock();
-        if (freeIdx < 0)
-            return freeIdx;
-
-        if (writeBlock(mount, freeIdx, dataBlock))
-            return ERR_DISK_OPERATION;
-        
-        inodeBlock[linkOffset] = freeIdx;
-        dataStart = dataStart + dataBlockSize;
-        memcpy(inodeBlock+OFFSET_I_SIZE, &dataStart, LEN_I_SIZE);
-        if (writeBlock(mount, fileTable.table[tableIdx].inodeBlock, inodeBlock))
-            return ERR_DISK_OPERATION;
-        linkOffset++;
+    if (size > ((attr.flags & FLAG_I_COMPRESS) ? MAX_COMPRESS_SIZE : DIR_SLOTS*dataPayload)){
+        printf("Error: Inode ran out of space\n");
+        return ERR_FILE_SIZE_LIMIT;
     }
 
-    memcpy(inodeBlock+OFFSET_I_SIZE, &dataStart, LEN_I_SIZE);
-    if (writeBlock(mount, fileTable.table[tableIdx].inodeBlock, inodeBlock))
-        return ERR_DISK_OPERATION;
+    // content buffered through other descriptors is replaced by this write
+    openFileEntry *entry = fileTable.table+tableIdx;
+    discardPendingWrites(entry->inodeBlock, entry);
 
-    if (dataStart < size){
-        printf("Error: Inode ran out of space\n");
-        return ERR_FILE_SIZE_LIMIT;
+    char *newBuffer = realloc(entry->wBuffer, size ? size : 1);
+    if (!newBuffer){
+        perror("realloc");
+        return ERR_NO_MEMORY;
     }
-    fileTable.table[tableIdx].byteOffset = 0;
-    
+    if (entry->wDirty)
+        pendingBytes -= entry->wSize;
+    entry->wBuffer = newBuffer;
+    memcpy(entry->wBuffer, buffer, size);
+    entry->wSize = size;
+    entry->wDirty = 1;
+    entry->byteOffset = 0;
+    pendingBytes += size;
+    invalidateReadahead(entry->inodeBlock);
+
+    if (pendingBytes > WB_MAX_PENDING)
+        return flushAllPending();
     return 0;
 }
 
@@ -248,56 +379,150 @@ int tfs_deleteFile(fileDescriptor FD){
     int tableIdx = searchFileTable(FD);
     if (tableIdx < 0)
         return ERR_FD_NOT_FOUND;
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
 
     else if (checkInodeExists(fileTable.table[tableIdx].inodeBlock) < 1){
         printf("Error: file descriptor points to invalid inode\n");
         return ERR_FILE_NOT_FOUND;
     }
+    return deleteFileInode(fileTable.table[tableIdx].filename, fileTable.table[tableIdx].inodeBlock);
+}
 
-    int retVal = deleteFileContent(fileTable.table[tableIdx].inodeBlock);
-    if (retVal < 0)
-        return retVal;
+// reads a single byte from open file based on current file pointer
+int tfs_readByte(fileDescriptor FD, char *buffer){
+    int tableIdx = searchFileTable(FD);
+    if (tableIdx < 0)
+        return ERR_FD_NOT_FOUND;
 
-    retVal = deleteParentLinks(fileTable.table[tableIdx].filename, fileTable.table[tableIdx].inodeBlock);
+    // size and flags come from the attribute cache
+    openFileEntry *entry = fileTable.table+tableIdx;
+    int retVal = flushInode(entry->inodeBlock);
     if (retVal < 0)
         return retVal;
-    retVal = deleteBlock(fileTable.table[tableIdx].inodeBlock);
+    inodeAttr attr;
+    retVal = getInodeAttr(entry->inodeBlock, &attr);
     if (retVal < 0)
         return retVal;
+    if (!retVal){
+        printf("Error: file descriptor points to invalid inode\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+    if (entry->byteOffset >= attr.size){
+        printf("Error: end of file reached\n");
+        return ERR_EOF;
+    }
+
+    // compressed files are decompressed whole on the first read
+    if (attr.flags & FLAG_I_COMPRESSED){
+        retVal = loadCompressed(entry, attr.size);
+        if (retVal < 0)
+            return retVal;
+        buffer[0] = entry->zBuffer[entry->byteOffset];
+        entry->byteOffset++;
+        return 0;
+    }
+
+    if (attr.flags & FLAG_I_INLINE){
+        unsigned char inodeBlock[BLOCKSIZE];
+        if (readBlock(mount, entry->inodeBlock, inodeBlock))
+            return ERR_DISK_OPERATION;
+        buffer[0] = inodeBlock[OFFSET_I_LINKS + entry->byteOffset];
+        entry->byteOffset++;
+        return 0;
+    }
+
+    int blockOffset = entry->byteOffset / dataPayload;
+    int byteOffset = entry->byteOffset % dataPayload;
+
+    // only go to disk when the block has not been prefetched
+    if (blockOffset < entry->raFirst || blockOffset >= entry->raFirst+entry->raCount){
+        retVal = fillReadahead(entry, blockOffset, attr.size);
+        if (retVal < 0)
+            return retVal;
+    }
+
+    entry->byteOffset++;
+    buffer[0] = entry->raBuffer[(blockOffset-entry->raFirst)*BLOCKSIZE + dataOffset + byteOffset];
     return 0;
 }
 
-// reads a single byte from open file based on current file pointer
-int tfs_readByte(fileDescriptor FD, char *buffer){
+// reads up to size bytes from the file pointer into buffer, returns the number of bytes read
+// on raw data disks whole blocks inside the range are read straight into buffer,
+// the partial blocks at either end go through the readahead buffer
+int tfs_read(fileDescriptor FD, char *buffer, int size){
     int tableIdx = searchFileTable(FD);
     if (tableIdx < 0)
         return ERR_FD_NOT_FOUND;
 
-    else if (checkInodeExists(fileTable.table[tableIdx].inodeBlock) < 1){
+    openFileEntry *entry = fileTable.table+tableIdx;
+    int retVal = flushInode(entry->inodeBlock);
+    if (retVal < 0)
+        return retVal;
+    inodeAttr attr;
+    retVal = getInodeAttr(entry->inodeBlock, &attr);
+    if (retVal < 0)
+        return retVal;
+    if (!retVal || attr.isdir){
         printf("Error: file descriptor points to invalid inode\n");
         return ERR_FILE_NOT_FOUND;
     }
-
-    unsigned char inodeBlock[BLOCKSIZE];
-    if (readBlock(mount, fileTable.table[tableIdx].inodeBlock, inodeBlock))
-        return ERR_DISK_OPERATION;
-    uint32_t fileSize = 0;
-    memcpy(&fileSize, inodeBlock+OFFSET_I_SIZE, LEN_I_SIZE);
-    if (fileTable.table[tableIdx].byteOffset >= fileSize){
+    if (size < 0){
+        printf("Error: invalid read size\n");
+        return ERR_FILE_SIZE_LIMIT;
+    }
+    if (entry->byteOffset >= attr.size){
         printf("Error: end of file reached\n");
         return ERR_EOF;
     }
+    if (size > attr.size-entry->byteOffset)
+        size = attr.size-entry->byteOffset;
 
-    int blockOffset = fileTable.table[tableIdx].byteOffset / (BLOCKSIZE-OFFSET_D_DATA);
-    int byteOffset = fileTable.table[tableIdx].byteOffset % (BLOCKSIZE-OFFSET_D_DATA);
+    if (attr.flags & FLAG_I_COMPRESSED){
+        retVal = loadCompressed(entry, attr.size);
+        if (retVal < 0)
+            return retVal;
+        memcpy(buffer, entry->zBuffer+entry->byteOffset, size);
+        entry->byteOffset += size;
+        return size;
+    }
 
-    unsigned char dataBlock[BLOCKSIZE];
-    if (readBlock(mount, inodeBlock[OFFSET_I_LINKS+blockOffset], dataBlock))
+    unsigned char inodeBlock[BLOCKSIZE];
+    if (readBlock(mount, entry->inodeBlock, inodeBlock))
         return ERR_DISK_OPERATION;
-    
-    fileTable.table[tableIdx].byteOffset++;
-    buffer[0] = dataBlock[OFFSET_D_DATA + byteOffset];
-    return 0;
+    if (attr.flags & FLAG_I_INLINE){
+        memcpy(buffer, inodeBlock+OFFSET_I_LINKS+entry->byteOffset, size);
+        entry->byteOffset += size;
+        return size;
+    }
+
+    int done = 0;
+    while (done < size){
+        int blockOffset = entry->byteOffset / dataPayload;
+        int byteOffset = entry->byteOffset % dataPayload;
+        int whole = (size-done) / dataPayload;
+        if (!dataOffset && !byteOffset && whole){
+            retVal = readDataBlocks(inodeBlock+OFFSET_I_LINKS+blockOffset, whole, (unsigned char *)buffer+done);
+            if (retVal < 0)
+                return retVal;
+            done += whole*dataPayload;
+            entry->byteOffset += whole*dataPayload;
+            continue;
+        }
+
+        if (blockOffset < entry->raFirst || blockOffset >= entry->raFirst+entry->raCount){
+            retVal = fillReadahead(entry, blockOffset, attr.size);
+            if (retVal < 0)
+                return retVal;
+        }
+        int len = dataPayload-byteOffset;
+        if (len > size-done)
+            len = size-done;
+        memcpy(buffer+done, entry->raBuffer + (blockOffset-entry->raFirst)*BLOCKSIZE + dataOffset + byteOffset, len);
+        done += len;
+        entry->byteOffset += len;
+    }
+    return size;
 }
 
 // sets position of open file pointer to offset
@@ -311,10 +536,24 @@ int tfs_seek(fileDescriptor FD, int offset){
         return ERR_FILE_NOT_FOUND;
     }
 
-    fileTable.table[tableIdx].byteOffset = offset;
+    // random seeks collapse the readahead window
+    openFileEntry *entry = fileTable.table+tableIdx;
+    int blockOffset = offset / dataPayload;
+    if (blockOffset < entry->raFirst || blockOffset > entry->raFirst+entry->raCount)
+        entry->raWindow = RA_MIN_WINDOW;
+
+    entry->byteOffset = offset;
     return 0;
 }
 
+// writes buffered content of an open file to disk
+int tfs_fsync(fileDescriptor FD){
+    int tableIdx = searchFileTable(FD);
+    if (tableIdx < 0)
+        return ERR_FD_NOT_FOUND;
+    return flushFileEntry(fileTable.table+tableIdx);
+}
+
 // EXTRA INTERFACE FUNCTIONS --------------------------------------------------
 
 // creates a directory using absolute path
@@ -327,6 +566,8 @@ int tfs_createDir(char *dirName){
 
 // removes an empty directory inode and parent link to it
 int tfs_removeDir(char *dirName){
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
     int dirIdx = openInode(dirName, 0, 1);
     if (dirIdx < 0)
         return dirIdx;
@@ -355,7 +596,12 @@ int tfs_removeDir(char *dirName){
 
 // recursively removes directory and all subdirectories/files
 int tfs_removeAll(char *dirName){
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
     int dirIdx = openInode(dirName, 0, 1);
+    if (dirIdx < 0)
+        return dirIdx;
+    dirIdx = cowInode(dirIdx);
     if (dirIdx < 0)
         return dirIdx;
 
@@ -422,108 +668,1774 @@ int tfs_rename(fileDescriptor FD, char* newName){
     int i = searchFileTable(FD);
     if (i < 0)
         return ERR_FD_NOT_FOUND;
-
-    // get file inode
-    unsigned char blockTemp[BLOCKSIZE];
-    if (readBlock(mount, fileTable.table[i].inodeBlock, blockTemp))
-        return ERR_DISK_OPERATION;
-    
-    // set file name, write to disk
-    memcpy(blockTemp+OFFSET_I_NAME, newName, strlen(newName));
-    if (writeBlock(mount, fileTable.table[i].inodeBlock, blockTemp))
-        return ERR_DISK_OPERATION;
-    return 0;
+    return renamePath(fileTable.table[i].filename, newName);
 }
 
-// print filesystem from root
-int tfs_readdir(){
-    printf("(d)\t/\n");
-    return readdir("/");
-}
+// gets size and type of a file or directory using absolute path
+int tfs_stat(char *name, tfsStat *st){
+    int inodeIdx = rootBlock;
+    if (strcmp(name, "/")){
+        inodeIdx = openInode(name, 0, 0);
+        if (inodeIdx < 0)
+            return inodeIdx;
+    }
 
-// HELPER FUNCTIONS -----------------------------------------------------------
+    inodeAttr attr;
+    int retVal = getInodeAttr(inodeIdx, &attr);
+    if (retVal < 0)
+        return retVal;
+    if (!retVal){
+        printf("Error: tfs_stat path does not point to an inode\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+    fillStat(inodeIdx, &attr, st);
+    return 0;
+}
 
-// updates open file entry with inode location from disk
-int updateFileInodeNumber(fileDescriptor fd, int inodeIdx){
-    int i = searchFileTable(fd);
-    if (i < 0)
+// gets size and type of an open file
+int tfs_fstat(fileDescriptor FD, tfsStat *st){
+    int tableIdx = searchFileTable(FD);
+    if (tableIdx < 0)
         return ERR_FD_NOT_FOUND;
-    fileTable.table[i].inodeBlock = inodeIdx;
+
+    inodeAttr attr;
+    int retVal = getInodeAttr(fileTable.table[tableIdx].inodeBlock, &attr);
+    if (retVal < 0)
+        return retVal;
+    if (!retVal){
+        printf("Error: file descriptor points to invalid inode\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+    fillStat(fileTable.table[tableIdx].inodeBlock, &attr, st);
     return 0;
 }
 
-// searches directory on disk for filename
-// returns block index if found
-// returns 0 if not found
-int searchDir(char *filename, unsigned char *dirBlock){
-    // search for subpath
-    char testName[LEN_I_NAME+1];
-    memset(testName, 0, LEN_I_NAME+1);
-    unsigned char testBlock[BLOCKSIZE];
-    int testBlockNum;
-    int i = 0;
-    do {
-        testBlockNum = dirBlock[i + OFFSET_I_LINKS];
-        if (testBlockNum){
-            if (readBlock(mount, testBlockNum, testBlock))
-                return ERR_DISK_OPERATION;
-            memset(testName, 0, LEN_I_NAME+1);
-            memcpy(testName, testBlock+OFFSET_I_NAME, LEN_I_NAME);
+// stats many paths at once, a directory level at a time: the directories searched at a level
+// and then their uncached children are read in ascending block order before any name is
+// looked up, so the lookups themselves are served from the attribute cache
+// entries that fail have their error code in inodeBlock
+// returns number of paths successfully stat'd
+int tfs_statBulk(char **names, int count, tfsStat *st){
+    unsigned char *blocks = statBlocks;
+    int *dirs = malloc((count ? count : 1) * sizeof(int));
+    int *next = malloc((count ? count : 1) * sizeof(int));
+    if (!dirs || !next){
+        perror("malloc");
+        free(dirs);
+        free(next);
+        return ERR_NO_MEMORY;
+    }
+
+    // inodeBlock is 0 while a path is being resolved, next is where its next name starts
+    int pending = 0;
+    int i;
+    for (i=0;i<count;i++){
+        st[i].inodeBlock = strcmp(names[i], "/") ? 0 : rootBlock;
+        dirs[i] = rootBlock;
+        next[i] = names[i][0] == '/';
+        pending += !st[i].inodeBlock;
+    }
+
+    unsigned char loaded[MAX_BLOCKS];
+    unsigned char wanted[MAX_BLOCKS];
+    memset(loaded, 0, MAX_BLOCKS);
+    int retVal = 0;
+    while (pending && retVal >= 0){
+        memset(wanted, 0, MAX_BLOCKS);
+        for (i=0;i<count;i++){
+            if (!st[i].inodeBlock && !loaded[dirs[i]])
+                wanted[dirs[i]] = 1;
         }
-        i++;
-    } while (i+OFFSET_I_LINKS < BLOCKSIZE && strcmp(testName, filename));
+        retVal = loadBlocks(wanted, blocks, loaded);
+
+        int b, l;
+        memset(wanted, 0, MAX_BLOCKS);
+        for (b=0;b<MAX_BLOCKS && retVal >= 0;b++){
+            for (l=0;loaded[b] && l<DIR_SLOTS;l++){
+                int child = blocks[b*BLOCKSIZE+OFFSET_I_LINKS+l];
+                if (blocks[b*BLOCKSIZE+OFFSET_I_DIR] && child && !attrCache[child].valid && !loaded[child])
+                    wanted[child] = 1;
+            }
+        }
+        if (retVal >= 0)
+            retVal = loadBlocks(wanted, blocks, loaded);
+
+        for (i=0;i<count && retVal >= 0;i++){
+            if (st[i].inodeBlock)
+                continue;
+            char *name = names[i];
+            int start = next[i];
+            int end = start;
+            while (name[end] && name[end] != '/')
+                end++;
+            char subpath[LEN_I_NAME+1];
+            if (end-start > LEN_I_NAME || end == start){
+                printf("Error: invalid name\n");
+                st[i].inodeBlock = ERR_FILENAME;
+                pending--;
+                continue;
+            }
+            memcpy(subpath, name+start, end-start);
+            subpath[end-start] = '\0';
+
+            inodeAttr attr;
+            int found = searchDir(subpath, blocks+dirs[i]*BLOCKSIZE);
+            if (found < 0)
+                retVal = found;
+            else if (found && !name[end])
+                st[i].inodeBlock = found;
+            else if (found && getInodeAttr(found, &attr) == 1 && attr.isdir){
+                dirs[i] = found;
+                next[i] = end+1;
+                continue;
+            }
+            else{
+                printf("Error: path not found\n");
+                st[i].inodeBlock = ERR_FILE_NOT_FOUND;
+            }
+            pending--;
+        }
+    }
+    free(dirs);
+    free(next);
+    if (retVal < 0)
+        return retVal;
 
-    if (strcmp(testName, filename))
-        return 0;
-    else
-        return testBlockNum;
+    // fill results from the cache
+    int found = 0;
+    for (i=0;i<count;i++){
+        if (st[i].inodeBlock < 0)
+            continue;
+        inodeAttr attr;
+        retVal = getInodeAttr(st[i].inodeBlock, &attr);
+        if (retVal < 1){
+            st[i].inodeBlock = retVal < 0 ? retVal : ERR_FILE_NOT_FOUND;
+            continue;
+        }
+        fillStat(st[i].inodeBlock, &attr, st+i);
+        found++;
+    }
+    return found;
 }
 
-// removes parent directory links to filename/block
-int deleteParentLinks(char *filename, int blockIdx){
-    // move 1 up path, remove link
-    char parentPath[MAX_FILENAME+1];
-    memset(parentPath, 0, MAX_FILENAME+1);
-    memcpy(parentPath, filename, strlen(filename));
-    int lastDelim = strlen(parentPath);
-    while (lastDelim > 0 && parentPath[lastDelim] != '/')
-        lastDelim--;
-    
-    int parentIdx = ROOT_BLOCK;
-    // get path to parent
-    if (lastDelim){
-        parentPath[lastDelim] = '\0';
-        parentIdx = openInode(parentPath, 0, 1);
-        if (parentIdx < 0)
-            return parentIdx;
-    }
+// turns compression of an open file on or off
+// content already on disk is rewritten in the new form
+int tfs_setCompression(fileDescriptor FD, int on){
+    int tableIdx = searchFileTable(FD);
+    if (tableIdx < 0)
+        return ERR_FD_NOT_FOUND;
 
-    // set references to 0
-    unsigned char dirBlock[BLOCKSIZE];
-    if (readBlock(mount, parentIdx, dirBlock))
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    openFileEntry *entry = fileTable.table+tableIdx;
+    int retVal = flushInode(entry->inodeBlock);
+    if (retVal < 0)
+        return retVal;
+    retVal = cowInode(entry->inodeBlock);
+    if (retVal < 0)
+        return retVal;
+
+    unsigned char inodeBlock[BLOCKSIZE];
+    if (readBlock(mount, entry->inodeBlock, inodeBlock))
         return ERR_DISK_OPERATION;
-    int linkOffset;
-    for (linkOffset=0;(linkOffset+OFFSET_I_LINKS)<BLOCKSIZE;linkOffset++){
-        if (dirBlock[linkOffset+OFFSET_I_LINKS] == blockIdx)
-            dirBlock[linkOffset+OFFSET_I_LINKS] = 0;
+    if (inodeBlock[OFFSET_TYPE] != TYPE_I || inodeBlock[OFFSET_I_DIR]){
+        printf("Error: file descriptor points to invalid inode\n");
+        return ERR_FILE_NOT_FOUND;
     }
-    if (writeBlock(mount, parentIdx, dirBlock))
-        return ERR_DISK_OPERATION;
-    return 0;
-}
+    int flags = inodeBlock[OFFSET_I_FLAGS];
+    if (!(flags & FLAG_I_COMPRESS) == !on)
+        return 0;
 
-// traverses directories recursively and prints all files within them
-int readdir(char *dirName){
-    int dirIdx = openInode(dirName, 0, 1);
-    if (dirIdx < 0)
-        return dirIdx;
+    uint32_t size = getInodeSize(inodeBlock);
+    if (!on && size > DIR_SLOTS*dataPayload){
+        printf("Error: Inode ran out of space\n");
+        return ERR_FILE_SIZE_LIMIT;
+    }
 
-    unsigned char dirBlock[BLOCKSIZE];
-    if (readBlock(mount, dirIdx, dirBlock))
+    // read the old form before the flag changes
+    char *content = NULL;
+    if (size > 0){
+        content = malloc(size);
+        if (!content){
+            perror("malloc");
+            return ERR_NO_MEMORY;
+        }
+        retVal = readFileContent(entry->inodeBlock, content);
+        if (retVal < 0){
+            free(content);
+            return retVal;
+        }
+    }
+
+    inodeBlock[OFFSET_I_FLAGS] = on ? flags | FLAG_I_COMPRESS : flags & ~FLAG_I_COMPRESS;
+    if (writeBlock(mount, entry->inodeBlock, inodeBlock)){
+        free(content);
         return ERR_DISK_OPERATION;
+    }
+    cacheInodeAttr(entry->inodeBlock, inodeBlock);
+    if (!content)
+        return 0;
 
-    // print files with data first
-    unsigned char blockTemp[BLOCKSIZE];
+    // store the content again as a pending write of this entry
+    free(entry->wBuffer);
+    entry->wBuffer = content;
+    entry->wSize = size;
+    entry->wDirty = 1;
+    pendingBytes += size;
+    return flushFileEntry(entry);
+}
+
+// reserves data blocks for a file to grow to size bytes, taken from the allocator in one call
+// so they are contiguous when a long enough run of free blocks exists
+// they are written as empty data blocks and linked after the file's content, whose size
+// doesn't change, and later writes of the file fill them before new blocks are allocated
+// inline content moves into the first of them
+int tfs_fallocate(fileDescriptor FD, int size){
+    int tableIdx = searchFileTable(FD);
+    if (tableIdx < 0)
+        return ERR_FD_NOT_FOUND;
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    if (size < 0 || size > DIR_SLOTS*dataPayload){
+        printf("Error: Inode ran out of space\n");
+        return ERR_FILE_SIZE_LIMIT;
+    }
+    openFileEntry *entry = fileTable.table+tableIdx;
+    int retVal = flushInode(entry->inodeBlock);
+    if (retVal < 0)
+        return retVal;
+    int inodeIdx = cowInode(entry->inodeBlock);
+    if (inodeIdx < 0)
+        return inodeIdx;
+
+    unsigned char inodeBlock[BLOCKSIZE];
+    if (readBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+    if (inodeBlock[OFFSET_TYPE] != TYPE_I || inodeBlock[OFFSET_I_DIR]){
+        printf("Error: file descriptor points to invalid inode\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+    unsigned char *links = inodeBlock+OFFSET_I_LINKS;
+    int isInline = inodeBlock[OFFSET_I_FLAGS] & FLAG_I_INLINE;
+    int have = 0;
+    while (!isInline && have < DIR_SLOTS && links[have])
+        have++;
+    int needed = (size + dataPayload-1) / dataPayload;
+    if (needed <= have)
+        return 0;
+
+    int count = needed-have;
+    unsigned char newLinks[DIR_SLOTS];
+    char *content = calloc(count, dataPayload);
+    if (!content){
+        perror("calloc");
+        return ERR_NO_MEMORY;
+    }
+    if (isInline)
+        memcpy(content, links, MAX_INLINE_SIZE);
+    retVal = allocBlocks(count, newLinks);
+    if (retVal >= 0)
+        retVal = writeDataBlocks(content, count*dataPayload, newLinks, count);
+    free(content);
+    if (retVal < 0)
+        return retVal;
+
+    if (isInline)
+        memset(links, 0, DIR_SLOTS);
+    int i;
+    for (i=0;i<count;i++){
+        links[have+i] = newLinks[i];
+        refCount[newLinks[i]]++;
+    }
+    inodeBlock[OFFSET_I_FLAGS] &= ~FLAG_I_INLINE;
+    inodeBlock[OFFSET_I_FLAGS] |= FLAG_I_RESERVED;
+    invalidateReadahead(inodeIdx);
+    if (writeBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+    cacheInodeAttr(inodeIdx, inodeBlock);
+    return 0;
+}
+
+// sets the size of a file to newSize bytes, keeping the content before it
+// shrinking frees only the data blocks past the new end, reserved ones with them, and
+// growing adds zero bytes in the blocks the file already links before allocating more
+// buffered content is cut or padded in memory, compressed content is stored again
+// since an lz stream can't be cut short
+int tfs_ftruncate(fileDescriptor FD, int newSize){
+    int tableIdx = searchFileTable(FD);
+    if (tableIdx < 0)
+        return ERR_FD_NOT_FOUND;
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    openFileEntry *entry = fileTable.table+tableIdx;
+    if (checkInodeExists(entry->inodeBlock) < 1){
+        printf("Error: file descriptor points to invalid inode\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+    inodeAttr attr;
+    int retVal = getInodeAttr(entry->inodeBlock, &attr);
+    if (retVal < 0)
+        return retVal;
+    if (newSize < 0 || newSize > ((attr.flags & FLAG_I_COMPRESS) ? MAX_COMPRESS_SIZE : DIR_SLOTS*dataPayload)){
+        printf("Error: Inode ran out of space\n");
+        return ERR_FILE_SIZE_LIMIT;
+    }
+
+    // content not on disk yet is resized where it is buffered
+    int i;
+    for (i=0;i<fileTable.maxSize;i++){
+        openFileEntry *pending = fileTable.table+i;
+        if (!pending->fd || !pending->wDirty || pending->inodeBlock != entry->inodeBlock)
+            continue;
+        char *newBuffer = realloc(pending->wBuffer, newSize ? newSize : 1);
+        if (!newBuffer){
+            perror("realloc");
+            return ERR_NO_MEMORY;
+        }
+        if (newSize > pending->wSize)
+            memset(newBuffer+pending->wSize, 0, newSize-pending->wSize);
+        pendingBytes += newSize - pending->wSize;
+        pending->wBuffer = newBuffer;
+        pending->wSize = newSize;
+        invalidateReadahead(entry->inodeBlock);
+        if (pendingBytes > WB_MAX_PENDING)
+            return flushAllPending();
+        return 0;
+    }
+
+    int inodeIdx = cowInode(entry->inodeBlock);
+    if (inodeIdx < 0)
+        return inodeIdx;
+    unsigned char inodeBlock[BLOCKSIZE];
+    if (readBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+    if (inodeBlock[OFFSET_TYPE] != TYPE_I || inodeBlock[OFFSET_I_DIR]){
+        printf("Error: file descriptor points to invalid inode\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+    int size = getInodeSize(inodeBlock);
+    int flags = inodeBlock[OFFSET_I_FLAGS];
+    if (newSize == size)
+        return 0;
+
+    // compressed content, and inline content growing out of the inode, are stored again
+    if ((flags & FLAG_I_COMPRESSED) || newSize > DIR_SLOTS*dataPayload
+        || ((flags & FLAG_I_INLINE) && newSize > MAX_INLINE_SIZE)){
+        char *content = calloc(size > newSize ? size : newSize, 1);
+        if (!content){
+            perror("calloc");
+            return ERR_NO_MEMORY;
+        }
+        retVal = readFileContent(inodeIdx, content);
+        if (retVal < 0){
+            free(content);
+            return retVal;
+        }
+        free(entry->wBuffer);
+        entry->wBuffer = content;
+        entry->wSize = newSize;
+        entry->wDirty = 1;
+        pendingBytes += newSize;
+        return flushFileEntry(entry);
+    }
+
+    unsigned char *links = inodeBlock+OFFSET_I_LINKS;
+    invalidateReadahead(inodeIdx);
+    if (flags & FLAG_I_INLINE){
+        if (newSize > size)
+            memset(links+size, 0, newSize-size);
+    }
+    else if (newSize < size){
+        int keep = (newSize + dataPayload-1) / dataPayload;
+        int have = keep;
+        while (have < DIR_SLOTS && links[have])
+            have++;
+        retVal = freeBlocks(links+keep, have-keep);
+        if (retVal < 0)
+            return retVal;
+        memset(links+keep, 0, have-keep);
+        inodeBlock[OFFSET_I_FLAGS] &= ~FLAG_I_RESERVED;
+    }
+    else{
+        retVal = zeroFillBlocks(inodeBlock, size, newSize);
+        if (retVal < 0)
+            return retVal;
+    }
+    if (!newSize){
+        memset(links, 0, DIR_SLOTS);
+        inodeBlock[OFFSET_I_FLAGS] &= ~FLAG_I_INLINE;
+    }
+    setInodeSize(inodeBlock, newSize);
+    if (writeBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+    cacheInodeAttr(inodeIdx, inodeBlock);
+    return 0;
+}
+
+// turns deduplication of new data blocks on or off, saved in the superblock
+// identical payloads are linked from every file that has them instead of written again
+// budget / DD_ENTRY_SIZE sets the number of hash buckets, at most MAX_BLOCKS, which also caps
+// how many blocks are indexed, the per block hashes and chain links are static arrays that
+// don't shrink with it, 0 keeps the current budget
+int tfs_setDedup(int on, int budget){
+    if (!mount){
+        printf("Error: no file system mounted\n");
+        return ERR_DISK_OPERATION;
+    }
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    if (budget > 0)
+        ddBudget = budget;
+
+    int features = superCache[OFFSET_S_FEATURES];
+    if (on)
+        features |= FEATURE_S_DEDUP | FEATURE_S_SHARED;
+    else
+        features &= ~FEATURE_S_DEDUP;
+    if (features != superCache[OFFSET_S_FEATURES]){
+        superCache[OFFSET_S_FEATURES] = features;
+        if (writeBlock(mount, 0, superCache))
+            return ERR_DISK_OPERATION;
+    }
+    return dedupRebuild();
+}
+
+// freezes the current state of the file system as snapshot name
+// only the root inode is copied, every other block in use is shared with the live file system
+// and copied to a new block when the live file system changes it
+int tfs_snapshot(char *name){
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    if (strlen(name) > LEN_I_NAME || strlen(name) == 0){
+        printf("Error: invalid name\n");
+        return ERR_FILENAME;
+    }
+    if (findSnapshot(name) >= 0){
+        printf("Error: snapshot already exists\n");
+        return ERR_FILENAME;
+    }
+    int slot = 0;
+    while (slot < MAX_SNAPSHOTS && superCache[OFFSET_S_SNAPS + slot*LEN_S_SNAP + LEN_I_NAME])
+        slot++;
+    if (slot == MAX_SNAPSHOTS){
+        printf("Error: no free snapshot entry\n");
+        return ERR_FILE_SIZE_LIMIT;
+    }
+
+    // buffered content belongs to the snapshot
+    int retVal = flushAllPending();
+    if (retVal < 0)
+        return retVal;
+
+    unsigned char rootCopy[BLOCKSIZE];
+    if (readBlock(mount, ROOT_BLOCK, rootCopy))
+        return ERR_DISK_OPERATION;
+    int copyIdx = getFreeBlock();
+    if (copyIdx < 0)
+        return copyIdx;
+    if (writeBlock(mount, copyIdx, rootCopy))
+        return ERR_DISK_OPERATION;
+    cacheInodeAttr(copyIdx, rootCopy);
+
+    // freeze every block that isn't free, the live root stays writable
+    unsigned char isFree[MAX_BLOCKS];
+    memset(isFree, 0, MAX_BLOCKS);
+    int b = superCache[OFFSET_S_FREE];
+    int n = 0;
+    while (b && n++ < numBlocks){
+        isFree[b] = 1;
+        b = freeLink[b];
+    }
+    for (b=ROOT_BLOCK+1;b<numBlocks;b++){
+        if (!isFree[b])
+            superCache[OFFSET_S_FROZEN + b/8] |= 1 << (b%8);
+    }
+
+    unsigned char *entry = superCache + OFFSET_S_SNAPS + slot*LEN_S_SNAP;
+    memset(entry, 0, LEN_I_NAME);
+    memcpy(entry, name, strlen(name));
+    entry[LEN_I_NAME] = copyIdx;
+    if (writeBlock(mount, 0, superCache))
+        return ERR_DISK_OPERATION;
+    return 0;
+}
+
+// deletes snapshot name, blocks no other snapshot or the live file system reaches are freed
+int tfs_deleteSnapshot(char *name){
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    int snapIdx = findSnapshot(name);
+    if (snapIdx < 0){
+        printf("Error: snapshot not found\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+    unsigned char *entry = superCache + OFFSET_S_SNAPS + snapIdx*LEN_S_SNAP;
+    int snapRoot = entry[LEN_I_NAME];
+    memset(entry, 0, LEN_S_SNAP);
+
+    // blocks stay frozen while another snapshot reaches them
+    unsigned char live[MAX_BLOCKS], frozen[MAX_BLOCKS], dropped[MAX_BLOCKS];
+    memset(live, 0, MAX_BLOCKS);
+    memset(frozen, 0, MAX_BLOCKS);
+    memset(dropped, 0, MAX_BLOCKS);
+    int retVal = markTree(ROOT_BLOCK, live);
+    int i;
+    for (i=0;retVal >= 0 && i<MAX_SNAPSHOTS;i++){
+        int otherRoot = superCache[OFFSET_S_SNAPS + i*LEN_S_SNAP + LEN_I_NAME];
+        if (otherRoot)
+            retVal = markTree(otherRoot, frozen);
+    }
+    if (retVal >= 0)
+        retVal = markTree(snapRoot, dropped);
+    if (retVal < 0)
+        return retVal;
+    memset(superCache+OFFSET_S_FROZEN, 0, LEN_S_FROZEN);
+    int b;
+    for (b=ROOT_BLOCK+1;b<numBlocks;b++){
+        if (frozen[b])
+            superCache[OFFSET_S_FROZEN + b/8] |= 1 << (b%8);
+    }
+    if (writeBlock(mount, 0, superCache))
+        return ERR_DISK_OPERATION;
+
+    // free inodes only the deleted snapshot reached, data blocks go with their last link
+    unsigned char inodeBlock[BLOCKSIZE];
+    for (b=ROOT_BLOCK+1;b<numBlocks;b++){
+        if (dropped[b] != MARK_INODE || live[b] || frozen[b])
+            continue;
+        if (readBlock(mount, b, inodeBlock))
+            return ERR_DISK_OPERATION;
+        if (!inodeBlock[OFFSET_I_DIR]){
+            retVal = freeDataBlocks(inodeBlock);
+            if (retVal < 0)
+                return retVal;
+        }
+        retVal = deleteBlock(b);
+        if (retVal < 0)
+            return retVal;
+    }
+    return 0;
+}
+
+// makes dst a copy of file src, dst is created if it doesn't exist
+// the copy links the same data blocks as src, which stay shared until either file is rewritten
+int tfs_copy(char *src, char *dst){
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    int srcIdx = openInode(src, 0, 0);
+    if (srcIdx < 0)
+        return srcIdx;
+    int retVal = flushInode(srcIdx);
+    if (retVal < 0)
+        return retVal;
+    // flushing a frozen inode moves it
+    srcIdx = openInode(src, 0, 0);
+    if (srcIdx < 0)
+        return srcIdx;
+    unsigned char srcBlock[BLOCKSIZE];
+    retVal = readFileInode(srcIdx, srcBlock);
+    if (retVal < 0)
+        return retVal;
+
+    int dstIdx = openInode(dst, 1, 0);
+    if (dstIdx < 0)
+        return dstIdx;
+    if (dstIdx == srcIdx)
+        return 0;
+    // content buffered for dst is replaced by the copy
+    discardPendingWrites(dstIdx, NULL);
+    dstIdx = cowInode(dstIdx);
+    if (dstIdx < 0)
+        return dstIdx;
+    unsigned char dstBlock[BLOCKSIZE];
+    retVal = readFileInode(dstIdx, dstBlock);
+    if (retVal < 0)
+        return retVal;
+    retVal = freeDataBlocks(dstBlock);
+    if (retVal < 0)
+        return retVal;
+
+    dstBlock[OFFSET_I_FLAGS] = srcBlock[OFFSET_I_FLAGS];
+    setInodeSize(dstBlock, getInodeSize(srcBlock));
+    memcpy(dstBlock+OFFSET_I_LINKS, srcBlock+OFFSET_I_LINKS, BLOCKSIZE-OFFSET_I_LINKS);
+    if (!(srcBlock[OFFSET_I_FLAGS] & FLAG_I_INLINE) && srcBlock[OFFSET_I_LINKS]){
+        int i;
+        for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+            if (srcBlock[i+OFFSET_I_LINKS])
+                refCount[srcBlock[i+OFFSET_I_LINKS]]++;
+        }
+        // tfsck accepts data blocks linked from several files once this is set
+        if (!(superCache[OFFSET_S_FEATURES] & FEATURE_S_SHARED)){
+            superCache[OFFSET_S_FEATURES] |= FEATURE_S_SHARED;
+            if (writeBlock(mount, 0, superCache))
+                return ERR_DISK_OPERATION;
+        }
+    }
+    if (writeBlock(mount, dstIdx, dstBlock))
+        return ERR_DISK_OPERATION;
+    cacheInodeAttr(dstIdx, dstBlock);
+    invalidateReadahead(dstIdx);
+    return 0;
+}
+
+// writes the whole content of an open file to a host file descriptor, at the host descriptor's
+// offset, the file's offset is neither used nor moved
+// the content is read into memory by readFileContent, which reads data blocks in runs of
+// consecutive blocks, then written with as few calls as the host descriptor takes
+int tfs_export(fileDescriptor FD, int hostfd){
+    int tableIdx = searchFileTable(FD);
+    if (tableIdx < 0)
+        return ERR_FD_NOT_FOUND;
+    openFileEntry *entry = fileTable.table+tableIdx;
+    int retVal = flushInode(entry->inodeBlock);
+    if (retVal < 0)
+        return retVal;
+    inodeAttr attr;
+    retVal = getInodeAttr(entry->inodeBlock, &attr);
+    if (retVal < 0)
+        return retVal;
+    if (!retVal || attr.isdir){
+        printf("Error: file descriptor points to invalid inode\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+
+    char *content = malloc(attr.size ? attr.size : 1);
+    if (!content){
+        perror("malloc");
+        return ERR_NO_MEMORY;
+    }
+    retVal = readFileContent(entry->inodeBlock, content);
+    int done = 0;
+    while (retVal == 0 && done < attr.size){
+        ssize_t n = write(hostfd, content+done, attr.size-done);
+        if (n <= 0){
+            perror("write");
+            retVal = ERR_DISK_OPERATION;
+        }
+        else
+            done += n;
+    }
+    free(content);
+    return retVal;
+}
+
+// sets the content of file path to everything left to read from a host file descriptor
+// path is created if it doesn't exist, the content is written to disk before returning
+int tfs_import(int hostfd, char *path){
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    int cap = 64*1024;
+    int size = 0;
+    char *content = malloc(cap);
+    if (!content){
+        perror("malloc");
+        return ERR_NO_MEMORY;
+    }
+    while (1){
+        if (size == cap){
+            if (cap > MAX_COMPRESS_SIZE){
+                printf("Error: Inode ran out of space\n");
+                free(content);
+                return ERR_FILE_SIZE_LIMIT;
+            }
+            char *grown = realloc(content, cap*2);
+            if (!grown){
+                perror("realloc");
+                free(content);
+                return ERR_NO_MEMORY;
+            }
+            content = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(hostfd, content+size, cap-size);
+        if (n < 0){
+            perror("read");
+            free(content);
+            return ERR_DISK_OPERATION;
+        }
+        if (!n)
+            break;
+        size += n;
+    }
+
+    fileDescriptor fd = tfs_openFile(path);
+    int retVal = fd;
+    if (fd >= 0){
+        retVal = tfs_writeFile(fd, content, size);
+        int closeVal = tfs_closeFile(fd);
+        if (retVal == 0)
+            retVal = closeVal;
+    }
+    free(content);
+    return retVal;
+}
+
+// moves a file or directory to newPath, which may be in another directory
+// an existing file at newPath is replaced, its link is swapped for the moved inode in one write
+// takes the new parent, the moved inode and the old parent, one block write each in that order
+// the writes aren't atomic together, a crash between them is left for tfsck
+int tfs_move(char *oldPath, char *newPath){
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    char oldParent[MAX_FILENAME+1], newParent[MAX_FILENAME+1];
+    char oldName[LEN_I_NAME+1], newName[LEN_I_NAME+1];
+    int retVal = splitPath(oldPath, oldParent, oldName);
+    if (retVal < 0)
+        return retVal;
+    retVal = splitPath(newPath, newParent, newName);
+    if (retVal < 0)
+        return retVal;
+
+    int srcIdx = openInode(oldPath, 0, 0);
+    if (srcIdx < 0)
+        return srcIdx;
+    inodeAttr srcAttr, attr;
+    retVal = getInodeAttr(srcIdx, &srcAttr);
+    if (retVal < 1)
+        return retVal < 0 ? retVal : ERR_FILE_NOT_FOUND;
+
+    // the new parent must be a directory outside of a moved directory
+    int parentIdx = openInode(newParent, 0, 1);
+    if (parentIdx < 0)
+        return parentIdx;
+    if (getInodeAttr(parentIdx, &attr) < 1 || !attr.isdir){
+        printf("Error: path not found\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+    unsigned char path[MAX_BLOCKS];
+    if (srcAttr.isdir && findInodePath(srcIdx, parentIdx, path, 0) != 0){
+        printf("Error: can't move a directory into itself\n");
+        return ERR_FILENAME;
+    }
+
+    // frozen inodes on either path are copied first, which leaves the other path writable
+    srcIdx = cowInode(srcIdx);
+    if (srcIdx < 0)
+        return srcIdx;
+    parentIdx = cowInode(openInode(newParent, 0, 1));
+    if (parentIdx < 0)
+        return parentIdx;
+    int oldParentIdx = openInode(oldParent, 0, 1);
+    if (oldParentIdx < 0)
+        return oldParentIdx;
+
+    unsigned char dirBlock[BLOCKSIZE];
+    if (readBlock(mount, parentIdx, dirBlock))
+        return ERR_DISK_OPERATION;
+    int targetIdx = searchDir(newName, dirBlock);
+    if (targetIdx < 0)
+        return targetIdx;
+    if (targetIdx == srcIdx)
+        return 0;
+    if (targetIdx && (getInodeAttr(targetIdx, &attr) < 1 || attr.isdir || srcAttr.isdir)){
+        printf("Error: file already exists\n");
+        return ERR_DIR_EXISTS;
+    }
+
+    int sameParent = parentIdx == oldParentIdx;
+    if (!targetIdx && !sameParent && !memchr(dirBlock+OFFSET_I_LINKS, 0, DIR_SLOTS)){
+        printf("Error: Inode ran out of space\n");
+        return ERR_FILE_SIZE_LIMIT;
+    }
+
+    // a new name has another slot in a hashed directory, the link moves with one write
+    // the replaced file's slot is on the probe path of the name
+    if (!sameParent || targetIdx || (dirBlock[OFFSET_I_FLAGS] & FLAG_I_HASHED)){
+        if (sameParent)
+            retVal = removeDirLink(dirBlock, srcIdx);
+        if (retVal >= 0 && targetIdx){
+            int i;
+            for (i=0;i<DIR_SLOTS;i++){
+                if (dirBlock[i+OFFSET_I_LINKS] == targetIdx)
+                    dirBlock[i+OFFSET_I_LINKS] = srcIdx;
+            }
+        }
+        else if (retVal >= 0)
+            retVal = insertDirLink(dirBlock, newName, srcIdx);
+        if (retVal < 0)
+            return retVal;
+        if (writeBlock(mount, parentIdx, dirBlock))
+            return ERR_DISK_OPERATION;
+        cacheInodeAttr(parentIdx, dirBlock);
+    }
+
+    // the name goes after the link, so no crash leaves a replaced file and the moved one
+    // under the same name, until it is written a link moved in a hashed directory is
+    // found by neither name, tfsck reports it as off its probe path
+    retVal = renameInode(srcIdx, newName);
+    if (retVal < 0)
+        return retVal;
+
+    if (!sameParent){
+        if (readBlock(mount, oldParentIdx, dirBlock))
+            return ERR_DISK_OPERATION;
+        retVal = removeDirLink(dirBlock, srcIdx);
+        if (retVal < 0)
+            return retVal;
+        if (writeBlock(mount, oldParentIdx, dirBlock))
+            return ERR_DISK_OPERATION;
+        cacheInodeAttr(oldParentIdx, dirBlock);
+    }
+
+    renameOpenFiles(oldPath, newPath);
+    if (targetIdx){
+        retVal = deleteFileContent(targetIdx);
+        if (retVal < 0)
+            return retVal;
+        return deleteBlock(targetIdx);
+    }
+    return 0;
+}
+
+// sets the libDisk flags used by the next tfs_mkfs, tfs_mount and tfs_mountSnapshot
+// DISK_DIRECT bypasses the host page cache, so memory goes to the caches in this library
+// DISK_MEMORY keeps disks as named images in memory, see loadMemoryDisk and saveMemoryDisk
+int tfs_setDiskFlags(int flags){
+    if (flags & ~(DISK_DIRECT|DISK_MEMORY|DISK_HUGE)){
+        printf("Error: unknown disk flag\n");
+        return ERR_DISK_OPERATION;
+    }
+    diskFlags = flags;
+    return 0;
+}
+
+// sets the stripe unit in blocks of disks the next tfs_mkfs stripes over several files,
+// saved in the superblock so tfs_mount maps blocks the same way
+int tfs_setStripe(int blocks){
+    if (blocks < 1 || blocks > DISK_MAX_STRIPE || (blocks & (blocks-1))){
+        printf("Error: stripe unit must be a power of two up to %d blocks\n", DISK_MAX_STRIPE);
+        return ERR_DISK_OPERATION;
+    }
+    stripeBlocks = blocks;
+    return 0;
+}
+
+// times the disks of the next tfs_mkfs, tfs_mount and tfs_mountSnapshot on a device model,
+// NULL turns it off, tfs_diskStats reports the simulated time as deviceNs
+int tfs_setDiskModel(diskModel *model){
+    if (model && (model->latencyNs < 0 || model->seekNs < 0 || model->seekBlockNs < 0
+        || model->bytesPerSec < 0 || model->queueDepth < 0)){
+        printf("Error: invalid device model\n");
+        return ERR_DISK_OPERATION;
+    }
+    deviceModeled = model != NULL;
+    if (model)
+        deviceModel = *model;
+    return 0;
+}
+
+// copies the I/O counters of the mounted disk
+int tfs_diskStats(diskStats *stats){
+    if (!mount){
+        printf("Error: no file system mounted\n");
+        return ERR_DISK_OPERATION;
+    }
+    if (getDiskStats(mount, stats) < 0)
+        return ERR_DISK_OPERATION;
+    return 0;
+}
+
+// runs a list of create, mkdir, delete and rename operations in order
+// blocks are kept in memory during the batch, so shared parent directories are read once
+// and every changed block, including the superblock, is written once at the end
+// returns 0 if every operation succeeded, otherwise the first error, each result is in ops
+int tfs_batch(tfsBatchOp *ops, int count){
+    if (!mount){
+        printf("Error: no file system mounted\n");
+        return ERR_DISK_OPERATION;
+    }
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    if (beginDiskBatch(mount) < 0)
+        return ERR_DISK_OPERATION;
+
+    int retVal = 0;
+    int i;
+    for (i=0;i<count;i++){
+        ops[i].result = runBatchOp(ops+i);
+        if (ops[i].result < 0 && !retVal)
+            retVal = ops[i].result;
+    }
+    if (endDiskBatch(mount) < 0)
+        return ERR_DISK_OPERATION;
+    return retVal;
+}
+
+// print filesystem from root
+int tfs_readdir(){
+    printf("(d)\t/\n");
+    return readdir("/");
+}
+
+// relocates blocks so every file's data blocks are contiguous and ascending,
+// inodes follow their parent directory, and free space is one run at the end
+// stops after moveBudget block moves or msBudget milliseconds (0 for no limit), the scan
+// of the tree each call starts with counts against msBudget
+// returns number of blocks still out of place, 0 when the disk is defragmented
+int tfs_defrag(int moveBudget, int msBudget){
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    int retVal = flushAllPending();
+    if (retVal < 0)
+        return retVal;
+
+    defragMap *map = calloc(1, sizeof(defragMap));
+    if (!map){
+        perror("calloc");
+        return ERR_NO_MEMORY;
+    }
+    int b;
+    for (b=0;b<MAX_BLOCKS;b++){
+        map->planIdx[b] = -1;
+        if (isFrozen(b))
+            map->kind[b] = DF_SHARED;
+    }
+
+    // plan: each inode followed by its data blocks or its subtree
+    map->meta[ROOT_BLOCK] = malloc(BLOCKSIZE);
+    if (!map->meta[ROOT_BLOCK]){
+        perror("malloc");
+        retVal = ERR_NO_MEMORY;
+    }
+    else if (readBlock(mount, ROOT_BLOCK, map->meta[ROOT_BLOCK]))
+        retVal = ERR_DISK_OPERATION;
+    else
+        retVal = defragScan(map, ROOT_BLOCK);
+
+    // blocks the scan didn't reach that aren't on the free chain aren't reclaimed here
+    unsigned char onChain[MAX_BLOCKS];
+    memset(onChain, 0, MAX_BLOCKS);
+    int n = 0;
+    b = superCache[OFFSET_S_FREE];
+    while (b && n++ < numBlocks){
+        onChain[b] = 1;
+        b = freeLink[b];
+    }
+    for (b=ROOT_BLOCK+1;b<numBlocks;b++){
+        if (map->kind[b] == DF_FREE && !onChain[b])
+            map->kind[b] = DF_LOST;
+    }
+
+    // shared and lost blocks stay where they are, the plan fills the positions around them
+    int i;
+    int target = ROOT_BLOCK;
+    for (i=0;i<map->count;i++){
+        map->planIdx[map->order[i]] = i;
+        do
+            target++;
+        while (map->kind[target] == DF_SHARED || map->kind[target] == DF_LOST);
+        map->target[i] = target;
+    }
+
+    int moves = 0;
+    for (i=0;retVal >= 0 && i<map->count;i++){
+        target = map->target[i];
+        if (map->order[i] == target)
+            continue;
+        if (moveBudget && moves >= moveBudget)
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (msBudget && (now.tv_sec-start.tv_sec)*1000 + (now.tv_nsec-start.tv_nsec)/1000000 >= msBudget)
+            break;
+        retVal = defragSwap(map, map->order[i], target);
+        moves++;
+    }
+
+    if (retVal >= 0)
+        retVal = defragFreeChain(map);
+    if (retVal >= 0){
+        for (i=0;i<map->count;i++){
+            if (map->order[i] != map->target[i])
+                retVal++;
+        }
+    }
+
+    for (b=0;b<MAX_BLOCKS;b++)
+        free(map->meta[b]);
+    free(map);
+    return retVal;
+}
+
+// HELPER FUNCTIONS -----------------------------------------------------------
+
+// opens a disk with the flags and device model set by tfs_setDiskFlags and tfs_setDiskModel
+int openFsDisk(char *filename, int nBytes){
+    int disk = openDiskFlags(filename, nBytes, diskFlags);
+    if (disk < 0 || !deviceModeled)
+        return disk;
+    if (setDiskModel(disk, &deviceModel) < 0){
+        closeDisk(disk);
+        return -1;
+    }
+    return disk;
+}
+
+// starts a libDisk batch on the mounted disk, used to group calls made back to back
+int beginMountBatch(){
+    if (!mount)
+        return ERR_DISK_OPERATION;
+    if (beginDiskBatch(mount) < 0)
+        return ERR_DISK_OPERATION;
+    return 0;
+}
+
+// writes the blocks changed since beginMountBatch
+int endMountBatch(){
+    if (!mount || endDiskBatch(mount) < 0)
+        return ERR_DISK_OPERATION;
+    return 0;
+}
+
+// updates open file entry with inode location from disk
+int updateFileInodeNumber(fileDescriptor fd, int inodeIdx){
+    int i = searchFileTable(fd);
+    if (i < 0)
+        return ERR_FD_NOT_FOUND;
+    fileTable.table[i].inodeBlock = inodeIdx;
+    return 0;
+}
+
+// clears an open file entry and frees its readahead buffer
+void resetFileEntry(openFileEntry *entry){
+    if (entry->wDirty)
+        pendingBytes -= entry->wSize;
+    free(entry->wBuffer);
+    entry->wBuffer = NULL;
+    entry->wSize = 0;
+    entry->wDirty = 0;
+    entry->fd = 0;
+    entry->byteOffset = 0;
+    entry->inodeBlock = 0;
+    free(entry->raBuffer);
+    entry->raBuffer = NULL;
+    free(entry->zBuffer);
+    entry->zBuffer = NULL;
+    entry->zValid = 0;
+    entry->raFirst = 0;
+    entry->raCount = 0;
+    entry->raWindow = RA_MIN_WINDOW;
+}
+
+// prefetches data blocks of an open file starting at file block blockOffset
+// the window doubles while misses stay sequential and collapses otherwise
+// runs of consecutive block numbers are read with a single disk call
+int fillReadahead(openFileEntry *entry, int blockOffset, uint32_t fileSize){
+    if (!entry->raBuffer){
+        entry->raBuffer = malloc(RA_MAX_WINDOW*BLOCKSIZE);
+        if (!entry->raBuffer){
+            perror("malloc");
+            return ERR_NO_MEMORY;
+        }
+    }
+
+    if (entry->raCount && blockOffset == entry->raFirst+entry->raCount){
+        entry->raWindow *= 2;
+        if (entry->raWindow > RA_MAX_WINDOW)
+            entry->raWindow = RA_MAX_WINDOW;
+    }
+    else if (entry->raCount)
+        entry->raWindow = RA_MIN_WINDOW;
+    entry->raCount = 0;
+
+    int fileBlocks = (fileSize + dataPayload-1) / dataPayload;
+    int count = entry->raWindow;
+    if (count > fileBlocks-blockOffset)
+        count = fileBlocks-blockOffset;
+
+    unsigned char inodeBlock[BLOCKSIZE];
+    if (readBlock(mount, entry->inodeBlock, inodeBlock))
+        return ERR_DISK_OPERATION;
+    int retVal = readDataBlocks(inodeBlock+OFFSET_I_LINKS+blockOffset, count, entry->raBuffer);
+    if (retVal < 0)
+        return retVal;
+
+    entry->raFirst = blockOffset;
+    entry->raCount = count;
+    return 0;
+}
+
+// writes buffered content of an open file entry to disk
+// all data blocks are allocated in one call so the file can be placed contiguously
+// and the inode is written exactly once
+int flushFileEntry(openFileEntry *entry){
+    if (!entry->wDirty)
+        return 0;
+    int size = entry->wSize;
+    int inodeIdx = cowInode(entry->inodeBlock);
+    if (inodeIdx < 0)
+        return inodeIdx;
+
+    unsigned char inodeBlock[BLOCKSIZE];
+    if (readBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+
+    // compressed files store an lz stream behind its length when that is smaller
+    char *stored = entry->wBuffer;
+    int storedSize = size;
+    char *packed = NULL;
+    if ((inodeBlock[OFFSET_I_FLAGS] & FLAG_I_COMPRESS) && size > LEN_Z_SIZE+1){
+        packed = malloc(size);
+        if (!packed){
+            perror("malloc");
+            return ERR_NO_MEMORY;
+        }
+        int zSize = lzCompress((unsigned char *)entry->wBuffer, size,
+                               (unsigned char *)packed+LEN_Z_SIZE, size-LEN_Z_SIZE-1);
+        if (zSize > 0){
+            setZSize((unsigned char *)packed, zSize);
+            stored = packed;
+            storedSize = zSize+LEN_Z_SIZE;
+        }
+    }
+    if (storedSize > DIR_SLOTS*dataPayload){
+        printf("Error: Inode ran out of space\n");
+        free(packed);
+        return ERR_FILE_SIZE_LIMIT;
+    }
+
+    // a file with reserved blocks is rewritten in the blocks it owns, see tfs_fallocate
+    if (inodeBlock[OFFSET_I_FLAGS] & FLAG_I_RESERVED){
+        invalidateReadahead(inodeIdx);
+        inodeBlock[OFFSET_I_FLAGS] &= ~FLAG_I_COMPRESSED;
+        if (stored == packed)
+            inodeBlock[OFFSET_I_FLAGS] |= FLAG_I_COMPRESSED;
+        int retVal = storeReserved(inodeBlock, stored, storedSize);
+        free(packed);
+        if (retVal < 0)
+            return retVal;
+        return finishFlush(entry, inodeIdx, inodeBlock);
+    }
+
+    // payloads already on disk are linked instead of written when dedup is on
+    int needed = 0;
+    int newBlocks = 0;
+    unsigned char links[BLOCKSIZE-OFFSET_I_LINKS];
+    int sameAs[BLOCKSIZE-OFFSET_I_LINKS];
+    uint32_t hashes[BLOCKSIZE-OFFSET_I_LINKS];
+    int retVal;
+    if (storedSize > MAX_INLINE_SIZE){
+        needed = (storedSize + dataPayload-1) / dataPayload;
+        newBlocks = dedupMatch(stored, storedSize, needed, links, sameAs, hashes);
+        if (newBlocks < 0){
+            free(packed);
+            return newBlocks;
+        }
+    }
+
+    // check the new content fits before removing the old content
+    // old blocks only count as space if this file held their last link
+    int available = countFreeBlocks();
+    int i;
+    int unlinked[MAX_BLOCKS];
+    memset(unlinked, 0, sizeof(unlinked));
+    if (!(inodeBlock[OFFSET_I_FLAGS] & FLAG_I_INLINE)){
+        for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++)
+            unlinked[inodeBlock[i+OFFSET_I_LINKS]]++;
+    }
+    for (i=0;i<needed;i++)
+        unlinked[links[i]]--;
+    for (i=1;i<MAX_BLOCKS;i++){
+        if (unlinked[i] > 0 && unlinked[i] == refCount[i])
+            available++;
+    }
+    if (newBlocks > available){
+        printf("Error: no more free blocks\n");
+        free(packed);
+        return ERR_FILE_SIZE_LIMIT;
+    }
+
+    // link shared blocks before the old links go so they aren't freed in between
+    for (i=0;i<needed;i++){
+        if (links[i])
+            refCount[links[i]]++;
+    }
+    invalidateReadahead(inodeIdx);
+
+    // the new content is written and linked before the old blocks are freed so the inode
+    // on disk never links a free block, only when the old blocks are needed for room
+    // are they freed first and a failed write then leaves the file empty
+    unsigned char oldLinks[DIR_SLOTS];
+    int oldInline = inodeBlock[OFFSET_I_FLAGS] & FLAG_I_INLINE;
+    int freeFirst = newBlocks > countFreeBlocks();
+    memcpy(oldLinks, inodeBlock+OFFSET_I_LINKS, DIR_SLOTS);
+    retVal = 0;
+    if (freeFirst)
+        retVal = freeDataBlocks(inodeBlock);
+    else {
+        inodeBlock[OFFSET_I_FLAGS] &= ~FLAG_I_INLINE;
+        memset(inodeBlock+OFFSET_I_LINKS, 0, DIR_SLOTS);
+    }
+    if (retVal >= 0){
+        inodeBlock[OFFSET_I_FLAGS] &= ~FLAG_I_COMPRESSED;
+        if (stored == packed)
+            inodeBlock[OFFSET_I_FLAGS] |= FLAG_I_COMPRESSED;
+
+        // small files live in the inode link bytes, no data blocks needed
+        if (storedSize > 0 && storedSize <= MAX_INLINE_SIZE){
+            inodeBlock[OFFSET_I_FLAGS] |= FLAG_I_INLINE;
+            memcpy(inodeBlock+OFFSET_I_LINKS, stored, storedSize);
+        }
+        else if (storedSize > 0)
+            retVal = storeDataBlocks(stored, storedSize, needed, links, sameAs, hashes, newBlocks, inodeBlock+OFFSET_I_LINKS);
+    }
+    free(packed);
+    if (retVal < 0){
+        // the shared links taken above are dropped again, the inode on disk still
+        // holds the old content unless its blocks were already freed
+        for (i=0;i<needed;i++){
+            if (links[i] && refCount[links[i]] > 0)
+                refCount[links[i]]--;
+        }
+        if (freeFirst){
+            inodeBlock[OFFSET_I_FLAGS] &= ~(FLAG_I_INLINE | FLAG_I_COMPRESSED);
+            memset(inodeBlock+OFFSET_I_LINKS, 0, DIR_SLOTS);
+            setInodeSize(inodeBlock, 0);
+            if (writeBlock(mount, inodeIdx, inodeBlock) == 0)
+                cacheInodeAttr(inodeIdx, inodeBlock);
+        }
+        else
+            readBlock(mount, inodeIdx, inodeBlock);
+        return retVal;
+    }
+    retVal = finishFlush(entry, inodeIdx, inodeBlock);
+    if (retVal < 0 || freeFirst || oldInline)
+        return retVal;
+
+    // the old blocks go once the inode on disk no longer links them
+    for (i=0;i<DIR_SLOTS;i++){
+        if (oldLinks[i]){
+            retVal = deleteBlock(oldLinks[i]);
+            if (retVal < 0)
+                return retVal;
+        }
+    }
+    return 0;
+}
+
+// writes the inode of a flushed entry with the new size and drops the entry's buffer
+int finishFlush(openFileEntry *entry, int inodeIdx, unsigned char *inodeBlock){
+    int size = entry->wSize;
+    setInodeSize(inodeBlock, size);
+    if (writeBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+    cacheInodeAttr(inodeIdx, inodeBlock);
+
+    pendingBytes -= size;
+    free(entry->wBuffer);
+    entry->wBuffer = NULL;
+    entry->wSize = 0;
+    entry->wDirty = 0;
+    return 0;
+}
+
+// stores content in the data blocks a file owns and allocates only what they don't cover
+// blocks shared with a snapshot or another file lose this file's link instead of being
+// overwritten, owned blocks past the content stay linked as the reservation
+// the caller writes the inode
+int storeReserved(unsigned char *inodeBlock, char *stored, int storedSize){
+    unsigned char *links = inodeBlock+OFFSET_I_LINKS;
+    unsigned char owned[DIR_SLOTS];
+    int have = 0;
+    int i;
+    for (i=0;i<DIR_SLOTS;i++){
+        if (links[i] && refCount[links[i]] == 1 && !isFrozen(links[i]))
+            owned[have++] = links[i];
+    }
+    int needed = (storedSize + dataPayload-1) / dataPayload;
+    if (needed > have && needed-have > countFreeBlocks()){
+        printf("Error: no more free blocks\n");
+        return ERR_FILE_SIZE_LIMIT;
+    }
+
+    for (i=0;i<DIR_SLOTS;i++){
+        if (links[i] && (refCount[links[i]] != 1 || isFrozen(links[i]))){
+            int retVal = deleteBlock(links[i]);
+            if (retVal < 0)
+                return retVal;
+        }
+        links[i] = 0;
+    }
+    if (needed > have){
+        int retVal = allocBlocks(needed-have, owned+have);
+        if (retVal < 0)
+            return retVal;
+        for (i=have;i<needed;i++)
+            refCount[owned[i]]++;
+        have = needed;
+    }
+    memcpy(links, owned, have);
+    inodeBlock[OFFSET_I_FLAGS] &= ~(FLAG_I_INLINE|FLAG_I_RESERVED);
+    if (have > needed)
+        inodeBlock[OFFSET_I_FLAGS] |= FLAG_I_RESERVED;
+
+    // rewritten payloads no longer match their dedup hash
+    for (i=0;i<needed;i++)
+        dedupRemove(owned[i]);
+    if (needed)
+        return writeDataBlocks(stored, storedSize, owned, needed);
+    return 0;
+}
+
+// zero fills the data blocks of a file growing from size to newSize bytes, the caller
+// writes the inode
+// the bytes past the old end may be stale, so the block holding it and every block after
+// it are written again, linked blocks the file owns are reused and the others are taken
+// from the allocator in one call
+int zeroFillBlocks(unsigned char *inodeBlock, int size, int newSize){
+    unsigned char *links = inodeBlock+OFFSET_I_LINKS;
+    int first = size / dataPayload;
+    int needed = (newSize + dataPayload-1) / dataPayload;
+    int count = needed-first;
+    int have = 0;
+    while (have < DIR_SLOTS && links[have])
+        have++;
+    char *content = calloc(count, dataPayload);
+    if (!content){
+        perror("calloc");
+        return ERR_NO_MEMORY;
+    }
+    if (size % dataPayload){
+        unsigned char dataBlock[BLOCKSIZE];
+        if (readBlock(mount, links[first], dataBlock)){
+            free(content);
+            return ERR_DISK_OPERATION;
+        }
+        memcpy(content, dataBlock+dataOffset, size % dataPayload);
+    }
+
+    // blocks shared with a snapshot or another file are replaced instead of overwritten
+    unsigned char fresh[DIR_SLOTS];
+    int replace = 0;
+    int i;
+    for (i=first;i<needed;i++){
+        if (!links[i] || refCount[links[i]] != 1 || isFrozen(links[i]))
+            replace++;
+    }
+    int retVal = 0;
+    if (replace)
+        retVal = allocBlocks(replace, fresh);
+    int n = 0;
+    for (i=first;i<needed && retVal >= 0;i++){
+        if (links[i] && refCount[links[i]] == 1 && !isFrozen(links[i])){
+            dedupRemove(links[i]);
+            continue;
+        }
+        if (links[i] && (retVal = deleteBlock(links[i])) < 0)
+            break;
+        links[i] = fresh[n++];
+        refCount[links[i]]++;
+    }
+    if (retVal >= 0)
+        retVal = writeDataBlocks(content, count*dataPayload, links+first, count);
+    free(content);
+    if (have <= needed)
+        inodeBlock[OFFSET_I_FLAGS] &= ~FLAG_I_RESERVED;
+    return retVal;
+}
+
+// writes file content into its data blocks
+// runs of consecutive block numbers are written with a single disk call
+int writeDataBlocks(char *buffer, int size, unsigned char *blocks, int count){
+    unsigned char *dataBlocks = calloc(count, BLOCKSIZE);
+    if (!dataBlocks){
+        perror("calloc");
+        return ERR_NO_MEMORY;
+    }
+
+    int i;
+    for (i=0;i<count;i++){
+        unsigned char *dataBlock = dataBlocks+i*BLOCKSIZE;
+        int dataStart = i*dataPayload;
+        int dataBlockSize = dataPayload;
+        if (size-dataStart < dataBlockSize)
+            dataBlockSize = size-dataStart;
+        if (dataOffset){
+            dataBlock[OFFSET_TYPE] = TYPE_D;
+            dataBlock[OFFSET_MAGIC] = 0x44;
+        }
+        memcpy(dataBlock+dataOffset, buffer+dataStart, dataBlockSize);
+    }
+
+    i = 0;
+    while (i < count){
+        int run = 1;
+        while (i+run < count && blocks[i+run] == blocks[i]+run)
+            run++;
+        if (writeBlocks(mount, blocks[i], run, dataBlocks+i*BLOCKSIZE)){
+            free(dataBlocks);
+            return ERR_DISK_OPERATION;
+        }
+        i += run;
+    }
+
+    free(dataBlocks);
+    return 0;
+}
+
+// links the count payloads of stored into blocks, only payloads dedupMatch found no copy of are written
+// new blocks are allocated in one call and added to the dedup index when dedup is on
+int storeDataBlocks(char *stored, int storedSize, int count, unsigned char *links, int *sameAs,
+                    uint32_t *hashes, int newBlocks, unsigned char *blocks){
+    int payload = dataPayload;
+    unsigned char newLinks[BLOCKSIZE-OFFSET_I_LINKS];
+    char *unique = calloc(newBlocks ? newBlocks : 1, payload);
+    if (!unique){
+        perror("calloc");
+        return ERR_NO_MEMORY;
+    }
+    int retVal = newBlocks ? allocBlocks(newBlocks, newLinks) : 0;
+    if (retVal < 0){
+        free(unique);
+        return retVal;
+    }
+
+    int i;
+    int n = 0;
+    for (i=0;i<count;i++){
+        if (!links[i] && sameAs[i] == i){
+            int len = storedSize-i*payload < payload ? storedSize-i*payload : payload;
+            memcpy(unique+n*payload, stored+i*payload, len);
+            links[i] = newLinks[n++];
+            if (superCache[OFFSET_S_FEATURES] & FEATURE_S_DEDUP)
+                dedupInsert(links[i], hashes[i]);
+            refCount[links[i]]++;
+        }
+        else if (!links[i]){
+            links[i] = links[sameAs[i]];
+            refCount[links[i]]++;
+        }
+        blocks[i] = links[i];
+    }
+
+    if (newBlocks)
+        retVal = writeDataBlocks(unique, newBlocks*payload, newLinks, newBlocks);
+    free(unique);
+    return retVal;
+}
+
+// reads data blocks into dataBlocks, count blocks long
+// runs of consecutive block numbers are read with a single disk call
+int readDataBlocks(unsigned char *blocks, int count, unsigned char *dataBlocks){
+    int i = 0;
+    while (i < count){
+        int run = 1;
+        while (i+run < count && blocks[i+run] == blocks[i]+run)
+            run++;
+        if (readBlocks(mount, blocks[i], run, dataBlocks+i*BLOCKSIZE))
+            return ERR_DISK_OPERATION;
+        i += run;
+    }
+    return 0;
+}
+
+// reads the wanted blocks that aren't loaded yet in ascending order, each run of consecutive
+// blocks with one call, into blocks at their block number and marks them loaded
+// inodes among them go into the attribute cache
+int loadBlocks(unsigned char *wanted, unsigned char *blocks, unsigned char *loaded){
+    int b = 1;
+    while (b < numBlocks){
+        if (!wanted[b] || loaded[b]){
+            b++;
+            continue;
+        }
+        int run = 1;
+        while (b+run < numBlocks && wanted[b+run] && !loaded[b+run])
+            run++;
+        if (readBlocks(mount, b, run, blocks+b*BLOCKSIZE))
+            return ERR_DISK_OPERATION;
+        int i;
+        for (i=b;i<b+run;i++){
+            loaded[i] = 1;
+            if (blocks[i*BLOCKSIZE+OFFSET_TYPE] == TYPE_I && !attrCache[i].valid)
+                cacheInodeAttr(i, blocks+i*BLOCKSIZE);
+        }
+        b += run;
+    }
+    return 0;
+}
+
+// reads the whole content of a file on disk into buffer, which holds the file size
+// compressed content is decompressed
+int readFileContent(int inodeIdx, char *buffer){
+    unsigned char inodeBlock[BLOCKSIZE];
+    if (readBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+    int size = getInodeSize(inodeBlock);
+    int flags = inodeBlock[OFFSET_I_FLAGS];
+
+    // gather the stored bytes, either the inode link bytes or the data block payloads
+    unsigned char *stored = inodeBlock+OFFSET_I_LINKS;
+    int storedSize = MAX_INLINE_SIZE;
+    unsigned char *dataBlocks = NULL;
+    if (!(flags & FLAG_I_INLINE)){
+        int count = 0;
+        while (OFFSET_I_LINKS+count < BLOCKSIZE && inodeBlock[OFFSET_I_LINKS+count])
+            count++;
+        // reserved blocks past the content aren't read
+        if (!(flags & FLAG_I_COMPRESSED) && count > (size + dataPayload-1) / dataPayload)
+            count = (size + dataPayload-1) / dataPayload;
+        dataBlocks = malloc(count ? count*BLOCKSIZE : 1);
+        if (!dataBlocks){
+            perror("malloc");
+            return ERR_NO_MEMORY;
+        }
+        if (readDataBlocks(inodeBlock+OFFSET_I_LINKS, count, dataBlocks) < 0){
+            free(dataBlocks);
+            return ERR_DISK_OPERATION;
+        }
+        // raw data blocks are already contiguous file bytes
+        int i;
+        for (i=0;dataOffset && i<count;i++)
+            memmove(dataBlocks+i*dataPayload, dataBlocks+i*BLOCKSIZE+dataOffset, dataPayload);
+        stored = dataBlocks;
+        storedSize = count*dataPayload;
+    }
+
+    int retVal = 0;
+    if (flags & FLAG_I_COMPRESSED){
+        int zSize = getZSize(stored);
+        if (zSize > storedSize-LEN_Z_SIZE
+                || lzDecompress(stored+LEN_Z_SIZE, zSize, (unsigned char *)buffer, size) != size){
+            printf("Error: corrupt compressed file\n");
+            retVal = ERR_FS_INTEGRITY;
+        }
+    }
+    else if (size > storedSize){
+        printf("Error: file size larger than its data blocks\n");
+        retVal = ERR_FS_INTEGRITY;
+    }
+    else
+        memcpy(buffer, stored, size);
+
+    free(dataBlocks);
+    return retVal;
+}
+
+// decompresses the content of a compressed file into the open file entry once
+int loadCompressed(openFileEntry *entry, uint32_t size){
+    if (entry->zValid)
+        return 0;
+    char *newBuffer = realloc(entry->zBuffer, size);
+    if (!newBuffer){
+        perror("realloc");
+        return ERR_NO_MEMORY;
+    }
+    entry->zBuffer = newBuffer;
+    int retVal = readFileContent(entry->inodeBlock, entry->zBuffer);
+    if (retVal < 0)
+        return retVal;
+    entry->zValid = 1;
+    return 0;
+}
+
+// sets where file bytes sit in a data block for the mounted disk's format
+void setDataFormat(int features){
+    dataOffset = (features & FEATURE_S_RAW_DATA) ? 0 : OFFSET_D_DATA;
+    dataPayload = BLOCKSIZE-dataOffset;
+}
+
+// writes buffered content of every open entry of an inode
+int flushInode(int inodeIdx){
+    int i;
+    for (i=0;i<fileTable.maxSize;i++){
+        if (fileTable.table[i].fd && fileTable.table[i].wDirty && fileTable.table[i].inodeBlock == inodeIdx){
+            int retVal = flushFileEntry(fileTable.table+i);
+            if (retVal < 0)
+                return retVal;
+        }
+    }
+    return 0;
+}
+
+// writes buffered content of every open entry
+int flushAllPending(){
+    int i;
+    for (i=0;i<fileTable.maxSize;i++){
+        if (fileTable.table[i].fd && fileTable.table[i].wDirty){
+            int retVal = flushFileEntry(fileTable.table+i);
+            if (retVal < 0)
+                return retVal;
+        }
+    }
+    return 0;
+}
+
+// drops buffered content of open entries of an inode, except for keep
+// used when content is replaced or the inode is deleted
+void discardPendingWrites(int inodeIdx, openFileEntry *keep){
+    int i;
+    for (i=0;i<fileTable.maxSize;i++){
+        openFileEntry *entry = fileTable.table+i;
+        if (entry != keep && entry->fd && entry->wDirty && entry->inodeBlock == inodeIdx){
+            pendingBytes -= entry->wSize;
+            free(entry->wBuffer);
+            entry->wBuffer = NULL;
+            entry->wSize = 0;
+            entry->wDirty = 0;
+        }
+    }
+}
+
+// returns size of buffered content for an inode
+// returns -1 if nothing is buffered
+int pendingWriteSize(int inodeIdx){
+    int i;
+    for (i=0;i<fileTable.maxSize;i++){
+        if (fileTable.table[i].fd && fileTable.table[i].wDirty && fileTable.table[i].inodeBlock == inodeIdx)
+            return fileTable.table[i].wSize;
+    }
+    return -1;
+}
+
+// drops prefetched data of every open entry of an inode, used when its content changes
+void invalidateReadahead(int inodeIdx){
+    int i;
+    for (i=0;i<fileTable.maxSize;i++){
+        if (fileTable.table[i].fd && fileTable.table[i].inodeBlock == inodeIdx){
+            fileTable.table[i].raCount = 0;
+            fileTable.table[i].zValid = 0;
+        }
+    }
+}
+
+// searches directory on disk for filename
+// names come from the inode attribute cache, only uncached inodes are read
+// returns block index if found
+// returns 0 if not found
+int searchDir(char *filename, unsigned char *dirBlock){
+    inodeAttr attr;
+    int i;
+
+    // hashed directories are probed from the name's home slot up to the first empty slot
+    if (dirBlock[OFFSET_I_FLAGS] & FLAG_I_HASHED){
+        int home = dirHomeSlot(filename);
+        for (i=0;i<DIR_SLOTS;i++){
+            int testBlockNum = dirBlock[OFFSET_I_LINKS + (home+i)%DIR_SLOTS];
+            if (!testBlockNum)
+                return 0;
+            int retVal = getInodeAttr(testBlockNum, &attr);
+            if (retVal < 0)
+                return retVal;
+            if (retVal && !strcmp(attr.name, filename))
+                return testBlockNum;
+        }
+        return 0;
+    }
+
+    for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+        int testBlockNum = dirBlock[i + OFFSET_I_LINKS];
+        if (!testBlockNum)
+            continue;
+        int retVal = getInodeAttr(testBlockNum, &attr);
+        if (retVal < 0)
+            return retVal;
+        if (retVal && !strcmp(attr.name, filename))
+            return testBlockNum;
+    }
+    return 0;
+}
+
+// gets inode header fields from the attribute cache, reading the inode on a miss
+// returns 1 if block is an inode, 0 if it is not
+int getInodeAttr(int inodeIdx, inodeAttr *attr){
+    if (inodeIdx <= 0 || inodeIdx >= MAX_BLOCKS)
+        return 0;
+
+    if (!attrCache[inodeIdx].valid){
+        unsigned char inodeBlock[BLOCKSIZE];
+        if (readBlock(mount, inodeIdx, inodeBlock))
+            return ERR_DISK_OPERATION;
+        if (inodeBlock[OFFSET_TYPE] != TYPE_I)
+            return 0;
+        cacheInodeAttr(inodeIdx, inodeBlock);
+    }
+
+    *attr = attrCache[inodeIdx];
+    return 1;
+}
+
+// copies inode header fields into the attribute cache
+// must be called after every write of an inode block
+void cacheInodeAttr(int inodeIdx, unsigned char *inodeBlock){
+    if (inodeIdx <= 0 || inodeIdx >= MAX_BLOCKS)
+        return;
+    inodeAttr *attr = attrCache+inodeIdx;
+    attr->size = getInodeSize(inodeBlock);
+    attr->isdir = inodeBlock[OFFSET_I_DIR];
+    attr->flags = inodeBlock[OFFSET_I_FLAGS];
+    memset(attr->name, 0, LEN_I_NAME+1);
+    memcpy(attr->name, inodeBlock+OFFSET_I_NAME, LEN_I_NAME);
+    attr->valid = 1;
+}
+
+// drops a block from the attribute cache, used when an inode is freed
+void invalidateInodeAttr(int inodeIdx){
+    if (inodeIdx <= 0 || inodeIdx >= MAX_BLOCKS)
+        return;
+    attrCache[inodeIdx].valid = 0;
+}
+
+// converts cached inode attributes to a stat result
+void fillStat(int inodeIdx, inodeAttr *attr, tfsStat *st){
+    st->inodeBlock = inodeIdx;
+    st->size = attr->size;
+    st->isdir = attr->isdir;
+    memcpy(st->name, attr->name, LEN_I_NAME+1);
+
+    // buffered content is the size the file will have
+    int pending = pendingWriteSize(inodeIdx);
+    if (pending >= 0)
+        st->size = pending;
+}
+
+// removes parent directory links to filename/block
+int deleteParentLinks(char *filename, int blockIdx){
+    // move 1 up path, remove link
+    char parentPath[MAX_FILENAME+1];
+    memset(parentPath, 0, MAX_FILENAME+1);
+    memcpy(parentPath, filename, strlen(filename));
+    int lastDelim = strlen(parentPath);
+    while (lastDelim > 0 && parentPath[lastDelim] != '/')
+        lastDelim--;
+    
+    int parentIdx = ROOT_BLOCK;
+    // get path to parent
+    if (lastDelim){
+        parentPath[lastDelim] = '\0';
+        parentIdx = openInode(parentPath, 0, 1);
+        if (parentIdx < 0)
+            return parentIdx;
+    }
+    parentIdx = cowInode(parentIdx);
+    if (parentIdx < 0)
+        return parentIdx;
+
+    // set references to 0
+    unsigned char dirBlock[BLOCKSIZE];
+    if (readBlock(mount, parentIdx, dirBlock))
+        return ERR_DISK_OPERATION;
+    int retVal = removeDirLink(dirBlock, blockIdx);
+    if (retVal < 0)
+        return retVal;
+    if (writeBlock(mount, parentIdx, dirBlock))
+        return ERR_DISK_OPERATION;
+    return 0;
+}
+
+// traverses directories recursively and prints all files within them
+int readdir(char *dirName){
+    int dirIdx = openInode(dirName, 0, 1);
+    if (dirIdx < 0)
+        return dirIdx;
+
+    unsigned char dirBlock[BLOCKSIZE];
+    if (readBlock(mount, dirIdx, dirBlock))
+        return ERR_DISK_OPERATION;
+
+    // print files with data first
+    unsigned char blockTemp[BLOCKSIZE];
     int linkOffset;
     for (linkOffset=0;(linkOffset+OFFSET_I_LINKS)<BLOCKSIZE;linkOffset++){
         if (dirBlock[linkOffset+OFFSET_I_LINKS]){
@@ -579,11 +2491,11 @@ int searchFileTable(fileDescriptor FD){
 // if isdir is set, looks for/creates directory inode
 int openInode(char *name, int create, int isdir) {
     if (!strcmp(name, "/") && isdir)
-        return ROOT_BLOCK;
+        return rootBlock;
 
     // root inode
     unsigned char dirBlock[BLOCKSIZE];
-    int dirIdx = ROOT_BLOCK;
+    int dirIdx = rootBlock;
     if (readBlock(mount, dirIdx, dirBlock))
         return ERR_DISK_OPERATION;
 
@@ -654,26 +2566,43 @@ int deleteFileContent(int inodeIdx){
         return ERR_FILE_NOT_FOUND;
     }
 
+    // a snapshot keeps the content of a frozen inode
+    if (isFrozen(inodeIdx))
+        return 0;
+
+    invalidateReadahead(inodeIdx);
+
     // get file inode
     unsigned char inodeBlock[BLOCKSIZE];
     if (readBlock(mount, inodeIdx, inodeBlock))
         return ERR_DISK_OPERATION;
 
-    // remove all data
+    int retVal = freeDataBlocks(inodeBlock);
+    if (retVal < 0)
+        return retVal;
+
+    if (writeBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+    cacheInodeAttr(inodeIdx, inodeBlock);
+
+    return 0;
+}
+
+// frees the data blocks of an inode held in memory and clears its links
+// the caller writes the inode, inline data has no blocks to free
+int freeDataBlocks(unsigned char *inodeBlock){
+    int isInline = inodeBlock[OFFSET_I_FLAGS] & FLAG_I_INLINE;
+    inodeBlock[OFFSET_I_FLAGS] &= ~FLAG_I_INLINE;
     int i;
     for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
         int dataIdx = inodeBlock[i+OFFSET_I_LINKS];
-        if (dataIdx){
+        if (dataIdx && !isInline){
             int retVal = deleteBlock(dataIdx);
-             if (retVal < 0)
+            if (retVal < 0)
                 return retVal;
         }
         inodeBlock[i+OFFSET_I_LINKS] = 0;
     }
-
-    if (writeBlock(mount, inodeIdx, inodeBlock))
-        return ERR_DISK_OPERATION;
-
     return 0;
 }
 
@@ -683,26 +2612,93 @@ int deleteBlock(int deleteIdx){
         printf("Error: can't delete superblock\n");
         return ERR_INVALID_BLOCK;
     }
-
-    // get free block head from superblock
-    unsigned char superblock[BLOCKSIZE];
-    if (readBlock(mount, 0, superblock))
+
+    // shared data blocks are freed with their last link
+    // snapshot blocks are never freed
+    if (refCount[deleteIdx] > 1){
+        refCount[deleteIdx]--;
+        return 0;
+    }
+    if (isFrozen(deleteIdx)){
+        discardPendingWrites(deleteIdx, NULL);
+        return 0;
+    }
+    refCount[deleteIdx] = 0;
+    dedupRemove(deleteIdx);
+
+    // replace free head with deleted block
+    freeLink[deleteIdx] = superCache[OFFSET_S_FREE];
+    superCache[OFFSET_S_FREE] = deleteIdx;
+    invalidateInodeAttr(deleteIdx);
+    discardPendingWrites(deleteIdx, NULL);
+
+    if (writeFreeBlock(deleteIdx, freeLink[deleteIdx]) < 0)
+        return ERR_DISK_OPERATION;
+    if (writeBlock(mount, 0, superCache))
+        return ERR_DISK_OPERATION;
+    return 0;
+}
+
+// frees data blocks cut from the end of a file in one go, shared and snapshot blocks are
+// handled as deleteBlock does, the rest are chained in their order in front of the free list
+// and written with one disk call per run of consecutive blocks, then the superblock once
+int freeBlocks(unsigned char *blocks, int count){
+    unsigned char freed[DIR_SLOTS];
+    int n = 0;
+    int i;
+    for (i=0;i<count;i++){
+        int b = blocks[i];
+        if (refCount[b] > 1)
+            refCount[b]--;
+        else if (!isFrozen(b)){
+            refCount[b] = 0;
+            dedupRemove(b);
+            freed[n++] = b;
+        }
+    }
+    if (!n)
+        return 0;
+
+    unsigned char *chain = calloc(n, BLOCKSIZE);
+    if (!chain){
+        perror("calloc");
+        return ERR_NO_MEMORY;
+    }
+    for (i=0;i<n;i++){
+        unsigned char *freeBlock = chain+i*BLOCKSIZE;
+        int next = i+1 < n ? freed[i+1] : superCache[OFFSET_S_FREE];
+        freeBlock[OFFSET_TYPE] = TYPE_F;
+        freeBlock[OFFSET_MAGIC] = 0x44;
+        freeBlock[OFFSET_LINK] = next;
+        freeLink[freed[i]] = next;
+    }
+    i = 0;
+    while (i < n){
+        int run = 1;
+        while (i+run < n && freed[i+run] == freed[i]+run)
+            run++;
+        if (writeBlocks(mount, freed[i], run, chain+i*BLOCKSIZE)){
+            free(chain);
+            return ERR_DISK_OPERATION;
+        }
+        i += run;
+    }
+    free(chain);
+    superCache[OFFSET_S_FREE] = freed[0];
+    if (writeBlock(mount, 0, superCache))
         return ERR_DISK_OPERATION;
-    int freeHeadIdx = superblock[OFFSET_S_FREE];
+    return 0;
+}
 
-    // setup a reference free block
+// writes a free block linking to nextIdx in the free chain
+int writeFreeBlock(int blockIdx, int nextIdx){
     unsigned char freeBlock[BLOCKSIZE];
     memset(freeBlock, 0, BLOCKSIZE);
     freeBlock[OFFSET_TYPE] = TYPE_F;
     freeBlock[OFFSET_MAGIC] = 0x44;
-
-    // replace free head with deleted block
-    freeBlock[OFFSET_LINK] = freeHeadIdx;
-    superblock[OFFSET_S_FREE] = deleteIdx;
-
-    if (writeBlock(mount, deleteIdx, freeBlock))
-        return ERR_DISK_OPERATION;
-    if (writeBlock(mount, 0, superblock))
+    freeBlock[OFFSET_LINK] = nextIdx;
+    freeLink[blockIdx] = nextIdx;
+    if (writeBlock(mount, blockIdx, freeBlock))
         return ERR_DISK_OPERATION;
     return 0;
 }
@@ -710,48 +2706,114 @@ int deleteBlock(int deleteIdx){
 // returns 0 if inode does not exist on disk
 // returns 1 if it exists
 int checkInodeExists(int inodeIdx){
-    unsigned char inodeBlock[BLOCKSIZE];
-    if (readBlock(mount, inodeIdx, inodeBlock))
-        return ERR_DISK_OPERATION;
-
-    if (inodeBlock[OFFSET_TYPE] == TYPE_I)
-        return 1;
-    
-    return 0;
+    inodeAttr attr;
+    return getInodeAttr(inodeIdx, &attr);
 }
 
 // removes a free block from the free list, returns its block number
 int getFreeBlock(){
-    // get free head from superblock
-    unsigned char superblock[BLOCKSIZE];
-    if (readBlock(mount, 0, superblock))
-        return ERR_DISK_OPERATION;
-    int freeHeadIdx = superblock[OFFSET_S_FREE];
+    int freeHeadIdx = superCache[OFFSET_S_FREE];
     if (!freeHeadIdx){
         printf("Error: no more free blocks\n");
         return ERR_FILE_SIZE_LIMIT;
     }
 
     // replace head
-    unsigned char freeBlockHead[BLOCKSIZE];
-    if (readBlock(mount, freeHeadIdx, freeBlockHead))
-        return ERR_DISK_OPERATION;
-    
-    superblock[OFFSET_S_FREE] = freeBlockHead[OFFSET_LINK];
-    if (writeBlock(mount, 0, superblock))
+    superCache[OFFSET_S_FREE] = freeLink[freeHeadIdx];
+    if (writeBlock(mount, 0, superCache))
         return ERR_DISK_OPERATION;
     
     return freeHeadIdx;
 }
 
+// returns number of blocks in the free chain
+int countFreeBlocks(){
+    int count = 0;
+    int b = superCache[OFFSET_S_FREE];
+    while (b && count < numBlocks){
+        count++;
+        b = freeLink[b];
+    }
+    return count;
+}
+
+// removes count blocks from the free list into blocks
+// prefers the first run of consecutive free blocks long enough for all of them,
+// otherwise takes the lowest numbered free blocks so they are at least ascending
+// only free blocks whose chain link changes are rewritten
+int allocBlocks(int count, unsigned char *blocks){
+    unsigned char isFree[MAX_BLOCKS];
+    memset(isFree, 0, MAX_BLOCKS);
+    int nFree = 0;
+    int b = superCache[OFFSET_S_FREE];
+    while (b && nFree < numBlocks){
+        isFree[b] = 1;
+        nFree++;
+        b = freeLink[b];
+    }
+    if (nFree < count){
+        printf("Error: no more free blocks\n");
+        return ERR_FILE_SIZE_LIMIT;
+    }
+
+    int start = 0;
+    int runLen = 0;
+    for (b=0;b<numBlocks;b++){
+        runLen = isFree[b] ? runLen+1 : 0;
+        if (runLen == count){
+            start = b-count+1;
+            break;
+        }
+    }
+    int n = 0;
+    for (b=start;n<count;b++){
+        if (isFree[b]){
+            blocks[n++] = b;
+            isFree[b] = 0;
+        }
+    }
+
+    // relink the remaining free blocks in their existing order
+    int prev = 0;
+    b = superCache[OFFSET_S_FREE];
+    int superDirty = 0;
+    n = 0;
+    while (b && n++ < numBlocks){
+        int next = freeLink[b];
+        if (isFree[b]){
+            if (!prev && superCache[OFFSET_S_FREE] != b){
+                superCache[OFFSET_S_FREE] = b;
+                superDirty = 1;
+            }
+            else if (prev && freeLink[prev] != b && writeFreeBlock(prev, b) < 0)
+                return ERR_DISK_OPERATION;
+            prev = b;
+        }
+        b = next;
+    }
+    if (!prev && superCache[OFFSET_S_FREE]){
+        superCache[OFFSET_S_FREE] = 0;
+        superDirty = 1;
+    }
+    else if (prev && freeLink[prev] && writeFreeBlock(prev, 0) < 0)
+        return ERR_DISK_OPERATION;
+
+    if (superDirty && writeBlock(mount, 0, superCache))
+        return ERR_DISK_OPERATION;
+    return 0;
+}
+
 // creates inode on disk with name, under dirInode/dirIdx directory
 // if isdir is set, creates directory
 int createInode(char* name, int isdir, unsigned char *dirInode, int dirIdx){
-    // get free link in directory
-    int i = 0;
-    while (i+OFFSET_I_LINKS < BLOCKSIZE && dirInode[i + OFFSET_I_LINKS])
-        i++;
-    if (i == BLOCKSIZE){
+    if (checkWritable() < 0)
+        return ERR_READ_ONLY;
+    dirIdx = cowInode(dirIdx);
+    if (dirIdx < 0)
+        return dirIdx;
+
+    // need a free link in directory
+    if (!memchr(dirInode+OFFSET_I_LINKS, 0, DIR_SLOTS)){
         printf("Error: Inode ran out of space\n");
         return ERR_FILE_SIZE_LIMIT;
     }
@@ -762,6 +2824,8 @@ int createInode(char* name, int isdir, unsigned char *dirInode, int dirIdx){
     newInode[OFFSET_MAGIC] = 0x44;
     newInode[OFFSET_TYPE] = 2;
     newInode[OFFSET_I_DIR] = isdir;
+    if (isdir)
+        newInode[OFFSET_I_FLAGS] = FLAG_I_HASHED;
     memcpy(newInode+OFFSET_I_NAME, name, strlen(name));
 
     // get a free block for inode
@@ -772,13 +2836,628 @@ int createInode(char* name, int isdir, unsigned char *dirInode, int dirIdx){
     // write inode to free block, update directory inode
     if (writeBlock(mount, freeIdx, newInode))
         return ERR_DISK_OPERATION;
-    dirInode[i + OFFSET_I_LINKS] = freeIdx;
+    cacheInodeAttr(freeIdx, newInode);
+    insertDirLink(dirInode, name, freeIdx);
     if (writeBlock(mount, dirIdx, dirInode))
         return ERR_DISK_OPERATION;
     
     return freeIdx;
 }
 
+// returns the dedup hash of a data block payload
+uint32_t dedupHash(unsigned char *payload){
+    return crc32c(0, payload, dataPayload);
+}
+
+// empties the dedup index and allocates budget / DD_ENTRY_SIZE buckets, none while dedup is off
+void dedupReset(){
+    free(ddBuckets);
+    ddBuckets = NULL;
+    ddNumBuckets = 0;
+    memset(ddIndexed, 0, sizeof(ddIndexed));
+    ddCount = 0;
+    if (!(superCache[OFFSET_S_FEATURES] & FEATURE_S_DEDUP))
+        return;
+    ddNumBuckets = ddBudget / DD_ENTRY_SIZE;
+    if (ddNumBuckets > MAX_BLOCKS)
+        ddNumBuckets = MAX_BLOCKS;
+    ddBuckets = ddNumBuckets ? calloc(ddNumBuckets, 1) : NULL;
+    if (!ddBuckets)
+        ddNumBuckets = 0;
+}
+
+// adds a data block to the dedup index, blocks past the budget are not indexed
+void dedupInsert(int blockIdx, uint32_t hash){
+    if (!ddNumBuckets || ddCount >= ddNumBuckets || ddIndexed[blockIdx])
+        return;
+    ddHash[blockIdx] = hash;
+    ddNext[blockIdx] = ddBuckets[hash % ddNumBuckets];
+    ddBuckets[hash % ddNumBuckets] = blockIdx;
+    ddIndexed[blockIdx] = 1;
+    ddCount++;
+}
+
+// drops a data block from the dedup index
+void dedupRemove(int blockIdx){
+    if (!ddIndexed[blockIdx])
+        return;
+    unsigned char *link = ddBuckets + ddHash[blockIdx] % ddNumBuckets;
+    while (*link != blockIdx)
+        link = ddNext + *link;
+    *link = ddNext[blockIdx];
+    ddIndexed[blockIdx] = 0;
+    ddCount--;
+}
+
+// finds an indexed data block holding payload, candidates are read to rule out collisions
+// returns 0 if there is none
+int dedupLookup(unsigned char *payload, uint32_t hash){
+    if (!ddNumBuckets)
+        return 0;
+    unsigned char dataBlock[BLOCKSIZE];
+    int b;
+    for (b=ddBuckets[hash % ddNumBuckets];b;b=ddNext[b]){
+        if (ddHash[b] != hash)
+            continue;
+        if (readBlock(mount, b, dataBlock))
+            return ERR_DISK_OPERATION;
+        if (!memcmp(dataBlock+dataOffset, payload, dataPayload))
+            return b;
+    }
+    return 0;
+}
+
+// rebuilds the dedup index from the linked data blocks on disk
+int dedupRebuild(){
+    dedupReset();
+    if (!(superCache[OFFSET_S_FEATURES] & FEATURE_S_DEDUP))
+        return 0;
+    unsigned char dataBlock[BLOCKSIZE];
+    int b;
+    for (b=ROOT_BLOCK+1;b<numBlocks;b++){
+        if (!refCount[b])
+            continue;
+        if (readBlock(mount, b, dataBlock))
+            return ERR_DISK_OPERATION;
+        dedupInsert(b, dedupHash(dataBlock+dataOffset));
+    }
+    return 0;
+}
+
+// finds blocks already holding the count payloads of stored, links[i] is 0 where there is none
+// a payload repeated within stored has sameAs[i] set to its first copy, otherwise sameAs[i] is i
+// returns the number of payloads that need new blocks
+int dedupMatch(char *stored, int storedSize, int count, unsigned char *links, int *sameAs, uint32_t *hashes){
+    int payload = dataPayload;
+    int dedup = superCache[OFFSET_S_FEATURES] & FEATURE_S_DEDUP;
+    unsigned char *chunks = calloc(count, payload);
+    if (!chunks){
+        perror("calloc");
+        return ERR_NO_MEMORY;
+    }
+    memcpy(chunks, stored, storedSize);
+
+    int newBlocks = 0;
+    int i, j;
+    for (i=0;i<count;i++){
+        unsigned char *chunk = chunks+i*payload;
+        links[i] = 0;
+        sameAs[i] = i;
+        if (!dedup){
+            newBlocks++;
+            continue;
+        }
+        hashes[i] = dedupHash(chunk);
+        int b = dedupLookup(chunk, hashes[i]);
+        if (b < 0){
+            free(chunks);
+            return b;
+        }
+        links[i] = b;
+        for (j=0;!b && j<i;j++){
+            if (sameAs[j] == j && !links[j] && hashes[j] == hashes[i] && !memcmp(chunks+j*payload, chunk, payload)){
+                sameAs[i] = j;
+                break;
+            }
+        }
+        if (!links[i] && sameAs[i] == i)
+            newBlocks++;
+    }
+    free(chunks);
+    return newBlocks;
+}
+
+// returns 1 if a snapshot reaches the block, so it must not change in place
+int isFrozen(int blockIdx){
+    return (superCache[OFFSET_S_FROZEN + blockIdx/8] >> (blockIdx%8)) & 1;
+}
+
+// returns the snapshot table index of snapshot name, -1 if there is none
+int findSnapshot(char *name){
+    int i;
+    for (i=0;i<MAX_SNAPSHOTS;i++){
+        unsigned char *entry = superCache + OFFSET_S_SNAPS + i*LEN_S_SNAP;
+        if (entry[LEN_I_NAME] && !strncmp((char *)entry, name, LEN_I_NAME) && strlen(name) <= LEN_I_NAME)
+            return i;
+    }
+    return -1;
+}
+
+// gives a frozen inode a writable copy in the live file system
+// frozen directories above it are copied first, each copy is linked from its parent
+// returns the block to change the inode in, open file entries are moved there too
+int cowInode(int inodeIdx){
+    if (!isFrozen(inodeIdx))
+        return inodeIdx;
+
+    unsigned char path[MAX_BLOCKS];
+    int depth = findInodePath(ROOT_BLOCK, inodeIdx, path, 0);
+    if (depth < 0)
+        return depth;
+    if (!depth){
+        printf("Error: inode is not in the file system\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+
+    unsigned char block[BLOCKSIZE], parent[BLOCKSIZE];
+    int i, j;
+    for (i=1;i<depth;i++){
+        if (!isFrozen(path[i]))
+            continue;
+        int copyIdx = getFreeBlock();
+        if (copyIdx < 0)
+            return copyIdx;
+        if (readBlock(mount, path[i], block) || writeBlock(mount, copyIdx, block))
+            return ERR_DISK_OPERATION;
+        cacheInodeAttr(copyIdx, block);
+
+        // the copy links the same data blocks as the snapshot
+        if (!block[OFFSET_I_DIR] && !(block[OFFSET_I_FLAGS] & FLAG_I_INLINE)){
+            for (j=0;(j+OFFSET_I_LINKS)<BLOCKSIZE;j++){
+                if (block[j+OFFSET_I_LINKS])
+                    refCount[block[j+OFFSET_I_LINKS]]++;
+            }
+        }
+
+        if (readBlock(mount, path[i-1], parent))
+            return ERR_DISK_OPERATION;
+        for (j=0;(j+OFFSET_I_LINKS)<BLOCKSIZE;j++){
+            if (parent[j+OFFSET_I_LINKS] == path[i])
+                parent[j+OFFSET_I_LINKS] = copyIdx;
+        }
+        if (writeBlock(mount, path[i-1], parent))
+            return ERR_DISK_OPERATION;
+
+        for (j=0;j<fileTable.maxSize;j++){
+            if (fileTable.table[j].fd && fileTable.table[j].inodeBlock == path[i])
+                fileTable.table[j].inodeBlock = copyIdx;
+        }
+        path[i] = copyIdx;
+    }
+    return path[depth-1];
+}
+
+// finds the directories from dirIdx down to inodeIdx, path[depth] is dirIdx
+// returns the length of the path, 0 if inodeIdx is not under dirIdx
+int findInodePath(int dirIdx, int inodeIdx, unsigned char *path, int depth){
+    path[depth] = dirIdx;
+    if (dirIdx == inodeIdx)
+        return depth+1;
+    if (depth+1 >= MAX_BLOCKS)
+        return 0;
+
+    unsigned char dirBlock[BLOCKSIZE];
+    if (readBlock(mount, dirIdx, dirBlock))
+        return ERR_DISK_OPERATION;
+    if (!dirBlock[OFFSET_I_DIR])
+        return 0;
+    inodeAttr attr;
+    int i;
+    for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+        int child = dirBlock[i+OFFSET_I_LINKS];
+        if (!child)
+            continue;
+        if (child == inodeIdx){
+            path[depth+1] = child;
+            return depth+2;
+        }
+        int retVal = getInodeAttr(child, &attr);
+        if (retVal > 0 && attr.isdir)
+            retVal = findInodePath(child, inodeIdx, path, depth+1);
+        if (retVal < 0 || (retVal && attr.isdir))
+            return retVal;
+    }
+    return 0;
+}
+
+// marks an inode and every block under it, MARK_INODE for inodes and MARK_DATA for data blocks
+int markTree(int inodeIdx, unsigned char *mark){
+    mark[inodeIdx] = MARK_INODE;
+    unsigned char inodeBlock[BLOCKSIZE];
+    if (readBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+    if (!inodeBlock[OFFSET_I_DIR] && (inodeBlock[OFFSET_I_FLAGS] & FLAG_I_INLINE))
+        return 0;
+    int i;
+    for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+        int child = inodeBlock[i+OFFSET_I_LINKS];
+        if (!child || mark[child])
+            continue;
+        if (!inodeBlock[OFFSET_I_DIR])
+            mark[child] = MARK_DATA;
+        else{
+            int retVal = markTree(child, mark);
+            if (retVal < 0)
+                return retVal;
+        }
+    }
+    return 0;
+}
+
+// returns ERR_READ_ONLY if the mounted file system is a snapshot
+int checkWritable(){
+    if (readOnly){
+        printf("Error: file system is mounted read only\n");
+        return ERR_READ_ONLY;
+    }
+    return 0;
+}
+
+// reads a file inode into inodeBlock, fails for directories
+int readFileInode(int inodeIdx, unsigned char *inodeBlock){
+    if (readBlock(mount, inodeIdx, inodeBlock))
+        return ERR_DISK_OPERATION;
+    if (inodeBlock[OFFSET_TYPE] != TYPE_I || inodeBlock[OFFSET_I_DIR]){
+        printf("Error: not a file\n");
+        return ERR_FILE_NOT_FOUND;
+    }
+    return 0;
+}
+
+// removes a file's content, its parent directory link and its inode
+int deleteFileInode(char *filename, int inodeIdx){
+    int retVal = deleteFileContent(inodeIdx);
+    if (retVal < 0)
+        return retVal;
+    retVal = deleteParentLinks(filename, inodeIdx);
+    if (retVal < 0)
+        return retVal;
+    return deleteBlock(inodeIdx);
+}
+
+// sets the name bytes of an inode
+int renameInode(int inodeIdx, char *newName){
+    inodeIdx = cowInode(inodeIdx);
+    if (inodeIdx < 0)
+        return inodeIdx;
+
+    // get file inode
+    unsigned char blockTemp[BLOCKSIZE];
+    if (readBlock(mount, inodeIdx, blockTemp))
+        return ERR_DISK_OPERATION;
+    
+    // set file name, write to disk
+    memset(blockTemp+OFFSET_I_NAME, 0, LEN_I_NAME);
+    memcpy(blockTemp+OFFSET_I_NAME, newName, strlen(newName));
+    if (writeBlock(mount, inodeIdx, blockTemp))
+        return ERR_DISK_OPERATION;
+    cacheInodeAttr(inodeIdx, blockTemp);
+    return 0;
+}
+
+// splits path into the path of its parent directory and its last name
+int splitPath(char *path, char *parentPath, char *name){
+    int len = strlen(path);
+    int lastDelim = len;
+    while (lastDelim > 0 && path[lastDelim] != '/')
+        lastDelim--;
+    int nameStart = path[lastDelim] == '/' ? lastDelim+1 : 0;
+    if (len > MAX_FILENAME || len-nameStart > LEN_I_NAME || len == nameStart){
+        printf("Error: invalid name\n");
+        return ERR_FILENAME;
+    }
+    memcpy(parentPath, path, lastDelim);
+    parentPath[lastDelim] = '\0';
+    if (!lastDelim)
+        strcpy(parentPath, "/");
+    strcpy(name, path+nameStart);
+    return 0;
+}
+
+// renames the file or directory at path within its directory
+int renamePath(char *path, char *newName){
+    char parentPath[MAX_FILENAME+1], name[LEN_I_NAME+1];
+    int retVal = splitPath(path, parentPath, name);
+    if (retVal < 0)
+        return retVal;
+    if (strlen(newName) > LEN_I_NAME || strlen(newName) == 0 || strchr(newName, '/')){
+        printf("Error: invalid name\n");
+        return ERR_FILENAME;
+    }
+    char newPath[MAX_FILENAME+LEN_I_NAME+2];
+    snprintf(newPath, sizeof(newPath), "%s%s%s", parentPath, strcmp(parentPath, "/") ? "/" : "", newName);
+    if (strlen(newPath) > MAX_FILENAME){
+        printf("Error: invalid name\n");
+        return ERR_FILENAME;
+    }
+    return tfs_move(path, newPath);
+}
+
+// updates the paths of open files at or under oldPath after a move
+void renameOpenFiles(char *oldPath, char *newPath){
+    if (oldPath[0] == '/')
+        oldPath++;
+    int oldLen = strlen(oldPath);
+    int i;
+    for (i=0;i<fileTable.maxSize;i++){
+        openFileEntry *entry = fileTable.table+i;
+        char *name = entry->filename[0] == '/' ? entry->filename+1 : entry->filename;
+        if (!entry->fd || strncmp(name, oldPath, oldLen) || (name[oldLen] && name[oldLen] != '/'))
+            continue;
+        char moved[MAX_FILENAME+1];
+        if (snprintf(moved, sizeof(moved), "%s%s", newPath, name+oldLen) <= MAX_FILENAME)
+            strcpy(entry->filename, moved);
+    }
+}
+
+// returns the slot a name is placed at first in a hashed directory
+int dirHomeSlot(char *name){
+    return crc32c(0, name, strlen(name)) % DIR_SLOTS;
+}
+
+// links an inode into a directory held in memory, returns the slot used
+// hashed directories take the first free slot from the name's home slot on
+int insertDirLink(unsigned char *dirBlock, char *name, int inodeIdx){
+    int home = (dirBlock[OFFSET_I_FLAGS] & FLAG_I_HASHED) ? dirHomeSlot(name) : 0;
+    int i;
+    for (i=0;i<DIR_SLOTS;i++){
+        int slot = (home+i)%DIR_SLOTS;
+        if (!dirBlock[OFFSET_I_LINKS+slot]){
+            dirBlock[OFFSET_I_LINKS+slot] = inodeIdx;
+            return slot;
+        }
+    }
+    printf("Error: Inode ran out of space\n");
+    return ERR_FILE_SIZE_LIMIT;
+}
+
+// unlinks an inode from a directory held in memory
+// in a hashed directory the links after it move back so no probe path has a gap
+int removeDirLink(unsigned char *dirBlock, int inodeIdx){
+    unsigned char *links = dirBlock+OFFSET_I_LINKS;
+    int hole = 0;
+    while (hole < DIR_SLOTS && links[hole] != inodeIdx)
+        hole++;
+    if (hole == DIR_SLOTS)
+        return 0;
+    links[hole] = 0;
+    if (!(dirBlock[OFFSET_I_FLAGS] & FLAG_I_HASHED))
+        return 0;
+
+    int i = hole;
+    while (1){
+        i = (i+1)%DIR_SLOTS;
+        if (!links[i])
+            break;
+        inodeAttr attr;
+        int retVal = getInodeAttr(links[i], &attr);
+        if (retVal < 0)
+            return retVal;
+        // without a name the probe paths are unknown, fall back to scanning every slot
+        if (!retVal){
+            dirBlock[OFFSET_I_FLAGS] &= ~FLAG_I_HASHED;
+            return 0;
+        }
+        int home = dirHomeSlot(attr.name);
+        if ((i-home+DIR_SLOTS)%DIR_SLOTS >= (i-hole+DIR_SLOTS)%DIR_SLOTS){
+            links[hole] = links[i];
+            links[i] = 0;
+            hole = i;
+        }
+    }
+    return 0;
+}
+
+// runs one operation of a batch, returns 0 or an error code
+int runBatchOp(tfsBatchOp *op){
+    if (op->op == BATCH_CREATE || op->op == BATCH_MKDIR){
+        int inodeIdx = openInode(op->path, 1, op->op == BATCH_MKDIR);
+        return inodeIdx < 0 ? inodeIdx : 0;
+    }
+    if (op->op == BATCH_RENAME && (!op->newName || strlen(op->newName) > LEN_I_NAME || strlen(op->newName) == 0)){
+        printf("Error: invalid name\n");
+        return ERR_FILENAME;
+    }
+    if (op->op != BATCH_DELETE && op->op != BATCH_RENAME){
+        printf("Error: invalid batch operation\n");
+        return ERR_FILENAME;
+    }
+
+    int inodeIdx = openInode(op->path, 0, 0);
+    if (inodeIdx < 0)
+        return inodeIdx;
+    if (op->op == BATCH_RENAME)
+        return renamePath(op->path, op->newName);
+    inodeAttr attr;
+    if (getInodeAttr(inodeIdx, &attr) > 0 && attr.isdir)
+        return tfs_removeDir(op->path);
+    return deleteFileInode(op->path, inodeIdx);
+}
+
+// creates the open file table and clears caches after mounting
+int createFileTable(){
+    fileTable.table = calloc(FT_SIZE_INC, sizeof(openFileEntry));
+    if (!fileTable.table){
+        perror("calloc");
+        return ERR_NO_MEMORY;
+    }
+    fileTable.currSize = 0;
+    fileTable.maxSize = FT_SIZE_INC;
+    fileTable.nextFd = 1;
+    memset(attrCache, 0, sizeof(attrCache));
+    pendingBytes = 0;
+    return 0;
+}
+
+// reads the inodes under a directory into the defrag map
+// plans each inode followed by its data blocks, or by its own subtree
+int defragScan(defragMap *map, int dirIdx){
+    unsigned char *dirBlock = map->meta[dirIdx];
+    int i;
+    for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+        int inodeIdx = dirBlock[i+OFFSET_I_LINKS];
+        if (!inodeIdx || isFrozen(inodeIdx))
+            continue;
+        unsigned char *inodeBlock = malloc(BLOCKSIZE);
+        if (!inodeBlock){
+            perror("malloc");
+            return ERR_NO_MEMORY;
+        }
+        map->meta[inodeIdx] = inodeBlock;
+        if (readBlock(mount, inodeIdx, inodeBlock))
+            return ERR_DISK_OPERATION;
+        map->kind[inodeIdx] = DF_INODE;
+        map->owner[inodeIdx] = dirIdx;
+        map->slot[inodeIdx] = i;
+        map->order[map->count++] = inodeIdx;
+
+        if (inodeBlock[OFFSET_I_DIR]){
+            int retVal = defragScan(map, inodeIdx);
+            if (retVal < 0)
+                return retVal;
+        }
+        else if (!(inodeBlock[OFFSET_I_FLAGS] & FLAG_I_INLINE)){
+            int j;
+            for (j=0;(j+OFFSET_I_LINKS)<BLOCKSIZE;j++){
+                int dataIdx = inodeBlock[j+OFFSET_I_LINKS];
+                if (!dataIdx)
+                    continue;
+                if (refCount[dataIdx] > 1 || isFrozen(dataIdx)){
+                    map->kind[dataIdx] = DF_SHARED;
+                    continue;
+                }
+                map->kind[dataIdx] = DF_DATA;
+                map->owner[dataIdx] = inodeIdx;
+                map->slot[dataIdx] = j;
+                map->order[map->count++] = dataIdx;
+            }
+        }
+    }
+    return 0;
+}
+
+// exchanges the contents of blocks a and b, either of which may be free
+// two blocks in use go through a free block, one move at a time, see defragMove
+// with no free block on the disk they stay where they are
+int defragSwap(defragMap *map, int a, int b){
+    if (map->kind[a] == DF_FREE)
+        return defragMove(map, b, a);
+    if (map->kind[b] == DF_FREE)
+        return defragMove(map, a, b);
+    int spare = ROOT_BLOCK+1;
+    while (spare < numBlocks && map->kind[spare] != DF_FREE)
+        spare++;
+    if (spare == numBlocks)
+        return 0;
+    int retVal = defragMove(map, a, spare);
+    if (retVal >= 0)
+        retVal = defragMove(map, b, a);
+    if (retVal >= 0)
+        retVal = defragMove(map, spare, b);
+    return retVal;
+}
+
+// moves the content of block a to the free block b
+// links in the owning inode, open file entries and cached attributes follow the move
+// the content is written at b before its owner links it there, so a crash leaves the
+// owner linking the old copy, a is left for defragFreeChain to write as free
+int defragMove(defragMap *map, int a, int b){
+    unsigned char bufA[BLOCKSIZE];
+    if (map->kind[a] == DF_DATA && readBlock(mount, a, bufA))
+        return ERR_DISK_OPERATION;
+    unsigned char kind = map->kind[a];
+    map->kind[a] = map->kind[b];
+    map->kind[b] = kind;
+    unsigned char owner = map->owner[a];
+    map->owner[a] = map->owner[b];
+    map->owner[b] = owner;
+    unsigned char slot = map->slot[a];
+    map->slot[a] = map->slot[b];
+    map->slot[b] = slot;
+    unsigned char *meta = map->meta[a];
+    map->meta[a] = map->meta[b];
+    map->meta[b] = meta;
+    int planIdx = map->planIdx[a];
+    map->planIdx[a] = map->planIdx[b];
+    map->planIdx[b] = planIdx;
+    if (map->planIdx[a] >= 0)
+        map->order[map->planIdx[a]] = a;
+    if (map->planIdx[b] >= 0)
+        map->order[map->planIdx[b]] = b;
+
+    int i;
+    for (i=0;i<fileTable.maxSize;i++){
+        if (fileTable.table[i].fd && fileTable.table[i].inodeBlock == a)
+            fileTable.table[i].inodeBlock = b;
+        else if (fileTable.table[i].fd && fileTable.table[i].inodeBlock == b)
+            fileTable.table[i].inodeBlock = a;
+    }
+    inodeAttr attr = attrCache[a];
+    attrCache[a] = attrCache[b];
+    attrCache[b] = attr;
+    uint16_t refs = refCount[a];
+    refCount[a] = refCount[b];
+    refCount[b] = refs;
+
+    // dedup index entries follow their data
+    int indexed[2] = {ddIndexed[a], ddIndexed[b]};
+    uint32_t hashes[2] = {ddHash[a], ddHash[b]};
+    dedupRemove(a);
+    dedupRemove(b);
+    if (indexed[0])
+        dedupInsert(b, hashes[0]);
+    if (indexed[1])
+        dedupInsert(a, hashes[1]);
+
+    // children of a moved inode have it as their owner at its new position
+    if (map->kind[b] == DF_INODE && !(map->meta[b][OFFSET_I_FLAGS] & FLAG_I_INLINE)){
+        for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+            if (map->meta[b][i+OFFSET_I_LINKS])
+                map->owner[map->meta[b][i+OFFSET_I_LINKS]] = b;
+        }
+    }
+
+    // the owner links the new position, written after the content
+    int parent = map->owner[b];
+    map->meta[parent][OFFSET_I_LINKS+map->slot[b]] = b;
+    if (writeBlock(mount, b, map->kind[b] == DF_DATA ? bufA : map->meta[b]))
+        return ERR_DISK_OPERATION;
+    if (writeBlock(mount, parent, map->meta[parent]))
+        return ERR_DISK_OPERATION;
+    map->touched[a] = 1;
+    return 0;
+}
+
+// rebuilds the free chain in ascending block order after defragmenting
+// only free blocks whose link changed or that were overwritten are written
+int defragFreeChain(defragMap *map){
+    int next = 0;
+    int b;
+    for (b=numBlocks-1;b>ROOT_BLOCK;b--){
+        if (map->kind[b] != DF_FREE)
+            continue;
+        if ((map->touched[b] || freeLink[b] != next) && writeFreeBlock(b, next) < 0)
+            return ERR_DISK_OPERATION;
+        next = b;
+    }
+    if (superCache[OFFSET_S_FREE] != next){
+        superCache[OFFSET_S_FREE] = next;
+        if (writeBlock(mount, 0, superCache))
+            return ERR_DISK_OPERATION;
+    }
+    return 0;
+}
+
 // creates new entry in filetable, returns index into open file table
 int appendFileTable(char *name) {
     if (strlen(name) > MAX_FILENAME || strlen(name) == 0){
@@ -795,8 +3474,11 @@ int appendFileTable(char *name) {
         }
         int i;
         for (i=0;i<FT_SIZE_INC;i++){
-            fileTable.table[i+fileTable.maxSize].fd = 0;
-            fileTable.table[i+fileTable.maxSize].byteOffset = 0;
+            fileTable.table[i+fileTable.maxSize].raBuffer = NULL;
+            fileTable.table[i+fileTable.maxSize].zBuffer = NULL;
+            fileTable.table[i+fileTable.maxSize].wBuffer = NULL;
+            fileTable.table[i+fileTable.maxSize].wDirty = 0;
+            resetFileEntry(fileTable.table+i+fileTable.maxSize);
         }
         fileTable.maxSize = fileTable.maxSize + FT_SIZE_INC;
     }
@@ -813,6 +3495,7 @@ int appendFileTable(char *name) {
 
     // update table entry
     fileTable.table[i].fd = (fileTable.nextFd++);
+    fileTable.table[i].raWindow = RA_MIN_WINDOW;
     memcpy(fileTable.table[i].filename, name, strlen(name)+1);
     fileTable.currSize++;
 
@@ -825,9 +3508,7 @@ int popFileTable(fileDescriptor fd) {
     if (i < 0)
         return ERR_FD_NOT_FOUND;
 
-    fileTable.table[i].fd = 0;
-    fileTable.table[i].byteOffset = 0;
-    fileTable.table[i].inodeBlock = 0;
+    resetFileEntry(fileTable.table+i);
 
     fileTable.currSize--;
 
@@ -1,9 +1,18 @@
 #ifndef LIBTINYFS_H
 #define LIBTINYFS_H
 
+#include <stdint.h>
+#include <stddef.h>
+
 #include "tinyFS.h"
+#include "libDisk.h"
 
 #define FT_SIZE_INC 100
+#define RA_MIN_WINDOW 2         // data blocks prefetched after a random access
+#define RA_MAX_WINDOW 32        // readahead window limit for sequential access
+#define WB_MAX_PENDING 65536    // buffered write bytes across all files before flushing
+#define DD_DEFAULT_BUDGET 4096  // dedup budget, divided by DD_ENTRY_SIZE it sets the hash buckets
+#define DD_ENTRY_SIZE (sizeof(uint32_t)+2)  // hash, chain link and bucket head per indexed block
 
 #define TYPE_S 1
 #define TYPE_I 2
@@ -11,6 +20,7 @@
 #define TYPE_F 4
 
 #define ROOT_BLOCK 1
+#define MAX_BLOCKS 255
 
 #define OFFSET_TYPE 0
 #define OFFSET_MAGIC 1
@@ -19,7 +29,20 @@
 #define OFFSET_S_SIZE 4
 #define LEN_S_SIZE 4
 #define OFFSET_S_FREE 8
+#define OFFSET_S_FEATURES 9
+#define OFFSET_S_STRIPE 10          // stripe unit in blocks of a disk striped over several files, 0 if not
+
+#define OFFSET_S_FROZEN 16           // bitmap of blocks a snapshot can reach, never changed in place
+#define LEN_S_FROZEN 32
+#define OFFSET_S_SNAPS 48           // snapshot table, a name and root inode block per entry
+#define LEN_S_SNAP (LEN_I_NAME+1)
+#define MAX_SNAPSHOTS 16
 
+#define FEATURE_S_DEDUP 0x01        // new data blocks are deduplicated
+#define FEATURE_S_SHARED 0x02       // data blocks may be linked more than once, stays set
+#define FEATURE_S_RAW_DATA 0x04     // data blocks have no header, set by tfs_mkfsFeatures
+
+#define OFFSET_I_FLAGS 3
 #define OFFSET_I_NAME 4
 #define LEN_I_NAME 8
 #define OFFSET_I_SIZE 12
@@ -29,6 +52,125 @@
 
 #define OFFSET_D_DATA 4
 
+#define FLAG_I_INLINE 0x01          // file data is stored in the inode link bytes
+#define FLAG_I_COMPRESS 0x02        // file content is compressed when written
+#define FLAG_I_COMPRESSED 0x04      // stored data is an lz stream behind its length
+#define FLAG_I_HASHED 0x08          // directory links are placed by name hash with linear probing
+#define FLAG_I_RESERVED 0x10        // file links data blocks past its content, see tfs_fallocate
+#define DIR_SLOTS (BLOCKSIZE-OFFSET_I_LINKS)
+#define MAX_INLINE_SIZE (BLOCKSIZE-OFFSET_I_LINKS)
+#define MAX_FILE_SIZE ((BLOCKSIZE-OFFSET_I_LINKS)*(BLOCKSIZE-OFFSET_D_DATA))
+#define MAX_RAW_FILE_SIZE ((BLOCKSIZE-OFFSET_I_LINKS)*BLOCKSIZE)
+#define LEN_Z_SIZE 3
+#define MAX_COMPRESS_SIZE ((1 << (8*LEN_I_SIZE)) - 1)   // limited by the inode size field
+
+// layouts of the block formats, every field is bytes so there is no padding
+// they describe the formats for tools and tests, the library indexes blocks through the
+// offsets above and only the size accessors below go through the layouts
+// the asserts keep both in step
+struct superLayout_s{
+    uint8_t type;
+    uint8_t magic;
+    uint8_t root;
+    uint8_t unused;
+    uint8_t size[LEN_S_SIZE];               // number of blocks, little endian
+    uint8_t freeHead;
+    uint8_t features;
+    uint8_t stripe;
+    uint8_t reserved[OFFSET_S_FROZEN-OFFSET_S_STRIPE-1];
+    uint8_t frozen[LEN_S_FROZEN];
+    uint8_t snaps[MAX_SNAPSHOTS][LEN_S_SNAP];
+    uint8_t tail[BLOCKSIZE-OFFSET_S_SNAPS-MAX_SNAPSHOTS*LEN_S_SNAP];
+} typedef superLayout;
+
+struct inodeLayout_s{
+    uint8_t type;
+    uint8_t magic;
+    uint8_t unused;
+    uint8_t flags;
+    uint8_t name[LEN_I_NAME];               // not terminated when all bytes are used
+    uint8_t size[LEN_I_SIZE];               // file size in bytes, little endian
+    uint8_t dir;
+    uint8_t links[BLOCKSIZE-OFFSET_I_LINKS];
+} typedef inodeLayout;
+
+struct dataLayout_s{
+    uint8_t type;
+    uint8_t magic;
+    uint8_t unused[OFFSET_D_DATA-2];
+    uint8_t data[BLOCKSIZE-OFFSET_D_DATA];
+} typedef dataLayout;
+
+struct freeLayout_s{
+    uint8_t type;
+    uint8_t magic;
+    uint8_t next;
+    uint8_t unused[BLOCKSIZE-3];
+} typedef freeLayout;
+
+_Static_assert(sizeof(superLayout) == BLOCKSIZE, "superblock layout");
+_Static_assert(offsetof(superLayout, root) == OFFSET_LINK, "superblock root offset");
+_Static_assert(offsetof(superLayout, size) == OFFSET_S_SIZE, "superblock size offset");
+_Static_assert(offsetof(superLayout, freeHead) == OFFSET_S_FREE, "superblock free offset");
+_Static_assert(offsetof(superLayout, features) == OFFSET_S_FEATURES, "superblock features offset");
+_Static_assert(offsetof(superLayout, stripe) == OFFSET_S_STRIPE, "superblock stripe offset");
+_Static_assert(offsetof(superLayout, frozen) == OFFSET_S_FROZEN, "superblock frozen offset");
+_Static_assert(offsetof(superLayout, snaps) == OFFSET_S_SNAPS, "superblock snapshot offset");
+_Static_assert(LEN_S_FROZEN*8 >= MAX_BLOCKS, "frozen bitmap covers every block");
+_Static_assert(sizeof(inodeLayout) == BLOCKSIZE, "inode layout");
+_Static_assert(offsetof(inodeLayout, flags) == OFFSET_I_FLAGS, "inode flags offset");
+_Static_assert(offsetof(inodeLayout, name) == OFFSET_I_NAME, "inode name offset");
+_Static_assert(offsetof(inodeLayout, size) == OFFSET_I_SIZE, "inode size offset");
+_Static_assert(offsetof(inodeLayout, dir) == OFFSET_I_DIR, "inode dir offset");
+_Static_assert(offsetof(inodeLayout, links) == OFFSET_I_LINKS, "inode links offset");
+_Static_assert(sizeof(dataLayout) == BLOCKSIZE, "data block layout");
+_Static_assert(offsetof(dataLayout, data) == OFFSET_D_DATA, "data block payload offset");
+_Static_assert(sizeof(freeLayout) == BLOCKSIZE, "free block layout");
+_Static_assert(offsetof(freeLayout, next) == OFFSET_LINK, "free block link offset");
+_Static_assert(MAX_BLOCKS <= 255, "block links are one byte");
+
+// little endian fields of len bytes, unrolled for the constant lengths below
+static inline uint32_t getField(const uint8_t *field, int len){
+    uint32_t value = 0;
+    int i;
+    for (i=len-1;i>=0;i--)
+        value = value << 8 | field[i];
+    return value;
+}
+
+static inline void setField(uint8_t *field, uint32_t value, int len){
+    int i;
+    for (i=0;i<len;i++){
+        field[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+static inline uint32_t getInodeSize(const unsigned char *block){
+    return getField(((const inodeLayout *)block)->size, LEN_I_SIZE);
+}
+
+static inline void setInodeSize(unsigned char *block, uint32_t size){
+    setField(((inodeLayout *)block)->size, size, LEN_I_SIZE);
+}
+
+static inline uint32_t getSuperSize(const unsigned char *block){
+    return getField(((const superLayout *)block)->size, LEN_S_SIZE);
+}
+
+static inline void setSuperSize(unsigned char *block, uint32_t size){
+    setField(((superLayout *)block)->size, size, LEN_S_SIZE);
+}
+
+// length of an lz stream stored in front of it
+static inline uint32_t getZSize(const unsigned char *stored){
+    return getField(stored, LEN_Z_SIZE);
+}
+
+static inline void setZSize(unsigned char *stored, uint32_t zSize){
+    setField(stored, zSize, LEN_Z_SIZE);
+}
+
 #define MAX_FILENAME 255
 
 struct openFileEntry_s{
@@ -36,8 +178,68 @@ struct openFileEntry_s{
     char filename[MAX_FILENAME+1];
     int byteOffset;
     int inodeBlock;
+    unsigned char *raBuffer;    // prefetched data blocks, RA_MAX_WINDOW blocks long
+    int raFirst;                // file block index of first prefetched block
+    int raCount;                // number of valid blocks in raBuffer
+    int raWindow;               // number of blocks to prefetch on next miss
+    char *wBuffer;              // file content written but not yet on disk
+    int wSize;
+    int wDirty;
+    char *zBuffer;              // decompressed content of a compressed file
+    int zValid;
 } typedef openFileEntry;
 
+struct tfsStat_s{
+    int inodeBlock;             // inode block number, or error code from bulk stat
+    uint32_t size;              // file size in bytes
+    int isdir;                  // 1 if directory
+    char name[LEN_I_NAME+1];
+} typedef tfsStat;
+
+#define BATCH_CREATE 0
+#define BATCH_MKDIR 1
+#define BATCH_DELETE 2
+#define BATCH_RENAME 3
+
+// one operation of tfs_batch
+struct tfsBatchOp_s{
+    int op;                     // BATCH_CREATE, BATCH_MKDIR, BATCH_DELETE or BATCH_RENAME
+    char *path;
+    char *newName;              // new name for BATCH_RENAME
+    int result;                 // 0 or error code, set by tfs_batch
+} typedef tfsBatchOp;
+
+// cached copy of the inode header fields, indexed by block number
+struct inodeAttr_s{
+    int valid;
+    uint32_t size;
+    int isdir;
+    int flags;
+    char name[LEN_I_NAME+1];
+} typedef inodeAttr;
+
+#define MARK_INODE 1    // markTree values, raw data blocks can't be told from inodes by their bytes
+#define MARK_DATA 2
+
+#define DF_FREE 0
+#define DF_INODE 1
+#define DF_DATA 2
+#define DF_SHARED 3     // data block linked more than once or frozen block, never moved
+#define DF_LOST 4       // block neither reached from the root nor free, left alone for tfsck
+
+// block ownership used while defragmenting, indexed by current block number
+struct defragMap_s{
+    unsigned char kind[MAX_BLOCKS];     // DF_FREE, DF_INODE, DF_DATA, DF_SHARED or DF_LOST
+    unsigned char owner[MAX_BLOCKS];    // inode linking to the block
+    unsigned char slot[MAX_BLOCKS];     // link index in the owner
+    unsigned char *meta[MAX_BLOCKS];    // inode contents
+    int planIdx[MAX_BLOCKS];            // index of the block in order, -1 if not planned
+    int order[MAX_BLOCKS];              // planned layout, as current block numbers
+    int target[MAX_BLOCKS];             // planned position of each block in order
+    int count;
+    unsigned char touched[MAX_BLOCKS];  // free blocks overwritten while moving
+} typedef defragMap;
+
 struct openFileTable_s{
     openFileEntry *table;
     int maxSize;
@@ -47,6 +249,7 @@ struct openFileTable_s{
 
 
 int tfs_mkfs(char *filename, int nBytes);
+int tfs_mkfsFeatures(char *filename, int nBytes, int features);
 int tfs_mount(char *diskname);
 int tfs_unmount(void);
 fileDescriptor tfs_openFile(char *name);
@@ -54,30 +257,114 @@ int tfs_closeFile(fileDescriptor FD);
 int tfs_writeFile(fileDescriptor FD,char *buffer, int size);
 int tfs_deleteFile(fileDescriptor FD);
 int tfs_readByte(fileDescriptor FD, char *buffer);
+int tfs_read(fileDescriptor FD, char *buffer, int size);
 int tfs_seek(fileDescriptor FD, int offset);
+int tfs_fsync(fileDescriptor FD);
 
 int tfs_createDir(char *dirName);
 int tfs_removeDir(char *dirName);
 int tfs_removeAll(char *dirName);
 int tfs_readdir();
 int tfs_rename(fileDescriptor FD, char* newName);
+int tfs_stat(char *name, tfsStat *st);
+int tfs_fstat(fileDescriptor FD, tfsStat *st);
+int tfs_statBulk(char **names, int count, tfsStat *st);
+int tfs_defrag(int moveBudget, int msBudget);
+int tfs_setCompression(fileDescriptor FD, int on);
+int tfs_fallocate(fileDescriptor FD, int size);
+int tfs_ftruncate(fileDescriptor FD, int newSize);
+int tfs_setDedup(int on, int budget);
+int tfs_snapshot(char *name);
+int tfs_deleteSnapshot(char *name);
+int tfs_mountSnapshot(char *diskname, char *name);
+int tfs_copy(char *src, char *dst);
+int tfs_export(fileDescriptor FD, int hostfd);
+int tfs_import(int hostfd, char *path);
+int tfs_batch(tfsBatchOp *ops, int count);
+int tfs_move(char *oldPath, char *newPath);
+int tfs_diskStats(diskStats *stats);
+int tfs_setDiskFlags(int flags);
+int tfs_setDiskModel(diskModel *model);
+int tfs_setStripe(int stripeBlocks);
 
 fileDescriptor accessFile(char *name, int isdir);
 int getFreeBlock();
+int allocBlocks(int count, unsigned char *blocks);
+int countFreeBlocks();
+int freeDataBlocks(unsigned char *inodeBlock);
+int writeDataBlocks(char *buffer, int size, unsigned char *blocks, int count);
+int storeDataBlocks(char *stored, int storedSize, int count, unsigned char *links, int *sameAs,
+                    uint32_t *hashes, int newBlocks, unsigned char *blocks);
+int readDataBlocks(unsigned char *blocks, int count, unsigned char *dataBlocks);
+int loadBlocks(unsigned char *wanted, unsigned char *blocks, unsigned char *loaded);
+int readFileContent(int inodeIdx, char *buffer);
+int loadCompressed(openFileEntry *entry, uint32_t size);
+int storeReserved(unsigned char *inodeBlock, char *stored, int storedSize);
+int zeroFillBlocks(unsigned char *inodeBlock, int size, int newSize);
+int finishFlush(openFileEntry *entry, int inodeIdx, unsigned char *inodeBlock);
+void setDataFormat(int features);
+int writeFreeBlock(int blockIdx, int nextIdx);
 int createInode(char* name, int isdir, unsigned char *dirInode, int dirIdx);
 int searchDir(char *filename, unsigned char *dirBlock);
 int getFreeBlock();
 int deleteBlock(int deleteIdx);
+int freeBlocks(unsigned char *blocks, int count);
 int deleteFileContent(int inodeIdx);
 int checkInodeExists(int inodeIdx);
 int openInode(char *name, int create, int isdir);
 int readdir(char *dirName);
 int deleteParentLinks(char *filename, int blockIdx);
+int getInodeAttr(int inodeIdx, inodeAttr *attr);
+void cacheInodeAttr(int inodeIdx, unsigned char *inodeBlock);
+void invalidateInodeAttr(int inodeIdx);
+void fillStat(int inodeIdx, inodeAttr *attr, tfsStat *st);
+
+uint32_t dedupHash(unsigned char *payload);
+void dedupReset();
+void dedupInsert(int blockIdx, uint32_t hash);
+void dedupRemove(int blockIdx);
+int dedupLookup(unsigned char *payload, uint32_t hash);
+int dedupRebuild();
+int dedupMatch(char *stored, int storedSize, int count, unsigned char *links, int *sameAs, uint32_t *hashes);
+
+int isFrozen(int blockIdx);
+int findSnapshot(char *name);
+int cowInode(int inodeIdx);
+int findInodePath(int dirIdx, int inodeIdx, unsigned char *path, int depth);
+int markTree(int inodeIdx, unsigned char *mark);
+int checkWritable();
+int readFileInode(int inodeIdx, unsigned char *inodeBlock);
+int deleteFileInode(char *filename, int inodeIdx);
+int renameInode(int inodeIdx, char *newName);
+int runBatchOp(tfsBatchOp *op);
+int openFsDisk(char *filename, int nBytes);
+int beginMountBatch();
+int endMountBatch();
+int splitPath(char *path, char *parentPath, char *name);
+int renamePath(char *path, char *newName);
+void renameOpenFiles(char *oldPath, char *newPath);
+int dirHomeSlot(char *name);
+int insertDirLink(unsigned char *dirBlock, char *name, int inodeIdx);
+int removeDirLink(unsigned char *dirBlock, int inodeIdx);
+int createFileTable();
+
+int defragScan(defragMap *map, int dirIdx);
+int defragSwap(defragMap *map, int a, int b);
+int defragMove(defragMap *map, int a, int b);
+int defragFreeChain(defragMap *map);
 
 int appendFileTable(char *name);
 int popFileTable(fileDescriptor fd);
 int searchFileTable(fileDescriptor FD);
 int updateFileInodeNumber(fileDescriptor fd, int inodeIdx);
+void resetFileEntry(openFileEntry *entry);
+int fillReadahead(openFileEntry *entry, int blockOffset, uint32_t fileSize);
+void invalidateReadahead(int inodeIdx);
+int flushFileEntry(openFileEntry *entry);
+int flushInode(int inodeIdx);
+int flushAllPending();
+void discardPendingWrites(int inodeIdx, openFileEntry *keep);
+int pendingWriteSize(int inodeIdx);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+// LZ4 style block format, a stream of sequences:
+//  token: high nibble literal count, low nibble match length - LZ_MIN_MATCH
+//  counts of 15 continue in extra bytes of 255 until a byte below 255
+//  literals, then a 2 byte little endian match offset and the match
+// the last sequence only has literals
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5      // bytes at the end always sent as literals
+
+static uint32_t lzHash(const unsigned char *p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// writes a length continuation, returns new output position or NULL if out of space
+static unsigned char *lzPutLength(unsigned char *op, unsigned char *oend, int len){
+    while (len >= 255){
+        if (op >= oend)
+            return NULL;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend)
+        return NULL;
+    *op++ = len;
+    return op;
+}
+
+// writes one sequence, returns new output position or NULL if out of space
+static unsigned char *lzPutSequence(unsigned char *op, unsigned char *oend,
+                                    const unsigned char *lit, int litLen, int offset, int matchLen){
+    if (op >= oend)
+        return NULL;
+    unsigned char *token = op++;
+    int matchCode = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+    *token = ((litLen < 15 ? litLen : 15) << 4) | (matchCode < 15 ? matchCode : 15);
+    if (litLen >= 15 && !(op = lzPutLength(op, oend, litLen - 15)))
+        return NULL;
+    if (op + litLen > oend)
+        return NULL;
+    memcpy(op, lit, litLen);
+    op += litLen;
+    if (!matchLen)
+        return op;
+    if (op + 2 > oend)
+        return NULL;
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    if (matchCode >= 15 && !(op = lzPutLength(op, oend, matchCode - 15)))
+        return NULL;
+    return op;
+}
+
+// compresses src into dst, returns compressed size
+// returns -1 if the result doesn't fit in dstCap bytes
+int lzCompress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCap){
+    const unsigned char *table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    unsigned char *op = dst;
+    unsigned char *oend = dst + dstCap;
+
+    // input too short for a match before the last literals is stored as literals,
+    // so the match limit below never points before src
+    if (srcLen < LZ_MIN_MATCH + LZ_LAST_LITERALS){
+        op = lzPutSequence(op, oend, src, srcLen, 0, 0);
+        return op ? op - dst : -1;
+    }
+
+    const unsigned char *ip = src;
+    const unsigned char *anchor = src;
+    const unsigned char *iend = src + srcLen;
+    const unsigned char *mlimit = iend - LZ_LAST_LITERALS;
+
+    while (ip + LZ_MIN_MATCH <= mlimit){
+        uint32_t h = lzHash(ip);
+        const unsigned char *ref = table[h];
+        table[h] = ip;
+        if (!ref || ip - ref > LZ_MAX_OFFSET || memcmp(ref, ip, LZ_MIN_MATCH)){
+            ip++;
+            continue;
+        }
+
+        int matchLen = LZ_MIN_MATCH;
+        while (ip + matchLen < mlimit && ref[matchLen] == ip[matchLen])
+            matchLen++;
+        op = lzPutSequence(op, oend, anchor, ip - anchor, ip - ref, matchLen);
+        if (!op)
+            return -1;
+        ip += matchLen;
+        anchor = ip;
+    }
+
+    op = lzPutSequence(op, oend, anchor, iend - anchor, 0, 0);
+    if (!op)
+        return -1;
+    return op - dst;
+}
+
+// reads a length continuation, returns -1 if the input ends early
+static int lzGetLength(const unsigned char **ip, const unsigned char *iend){
+    int len = 0;
+    unsigned char b;
+    do {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+// decompresses src into dst, returns decompressed size
+// returns -1 if the input is corrupt or would overflow dstLen bytes
+int lzDecompress(const unsigned char *src, int srcLen, unsigned char *dst, int dstLen){
+    const unsigned char *ip = src;
+    const unsigned char *iend = src + srcLen;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + dstLen;
+
+    while (ip < iend){
+        int token = *ip++;
+        int litLen = token >> 4;
+        if (litLen == 15){
+            int extra = lzGetLength(&ip, iend);
+            if (extra < 0)
+                return -1;
+            litLen += extra;
+        }
+        if (ip + litLen > iend || op + litLen > oend)
+            return -1;
+        memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == iend)
+            break;
+
+        if (ip + 2 > iend)
+            return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int matchLen = token & 0xF;
+        if (matchLen == 15){
+            int extra = lzGetLength(&ip, iend);
+            if (extra < 0)
+                return -1;
+            matchLen += extra;
+        }
+        matchLen += LZ_MIN_MATCH;
+        if (!offset || offset > op - dst || op + matchLen > oend)
+            return -1;
+
+        // byte copy, matches may overlap their own output
+        const unsigned char *ref = op - offset;
+        while (matchLen--)
+            *op++ = *ref++;
+    }
+    return op - dst;
+}
@@ -0,0 +1,7 @@
+#ifndef LZ_H
+#define LZ_H
+
+int lzCompress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCap);
+int lzDecompress(const unsigned char *src, int srcLen, unsigned char *dst, int dstLen);
+
+#endif
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "TinyFS_errno.h"
+#include "tfsAsync.h"
+
+// one engine thread runs the queued calls in submission order, the library isn't thread safe
+// calls queued together run in one libDisk batch, so they share block reads and writes
+// completions are queued for tfs_asyncPoll and counted on an eventfd for epoll
+static pthread_t engine;
+static pthread_mutex_t asyncLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t asyncWake = PTHREAD_COND_INITIALIZER;
+static tfsAsyncReq *submitHead;
+static tfsAsyncReq *submitTail;
+static tfsAsyncReq *doneHead;
+static tfsAsyncReq *doneTail;
+static int eventFd = -1;
+static int running;
+static int nextToken = 1;
+
+// runs queued calls until tfs_asyncShutdown, completing each group together
+static void *engineMain(void *arg){
+    while (1){
+        pthread_mutex_lock(&asyncLock);
+        while (running && !submitHead)
+            pthread_cond_wait(&asyncWake, &asyncLock);
+        tfsAsyncReq *group = submitHead;
+        submitHead = NULL;
+        submitTail = NULL;
+        pthread_mutex_unlock(&asyncLock);
+        if (!group)
+            break;
+
+        // a group is durable when its batch ends, a failed batch fails every call in it
+        int batched = group->next && beginMountBatch() == 0;
+        tfsAsyncReq *req;
+        uint64_t count = 0;
+        for (req=group;req;req=req->next){
+            req->c.result = runAsyncReq(req);
+            count++;
+        }
+        // descriptors the group opened are closed again, the caller never sees them
+        if (batched && endMountBatch() < 0){
+            for (req=group;req;req=req->next){
+                if (req->c.op == ASYNC_OPEN && req->c.result >= 0 && searchFileTable(req->c.result) >= 0)
+                    tfs_closeFile(req->c.result);
+                req->c.result = ERR_DISK_OPERATION;
+            }
+        }
+
+        pthread_mutex_lock(&asyncLock);
+        for (req=group;req->next;req=req->next);
+        if (doneTail)
+            doneTail->next = group;
+        else
+            doneHead = group;
+        doneTail = req;
+        pthread_mutex_unlock(&asyncLock);
+        if (write(eventFd, &count, sizeof(count)) < 0)
+            perror("write");
+    }
+    return NULL;
+}
+
+// starts the engine, returns an eventfd that is readable while completions wait for tfs_asyncPoll
+// other tfs_ calls must not be made while the engine runs
+int tfs_asyncInit(){
+    if (running){
+        printf("Error: async engine already running\n");
+        return ERR_DISK_OPERATION;
+    }
+    eventFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (eventFd < 0){
+        perror("eventfd");
+        return ERR_DISK_OPERATION;
+    }
+    running = 1;
+    if (pthread_create(&engine, NULL, engineMain, NULL)){
+        printf("Error: can't start async engine\n");
+        running = 0;
+        close(eventFd);
+        eventFd = -1;
+        return ERR_DISK_OPERATION;
+    }
+    return eventFd;
+}
+
+// finishes every submitted call, then stops the engine
+// completions nobody polled are dropped without running their callbacks
+int tfs_asyncShutdown(){
+    if (!running){
+        printf("Error: async engine not running\n");
+        return ERR_DISK_OPERATION;
+    }
+    pthread_mutex_lock(&asyncLock);
+    running = 0;
+    pthread_cond_signal(&asyncWake);
+    pthread_mutex_unlock(&asyncLock);
+    pthread_join(engine, NULL);
+
+    while (doneHead){
+        tfsAsyncReq *next = doneHead->next;
+        freeAsyncReq(doneHead);
+        doneHead = next;
+    }
+    doneTail = NULL;
+    close(eventFd);
+    eventFd = -1;
+    return 0;
+}
+
+// takes up to max completions, runs their callbacks on the calling thread
+// completions without a callback are copied to done, returns how many were copied
+int tfs_asyncPoll(tfsCompletion *done, int max){
+    if (eventFd < 0){
+        printf("Error: async engine not running\n");
+        return ERR_DISK_OPERATION;
+    }
+    uint64_t count;
+    if (read(eventFd, &count, sizeof(count)) < 0)
+        count = 0;
+
+    pthread_mutex_lock(&asyncLock);
+    tfsAsyncReq *list = doneHead;
+    tfsAsyncReq *last = NULL;
+    int taken = 0;
+    while (doneHead && taken < max){
+        last = doneHead;
+        doneHead = doneHead->next;
+        taken++;
+    }
+    if (!doneHead)
+        doneTail = NULL;
+    if (last)
+        last->next = NULL;
+    int left = doneHead != NULL;
+    pthread_mutex_unlock(&asyncLock);
+
+    // the eventfd stays readable while completions are left
+    count = 1;
+    if (left && write(eventFd, &count, sizeof(count)) < 0)
+        perror("write");
+
+    int n = 0;
+    while (taken--){
+        tfsAsyncReq *next = list->next;
+        if (list->cb)
+            list->cb(&list->c);
+        else
+            done[n++] = list->c;
+        freeAsyncReq(list);
+        list = next;
+    }
+    return n;
+}
+
+int tfs_asyncOpen(char *name, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_OPEN, name, NULL, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    return submitAsyncReq(req);
+}
+
+int tfs_asyncClose(fileDescriptor FD, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_CLOSE, NULL, NULL, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    req->fd = FD;
+    return submitAsyncReq(req);
+}
+
+// buffer must stay valid until the completion, the result is the number of bytes read
+int tfs_asyncRead(fileDescriptor FD, char *buffer, int size, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_READ, NULL, NULL, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    req->fd = FD;
+    req->buffer = buffer;
+    req->size = size;
+    return submitAsyncReq(req);
+}
+
+// buffer must stay valid until the completion
+int tfs_asyncWrite(fileDescriptor FD, char *buffer, int size, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_WRITE, NULL, NULL, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    req->fd = FD;
+    req->buffer = buffer;
+    req->size = size;
+    return submitAsyncReq(req);
+}
+
+int tfs_asyncDelete(fileDescriptor FD, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_DELETE, NULL, NULL, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    req->fd = FD;
+    return submitAsyncReq(req);
+}
+
+int tfs_asyncCreateDir(char *dirName, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_CREATE_DIR, dirName, NULL, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    return submitAsyncReq(req);
+}
+
+int tfs_asyncRemoveDir(char *dirName, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_REMOVE_DIR, dirName, NULL, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    return submitAsyncReq(req);
+}
+
+int tfs_asyncRemoveAll(char *dirName, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_REMOVE_ALL, dirName, NULL, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    return submitAsyncReq(req);
+}
+
+int tfs_asyncMove(char *oldPath, char *newPath, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_MOVE, oldPath, newPath, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    return submitAsyncReq(req);
+}
+
+// st must stay valid until the completion
+int tfs_asyncStat(char *name, tfsStat *st, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = newAsyncReq(ASYNC_STAT, name, NULL, cb, arg);
+    if (!req)
+        return ERR_NO_MEMORY;
+    req->st = st;
+    return submitAsyncReq(req);
+}
+
+// HELPER FUNCTIONS -----------------------------------------------------------
+
+// allocates a request, the paths are copied so callers may reuse theirs
+tfsAsyncReq *newAsyncReq(int op, char *path, char *path2, tfsCallback cb, void *arg){
+    tfsAsyncReq *req = calloc(1, sizeof(tfsAsyncReq));
+    if (!req){
+        perror("calloc");
+        return NULL;
+    }
+    req->c.op = op;
+    req->c.arg = arg;
+    req->cb = cb;
+    if ((path && !(req->path = strdup(path))) || (path2 && !(req->path2 = strdup(path2)))){
+        perror("strdup");
+        freeAsyncReq(req);
+        return NULL;
+    }
+    return req;
+}
+
+// queues a request for the engine, returns its token
+int submitAsyncReq(tfsAsyncReq *req){
+    pthread_mutex_lock(&asyncLock);
+    if (!running){
+        pthread_mutex_unlock(&asyncLock);
+        printf("Error: async engine not running\n");
+        freeAsyncReq(req);
+        return ERR_DISK_OPERATION;
+    }
+    req->c.token = nextToken++;
+    if (nextToken <= 0)
+        nextToken = 1;
+    if (submitTail)
+        submitTail->next = req;
+    else
+        submitHead = req;
+    submitTail = req;
+    int token = req->c.token;
+    pthread_cond_signal(&asyncWake);
+    pthread_mutex_unlock(&asyncLock);
+    return token;
+}
+
+// runs a request with the synchronous call, on the engine thread
+int runAsyncReq(tfsAsyncReq *req){
+    int op = req->c.op;
+    if (op == ASYNC_OPEN)
+        return tfs_openFile(req->path);
+    else if (op == ASYNC_CLOSE)
+        return tfs_closeFile(req->fd);
+    else if (op == ASYNC_READ)
+        return tfs_read(req->fd, req->buffer, req->size);
+    else if (op == ASYNC_WRITE)
+        return tfs_writeFile(req->fd, req->buffer, req->size);
+    else if (op == ASYNC_DELETE)
+        return tfs_deleteFile(req->fd);
+    else if (op == ASYNC_CREATE_DIR)
+        return tfs_createDir(req->path);
+    else if (op == ASYNC_REMOVE_DIR)
+        return tfs_removeDir(req->path);
+    else if (op == ASYNC_REMOVE_ALL)
+        return tfs_removeAll(req->path);
+    else if (op == ASYNC_MOVE)
+        return tfs_move(req->path, req->path2);
+    else if (op == ASYNC_STAT)
+        return tfs_stat(req->path, req->st);
+    printf("Error: invalid async operation\n");
+    return ERR_FILENAME;
+}
+
+void freeAsyncReq(tfsAsyncReq *req){
+    free(req->path);
+    free(req->path2);
+    free(req);
+}
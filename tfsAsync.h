@@ -0,0 +1,59 @@
+#ifndef TFSASYNC_H
+#define TFSASYNC_H
+
+#include "libTinyFS.h"
+
+#define ASYNC_OPEN 0
+#define ASYNC_CLOSE 1
+#define ASYNC_READ 2
+#define ASYNC_WRITE 3
+#define ASYNC_DELETE 4
+#define ASYNC_CREATE_DIR 5
+#define ASYNC_REMOVE_DIR 6
+#define ASYNC_REMOVE_ALL 7
+#define ASYNC_MOVE 8
+#define ASYNC_STAT 9
+
+// result of an asynchronous call, handed to its callback or returned by tfs_asyncPoll
+struct tfsCompletion_s{
+    int token;                  // returned by the submitting call
+    int op;                     // ASYNC_OPEN ... ASYNC_STAT
+    int result;                 // what the synchronous call returned
+    void *arg;                  // caller pointer given at submission
+} typedef tfsCompletion;
+
+typedef void (*tfsCallback)(tfsCompletion *c);
+
+// queued asynchronous call, paths are copies, buffers belong to the caller until completion
+struct tfsAsyncReq_s{
+    tfsCompletion c;
+    tfsCallback cb;
+    fileDescriptor fd;
+    char *path;
+    char *path2;
+    char *buffer;
+    int size;
+    tfsStat *st;
+    struct tfsAsyncReq_s *next;
+} typedef tfsAsyncReq;
+
+int tfs_asyncInit();
+int tfs_asyncShutdown();
+int tfs_asyncPoll(tfsCompletion *done, int max);
+int tfs_asyncOpen(char *name, tfsCallback cb, void *arg);
+int tfs_asyncClose(fileDescriptor FD, tfsCallback cb, void *arg);
+int tfs_asyncRead(fileDescriptor FD, char *buffer, int size, tfsCallback cb, void *arg);
+int tfs_asyncWrite(fileDescriptor FD, char *buffer, int size, tfsCallback cb, void *arg);
+int tfs_asyncDelete(fileDescriptor FD, tfsCallback cb, void *arg);
+int tfs_asyncCreateDir(char *dirName, tfsCallback cb, void *arg);
+int tfs_asyncRemoveDir(char *dirName, tfsCallback cb, void *arg);
+int tfs_asyncRemoveAll(char *dirName, tfsCallback cb, void *arg);
+int tfs_asyncMove(char *oldPath, char *newPath, tfsCallback cb, void *arg);
+int tfs_asyncStat(char *name, tfsStat *st, tfsCallback cb, void *arg);
+
+tfsAsyncReq *newAsyncReq(int op, char *path, char *path2, tfsCallback cb, void *arg);
+int submitAsyncReq(tfsAsyncReq *req);
+int runAsyncReq(tfsAsyncReq *req);
+void freeAsyncReq(tfsAsyncReq *req);
+
+#endif
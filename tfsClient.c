@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "TinyFS_errno.h"
+#include "tfsClient.h"
+
+// content larger than a slot is split over several entries, queued together so
+// the server runs them in one pass, and collected in order
+static int sock = -1;
+static int submitFd = -1;
+static int completeFd = -1;
+static tfsdRing *ring;
+static uint32_t submitted;      // entries queued, the ring counter is set from it
+static uint32_t announced;      // entries the server was signalled about
+
+// connects to the tfsd serving on socketPath, the default socket if NULL
+int tfsc_connect(char *socketPath){
+    if (sock >= 0){
+        printf("Error: already connected to tfsd\n");
+        return ERR_DISK_OPERATION;
+    }
+    if (!socketPath)
+        socketPath = TFSD_SOCKET;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)){
+        printf("Error: socket path too long\n");
+        return ERR_FILENAME;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+    if (fd < 0){
+        perror("socket");
+        return ERR_DISK_OPERATION;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        perror("connect");
+        close(fd);
+        return ERR_DISK_OPERATION;
+    }
+    tfsdReply greeting;
+    int fds[TFSD_GREETING_FDS];
+    int retVal = recvFds(fd, &greeting, fds);
+    if (retVal < 0){
+        close(fd);
+        return retVal;
+    }
+    ring = mmap(NULL, sizeof(tfsdRing), PROT_READ|PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (ring == MAP_FAILED){
+        perror("mmap");
+        ring = NULL;
+        close(fds[1]);
+        close(fds[2]);
+        close(fd);
+        return ERR_DISK_OPERATION;
+    }
+    sock = fd;
+    submitFd = fds[1];
+    completeFd = fds[2];
+    submitted = 0;
+    announced = 0;
+    return 0;
+}
+
+// receives the greeting and the descriptors sent with it
+int recvFds(int sock, tfsdReply *reply, int *fds){
+    char control[CMSG_SPACE(TFSD_GREETING_FDS*sizeof(int))];
+    struct iovec iov = {reply, sizeof(tfsdReply)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(tfsdReply)){
+        printf("Error: no greeting from tfsd\n");
+        return ERR_DISK_OPERATION;
+    }
+    if (reply->result < 0)
+        return reply->result;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(TFSD_GREETING_FDS*sizeof(int))){
+        printf("Error: bad greeting from tfsd\n");
+        return ERR_DISK_OPERATION;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), TFSD_GREETING_FDS*sizeof(int));
+    return 0;
+}
+
+// closes the connection, the server closes files left open
+int tfsc_disconnect(){
+    if (sock < 0){
+        printf("Error: not connected to tfsd\n");
+        return ERR_DISK_OPERATION;
+    }
+    munmap(ring, sizeof(tfsdRing));
+    close(sock);
+    close(submitFd);
+    close(completeFd);
+    ring = NULL;
+    sock = -1;
+    submitFd = -1;
+    completeFd = -1;
+    return 0;
+}
+
+// sends a call over the socket and waits for its reply, returns the call's result
+int callServer(int op, int fd, int arg, char *path, char *path2, tfsdReply *reply){
+    if (sock < 0){
+        printf("Error: not connected to tfsd\n");
+        return ERR_DISK_OPERATION;
+    }
+    if ((path && strlen(path) >= TFSD_PATH_MAX) || (path2 && strlen(path2) >= TFSD_PATH_MAX)){
+        printf("Error: path too long\n");
+        return ERR_FILENAME;
+    }
+    tfsdRequest req;
+    memset(&req, 0, sizeof(req));
+    req.op = op;
+    req.fd = fd;
+    req.arg = arg;
+    if (path)
+        strcpy(req.path, path);
+    if (path2)
+        strcpy(req.path2, path2);
+    tfsdReply local;
+    if (!reply)
+        reply = &local;
+    if (send(sock, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req)
+        || recv(sock, reply, sizeof(tfsdReply), 0) != sizeof(tfsdReply)){
+        printf("Error: lost connection to tfsd\n");
+        return ERR_DISK_OPERATION;
+    }
+    return reply->result;
+}
+
+// queues an entry, its slot must be filled first, the server is signalled by waitEntry
+// returns the entry number
+int submitEntry(int op, int fd, int size){
+    tfsdEntry *e = ring->entries + submitted % TFSD_RING_ENTRIES;
+    e->op = op;
+    e->fd = fd;
+    e->size = size;
+    submitted++;
+    __atomic_store_n(&ring->submitted, submitted, __ATOMIC_RELEASE);
+    return submitted-1;
+}
+
+// signals queued entries and waits until entry is completed, returns its result
+int waitEntry(uint32_t entry){
+    if (announced != submitted){
+        uint64_t count = submitted - announced;
+        if (write(submitFd, &count, sizeof(count)) < 0){
+            perror("write");
+            return ERR_DISK_OPERATION;
+        }
+        announced = submitted;
+    }
+    while ((int32_t)(__atomic_load_n(&ring->completed, __ATOMIC_ACQUIRE) - entry) <= 0){
+        struct pollfd pfds[2] = {{completeFd, POLLIN, 0}, {sock, POLLIN, 0}};
+        if (poll(pfds, 2, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return ERR_DISK_OPERATION;
+        }
+        uint64_t count;
+        if (pfds[0].revents & POLLIN){
+            if (read(completeFd, &count, sizeof(count)) < 0)
+                perror("read");
+        }
+        // the server only sends replies to calls, anything else means it went away
+        else if (pfds[1].revents){
+            printf("Error: lost connection to tfsd\n");
+            return ERR_DISK_OPERATION;
+        }
+    }
+    return ring->entries[entry % TFSD_RING_ENTRIES].result;
+}
+
+fileDescriptor tfsc_openFile(char *name){
+    return callServer(TFSD_OPEN, 0, 0, name, NULL, NULL);
+}
+
+int tfsc_closeFile(fileDescriptor FD){
+    return callServer(TFSD_CLOSE, FD, 0, NULL, NULL, NULL);
+}
+
+// content goes through the ring, a slot at a time
+int tfsc_writeFile(fileDescriptor FD, char *buffer, int size){
+    if (!ring){
+        printf("Error: not connected to tfsd\n");
+        return ERR_DISK_OPERATION;
+    }
+    int pieces = size > 0 ? (size + TFSD_SLOT_SIZE-1) / TFSD_SLOT_SIZE : 1;
+    uint32_t first = submitted;
+    int queued = 0, done = 0, retVal = 0;
+    while (done < pieces){
+        while (queued < pieces && queued-done < TFSD_RING_ENTRIES){
+            int part = size - queued*TFSD_SLOT_SIZE;
+            if (part > TFSD_SLOT_SIZE)
+                part = TFSD_SLOT_SIZE;
+            if (part > 0)
+                memcpy(ring->data[submitted % TFSD_RING_ENTRIES], buffer + queued*TFSD_SLOT_SIZE, part);
+            submitEntry(queued == pieces-1 ? TFSD_WRITE : TFSD_WRITE_PART, FD, size > 0 ? part : size);
+            queued++;
+        }
+        // a failed part fails the final entry too, so the server drops the whole write
+        retVal = waitEntry(first + done);
+        done++;
+    }
+    return retVal;
+}
+
+int tfsc_deleteFile(fileDescriptor FD){
+    return callServer(TFSD_DELETE, FD, 0, NULL, NULL, NULL);
+}
+
+int tfsc_readByte(fileDescriptor FD, char *buffer){
+    if (!ring){
+        printf("Error: not connected to tfsd\n");
+        return ERR_DISK_OPERATION;
+    }
+    uint32_t entry = submitEntry(TFSD_READ_BYTE, FD, 0);
+    int retVal = waitEntry(entry);
+    if (retVal >= 0)
+        *buffer = ring->data[entry % TFSD_RING_ENTRIES][0];
+    return retVal;
+}
+
+// a read larger than a slot is split, the parts after a short part add nothing
+int tfsc_read(fileDescriptor FD, char *buffer, int size){
+    if (!ring){
+        printf("Error: not connected to tfsd\n");
+        return ERR_DISK_OPERATION;
+    }
+    int pieces = size > 0 ? (size + TFSD_SLOT_SIZE-1) / TFSD_SLOT_SIZE : 1;
+    uint32_t first = submitted;
+    int queued = 0, done = 0, total = 0, retVal = 0, ended = 0;
+    while (done < pieces){
+        while (queued < pieces && queued-done < TFSD_RING_ENTRIES){
+            int part = size - queued*TFSD_SLOT_SIZE;
+            submitEntry(TFSD_READ, FD, part > TFSD_SLOT_SIZE ? TFSD_SLOT_SIZE : part);
+            queued++;
+        }
+        uint32_t entry = first + done;
+        int got = waitEntry(entry);
+        int part = size - done*TFSD_SLOT_SIZE;
+        done++;
+        if (ended)
+            continue;
+        if (got < 0){
+            retVal = got;
+            ended = 1;
+            continue;
+        }
+        memcpy(buffer + total, ring->data[entry % TFSD_RING_ENTRIES], got);
+        total += got;
+        if (got < part && got < TFSD_SLOT_SIZE)
+            ended = 1;
+    }
+    return total ? total : retVal;
+}
+
+int tfsc_seek(fileDescriptor FD, int offset){
+    return callServer(TFSD_SEEK, FD, offset, NULL, NULL, NULL);
+}
+
+int tfsc_fsync(fileDescriptor FD){
+    return callServer(TFSD_FSYNC, FD, 0, NULL, NULL, NULL);
+}
+
+int tfsc_createDir(char *dirName){
+    return callServer(TFSD_CREATE_DIR, 0, 0, dirName, NULL, NULL);
+}
+
+int tfsc_removeDir(char *dirName){
+    return callServer(TFSD_REMOVE_DIR, 0, 0, dirName, NULL, NULL);
+}
+
+int tfsc_removeAll(char *dirName){
+    return callServer(TFSD_REMOVE_ALL, 0, 0, dirName, NULL, NULL);
+}
+
+int tfsc_rename(fileDescriptor FD, char *newName){
+    return callServer(TFSD_RENAME, FD, 0, newName, NULL, NULL);
+}
+
+int tfsc_move(char *oldPath, char *newPath){
+    return callServer(TFSD_MOVE, 0, 0, oldPath, newPath, NULL);
+}
+
+int tfsc_stat(char *name, tfsStat *st){
+    tfsdReply reply;
+    int retVal = callServer(TFSD_STAT, 0, 0, name, NULL, &reply);
+    if (retVal >= 0)
+        *st = reply.st;
+    return retVal;
+}
+
+int tfsc_fstat(fileDescriptor FD, tfsStat *st){
+    tfsdReply reply;
+    int retVal = callServer(TFSD_FSTAT, FD, 0, NULL, NULL, &reply);
+    if (retVal >= 0)
+        *st = reply.st;
+    return retVal;
+}
+
+// block I/O of the served disk, as tfs_diskStats
+int tfsc_diskStats(diskStats *stats){
+    tfsdReply reply;
+    int retVal = callServer(TFSD_DISK_STATS, 0, 0, NULL, NULL, &reply);
+    if (retVal >= 0)
+        *stats = reply.stats;
+    return retVal;
+}
+
+// asks the server to close every client's files and stop, then disconnects
+int tfsc_shutdown(){
+    int retVal = callServer(TFSD_SHUTDOWN, 0, 0, NULL, NULL, NULL);
+    if (sock >= 0)
+        tfsc_disconnect();
+    return retVal;
+}
@@ -0,0 +1,34 @@
+#ifndef TFSCLIENT_H
+#define TFSCLIENT_H
+
+#include "libTinyFS.h"
+#include "tfsServer.h"
+
+// calls of a file system served by tfsd, they take and return what the tfs_ calls do
+// a process has one connection, its calls must not be made from several threads at once
+int tfsc_connect(char *socketPath);
+int tfsc_disconnect();
+fileDescriptor tfsc_openFile(char *name);
+int tfsc_closeFile(fileDescriptor FD);
+int tfsc_writeFile(fileDescriptor FD, char *buffer, int size);
+int tfsc_deleteFile(fileDescriptor FD);
+int tfsc_readByte(fileDescriptor FD, char *buffer);
+int tfsc_read(fileDescriptor FD, char *buffer, int size);
+int tfsc_seek(fileDescriptor FD, int offset);
+int tfsc_fsync(fileDescriptor FD);
+int tfsc_createDir(char *dirName);
+int tfsc_removeDir(char *dirName);
+int tfsc_removeAll(char *dirName);
+int tfsc_rename(fileDescriptor FD, char *newName);
+int tfsc_move(char *oldPath, char *newPath);
+int tfsc_stat(char *name, tfsStat *st);
+int tfsc_fstat(fileDescriptor FD, tfsStat *st);
+int tfsc_diskStats(diskStats *stats);
+int tfsc_shutdown();
+
+int callServer(int op, int fd, int arg, char *path, char *path2, tfsdReply *reply);
+int submitEntry(int op, int fd, int size);
+int waitEntry(uint32_t entry);
+int recvFds(int sock, tfsdReply *reply, int *fds);
+
+#endif
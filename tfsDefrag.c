@@ -0,0 +1,54 @@
+/* tinyFS defragmenter
+ * usage: tfsdefrag [-m moves] [-t ms] diskname
+ *
+ * Without limits the disk is defragmented completely. With -m or -t a single
+ * incremental pass is made within that budget, so it can be scheduled
+ * during quiet periods.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "TinyFS_errno.h"
+
+int main(int argc, char **argv){
+    int moveBudget = 0;
+    int msBudget = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:t:")) != -1){
+        if (opt == 'm')
+            moveBudget = atoi(optarg);
+        else if (opt == 't')
+            msBudget = atoi(optarg);
+        else{
+            printf("usage: %s [-m moves] [-t ms] diskname\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc){
+        printf("usage: %s [-m moves] [-t ms] diskname\n", argv[0]);
+        return 1;
+    }
+
+    if (tfs_mount(argv[optind]) < 0)
+        return 1;
+
+    int remaining;
+    int passes = 0;
+    do {
+        remaining = tfs_defrag(moveBudget, msBudget);
+        passes++;
+    } while (remaining > 0 && !moveBudget && !msBudget);
+
+    if (remaining < 0)
+        printf("%s: defrag failed (%d)\n", argv[optind], remaining);
+    else
+        printf("%s: %d blocks out of place after %d pass(es)\n", argv[optind], remaining, passes);
+
+    if (tfs_unmount() < 0 || remaining < 0)
+        return 1;
+    return 0;
+}
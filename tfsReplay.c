@@ -0,0 +1,391 @@
+/* tinyFS workload replay
+ * usage: tfsreplay [-p] [-v] [-D hdd|ssd|nvme] [-d diskname] [-s bytes] tracefile
+ *
+ * Replays a trace recorded through tfsTrace.h against a freshly formatted
+ * disk, as fast as possible or with -p at the recorded pace, and reports
+ * throughput, latency percentiles per call and block I/O. Disk names in the
+ * trace are replaced by the replay disk, striped over as many files as the
+ * recorded name lists, named diskname, diskname.1 and so on. File content isn't in the trace, so
+ * writes and imports store text of the recorded sizes. Messages printed by the
+ * library are hidden unless -v is given. With -D the disk is timed on a
+ * simulated device and its time is reported with the block I/O, otherwise
+ * on the devices the trace sets.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "libDisk.h"
+#include "TinyFS_errno.h"
+#include "tfsTrace.h"
+
+#define REPLAY_DISK "tfsReplay.dsk"
+#define REPLAY_DISK_SIZE (MAX_BLOCKS*BLOCKSIZE)
+#define REPLAY_PHRASE "hello world from (a) file "
+
+// latencies of one kind of call, in nanoseconds
+struct opLatency_s{
+    long *replayed;
+    long *recorded;
+    int count;
+    int cap;
+} typedef opLatency;
+
+static opLatency latency[TRACE_OPS];
+
+// trace file descriptors to replay file descriptors, -1 when not open
+static int *fdMap;
+static int fdMapSize;
+
+static char stripeName[DISK_NAME_MAX+1];
+
+// the -D model, used in place of the models a trace sets
+static diskModel *forcedModel;
+
+static char *buffer;
+static int bufferSize;
+static long bytesWritten;
+static long bytesRead;
+
+static int mapFd(int recorded){
+    if (recorded < 0 || recorded >= fdMapSize)
+        return -1;
+    return fdMap[recorded];
+}
+
+static void setFd(int recorded, int fd){
+    if (recorded < 0)
+        return;
+    if (recorded >= fdMapSize){
+        int size = recorded*2+16;
+        int *grown = realloc(fdMap, size * sizeof(int));
+        if (!grown){
+            perror("realloc");
+            exit(1);
+        }
+        memset(grown+fdMapSize, -1, (size-fdMapSize) * sizeof(int));
+        fdMap = grown;
+        fdMapSize = size;
+    }
+    fdMap[recorded] = fd;
+}
+
+// the replay disk for a disk name of the trace, with one file per file of a striped name
+// a replay disk given with commas is used as it is
+static char *replayDisk(char *disk, char *recorded){
+    int members = 1;
+    char *c;
+    for (c=recorded;c && *c;c++)
+        members += *c == ',';
+    if (members == 1 || strchr(disk, ','))
+        return disk;
+    int len = snprintf(stripeName, sizeof(stripeName), "%s", disk);
+    int i;
+    for (i=1;i<members && len < sizeof(stripeName);i++)
+        len += snprintf(stripeName+len, sizeof(stripeName)-len, ",%s.%d", disk, i);
+    return stripeName;
+}
+
+// grows the data buffer to size bytes of the phrase
+static void growBuffer(int size){
+    if (size <= bufferSize)
+        return;
+    char *grown = realloc(buffer, size);
+    if (!grown){
+        perror("realloc");
+        exit(1);
+    }
+    buffer = grown;
+    int len = strlen(REPLAY_PHRASE);
+    int i;
+    for (i=bufferSize;i<size;i++)
+        buffer[i] = REPLAY_PHRASE[i % len];
+    bufferSize = size;
+}
+
+static void addLatency(int op, long replayed, long recorded){
+    opLatency *l = latency+op;
+    if (l->count == l->cap){
+        l->cap = l->cap ? l->cap*2 : 64;
+        l->replayed = realloc(l->replayed, l->cap * sizeof(long));
+        l->recorded = realloc(l->recorded, l->cap * sizeof(long));
+        if (!l->replayed || !l->recorded){
+            perror("realloc");
+            exit(1);
+        }
+    }
+    l->replayed[l->count] = replayed;
+    l->recorded[l->count] = recorded;
+    l->count++;
+}
+
+static int compareLong(const void *a, const void *b){
+    long x = *(long *)a, y = *(long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// percentile of sorted values, in microseconds
+static double percentile(long *sorted, int count, int p){
+    return sorted[(long)(count-1)*p/100] / 1e3;
+}
+
+// makes the call a record describes, timing only the call
+// returns its result and sets ns to how long it took
+static int replayRecord(traceRecord *rec, char *disk, int devNull, long *ns){
+    int op = rec->op;
+    int *a = rec->args;
+    char **s = rec->strs;
+    int fd = mapFd(a[0]);
+    int hostfd = -1;
+    tfsStat st;
+    tfsStat *sts = NULL;
+    diskStats stats;
+    char c;
+    if (op == TRACE_WRITE || op == TRACE_READ)
+        growBuffer(a[1]);
+    if (op == TRACE_STAT_BULK && !(sts = malloc((rec->count ? rec->count : 1) * sizeof(tfsStat)))){
+        perror("malloc");
+        exit(1);
+    }
+    if (op == TRACE_IMPORT){
+        FILE *host = tmpfile();
+        growBuffer(a[0]);
+        if (!host || fwrite(buffer, 1, a[0], host) < a[0]){
+            perror("tmpfile");
+            exit(1);
+        }
+        fflush(host);
+        hostfd = dup(fileno(host));
+        lseek(hostfd, 0, SEEK_SET);
+        fclose(host);
+    }
+
+    int r;
+    uint64_t start = traceClock();
+    if (op == TRACE_MKFS)
+        r = tfs_mkfs(replayDisk(disk, s[0]), a[0]);
+    else if (op == TRACE_MKFS_FEATURES)
+        r = tfs_mkfsFeatures(replayDisk(disk, s[0]), a[0], a[1]);
+    else if (op == TRACE_MOUNT)
+        r = tfs_mount(replayDisk(disk, s[0]));
+    else if (op == TRACE_UNMOUNT)
+        r = tfs_unmount();
+    else if (op == TRACE_OPEN)
+        r = tfs_openFile(s[0]);
+    else if (op == TRACE_CLOSE)
+        r = tfs_closeFile(fd);
+    else if (op == TRACE_WRITE)
+        r = tfs_writeFile(fd, buffer, a[1]);
+    else if (op == TRACE_DELETE)
+        r = tfs_deleteFile(fd);
+    else if (op == TRACE_READ_BYTE)
+        r = tfs_readByte(fd, &c);
+    else if (op == TRACE_READ)
+        r = tfs_read(fd, buffer, a[1]);
+    else if (op == TRACE_SEEK)
+        r = tfs_seek(fd, a[1]);
+    else if (op == TRACE_FSYNC)
+        r = tfs_fsync(fd);
+    else if (op == TRACE_CREATE_DIR)
+        r = tfs_createDir(s[0]);
+    else if (op == TRACE_REMOVE_DIR)
+        r = tfs_removeDir(s[0]);
+    else if (op == TRACE_REMOVE_ALL)
+        r = tfs_removeAll(s[0]);
+    else if (op == TRACE_READDIR)
+        r = tfs_readdir();
+    else if (op == TRACE_RENAME)
+        r = tfs_rename(fd, s[0]);
+    else if (op == TRACE_STAT)
+        r = tfs_stat(s[0], &st);
+    else if (op == TRACE_FSTAT)
+        r = tfs_fstat(fd, &st);
+    else if (op == TRACE_STAT_BULK)
+        r = tfs_statBulk(rec->names, rec->count, sts);
+    else if (op == TRACE_DEFRAG)
+        r = tfs_defrag(a[0], a[1]);
+    else if (op == TRACE_SET_COMPRESSION)
+        r = tfs_setCompression(fd, a[1]);
+    else if (op == TRACE_SET_DEDUP)
+        r = tfs_setDedup(a[0], a[1]);
+    else if (op == TRACE_SNAPSHOT)
+        r = tfs_snapshot(s[0]);
+    else if (op == TRACE_DELETE_SNAPSHOT)
+        r = tfs_deleteSnapshot(s[0]);
+    else if (op == TRACE_MOUNT_SNAPSHOT)
+        r = tfs_mountSnapshot(replayDisk(disk, s[0]), s[1]);
+    else if (op == TRACE_COPY)
+        r = tfs_copy(s[0], s[1]);
+    else if (op == TRACE_EXPORT)
+        r = tfs_export(fd, devNull);
+    else if (op == TRACE_IMPORT)
+        r = tfs_import(hostfd, s[0]);
+    else if (op == TRACE_BATCH)
+        r = tfs_batch(rec->ops, rec->count);
+    else if (op == TRACE_MOVE)
+        r = tfs_move(s[0], s[1]);
+    else if (op == TRACE_DISK_STATS)
+        r = tfs_diskStats(&stats);
+    else if (op == TRACE_SET_DISK_FLAGS)
+        r = tfs_setDiskFlags(a[0]);
+    else if (op == TRACE_FALLOCATE)
+        r = tfs_fallocate(fd, a[1]);
+    else if (op == TRACE_FTRUNCATE)
+        r = tfs_ftruncate(fd, a[1]);
+    else if (op == TRACE_SET_STRIPE)
+        r = tfs_setStripe(a[0]);
+    else
+        r = tfs_setDiskModel(forcedModel ? forcedModel : rec->model);
+    *ns = traceClock()-start;
+
+    if (op == TRACE_OPEN && rec->result >= 0)
+        setFd(rec->result, r >= 0 ? r : -1);
+    else if ((op == TRACE_CLOSE || op == TRACE_DELETE) && rec->result >= 0)
+        setFd(a[0], -1);
+    else if ((op == TRACE_UNMOUNT || op == TRACE_MOUNT || op == TRACE_MOUNT_SNAPSHOT) && fdMap)
+        memset(fdMap, -1, fdMapSize * sizeof(int));
+    if (op == TRACE_WRITE && r >= 0)
+        bytesWritten += a[1];
+    else if (op == TRACE_IMPORT && r >= 0)
+        bytesWritten += a[0];
+    else if (op == TRACE_READ && r > 0)
+        bytesRead += r;
+    else if (op == TRACE_READ_BYTE && r >= 0)
+        bytesRead++;
+    if (hostfd >= 0)
+        close(hostfd);
+    free(sts);
+    return r;
+}
+
+static void sleepUntil(uint64_t ns){
+    struct timespec ts = {ns / 1000000000, ns % 1000000000};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void report(long calls, long differ, double seconds, diskStats *io){
+    printf("%ld calls in %.3f s, %.0f calls/s, %ld results differ from the trace\n",
+        calls, seconds, calls/seconds, differ);
+    printf("written %.2f MB (%.2f MB/s), read %.2f MB (%.2f MB/s)\n",
+        bytesWritten/1e6, bytesWritten/1e6/seconds, bytesRead/1e6, bytesRead/1e6/seconds);
+    printf("block reads %ld in %ld calls, block writes %ld in %ld calls\n",
+        io->reads, io->readCalls, io->writes, io->writeCalls);
+    if (io->deviceNs)
+        printf("simulated device time %.3f ms\n", io->deviceNs/1e6);
+    printf("\n");
+
+    printf("%-15s %8s %10s %10s %10s %10s %10s\n", "call", "count", "trace p50", "p50 us", "p90 us", "p99 us", "max us");
+    int op;
+    for (op=0;op<TRACE_OPS;op++){
+        opLatency *l = latency+op;
+        if (!l->count)
+            continue;
+        qsort(l->replayed, l->count, sizeof(long), compareLong);
+        qsort(l->recorded, l->count, sizeof(long), compareLong);
+        printf("%-15s %8d %10.2f %10.2f %10.2f %10.2f %10.2f\n", traceOpName(op), l->count,
+            percentile(l->recorded, l->count, 50), percentile(l->replayed, l->count, 50),
+            percentile(l->replayed, l->count, 90), percentile(l->replayed, l->count, 99),
+            percentile(l->replayed, l->count, 100));
+    }
+}
+
+int main(int argc, char **argv){
+    char *disk = REPLAY_DISK;
+    int size = REPLAY_DISK_SIZE;
+    int paced = 0;
+    int verbose = 0;
+    diskModel model;
+    int opt;
+    while ((opt = getopt(argc, argv, "pvD:d:s:")) != -1){
+        if (opt == 'p')
+            paced = 1;
+        else if (opt == 'D'){
+            if (getDiskModel(optarg, &model) < 0)
+                return 1;
+            tfs_setDiskModel(&model);
+            forcedModel = &model;
+        }
+        else if (opt == 'v')
+            verbose = 1;
+        else if (opt == 'd')
+            disk = optarg;
+        else if (opt == 's')
+            size = atoi(optarg);
+        else{
+            printf("usage: %s [-p] [-v] [-D hdd|ssd|nvme] [-d diskname] [-s bytes] tracefile\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc){
+        printf("usage: %s [-p] [-v] [-D hdd|ssd|nvme] [-d diskname] [-s bytes] tracefile\n", argv[0]);
+        return 1;
+    }
+
+    FILE *trace = fopen(argv[optind], "rb");
+    if (!trace){
+        perror("fopen");
+        return 1;
+    }
+    if (readTraceHeader(trace) < 0)
+        return 1;
+    if (tfs_mkfs(disk, size) < 0)
+        return 1;
+
+    // library messages would be timed with the calls, they go to /dev/null
+    int devNull = open("/dev/null", O_WRONLY);
+    int out = dup(STDOUT_FILENO);
+    fflush(stdout);
+    if (!verbose)
+        dup2(devNull, STDOUT_FILENO);
+
+    diskStats before, after;
+    getTotalDiskStats(&before);
+    traceRecord rec;
+    long calls = 0, differ = 0;
+    int err;
+    uint64_t start = traceClock();
+    uint64_t due = start;
+    while ((err = readTraceRecord(trace, &rec)) == 0){
+        // a trace recorded after its disk was mounted runs on the fresh disk mounted here
+        if (!calls && rec.op != TRACE_MKFS && rec.op != TRACE_MKFS_FEATURES && rec.op != TRACE_MOUNT
+            && rec.op != TRACE_MOUNT_SNAPSHOT && rec.op != TRACE_SET_DISK_FLAGS && rec.op != TRACE_SET_STRIPE
+            && rec.op != TRACE_SET_DISK_MODEL && tfs_mount(disk) < 0){
+            freeTraceRecord(&rec);
+            break;
+        }
+        due += rec.gap;
+        if (paced && traceClock() < due)
+            sleepUntil(due);
+        long ns;
+        int r = replayRecord(&rec, disk, devNull, &ns);
+        addLatency(rec.op, ns, rec.latency);
+        if ((r < 0) != (rec.result < 0))
+            differ++;
+        calls++;
+        freeTraceRecord(&rec);
+    }
+    double seconds = (traceClock()-start) / 1e9;
+    if (seconds <= 0)
+        seconds = 1e-9;
+    tfs_unmount();
+    getTotalDiskStats(&after);
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    fclose(trace);
+    if (err != ERR_EOF)
+        printf("trace ends with a corrupt record\n");
+
+    after.reads -= before.reads;
+    after.readCalls -= before.readCalls;
+    after.writes -= before.writes;
+    after.writeCalls -= before.writeCalls;
+    after.deviceNs -= before.deviceNs;
+    report(calls, differ, seconds, &after);
+    return err != ERR_EOF;
+}
@@ -0,0 +1,369 @@
+#define _GNU_SOURCE             // memfd_create
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "TinyFS_errno.h"
+#include "tfsServer.h"
+
+// one loop runs every call, the library isn't thread safe
+// the calls of one pass over the clients run in one libDisk batch, so clients share
+// block reads and writes, and replies and completions are sent once the pass is on disk
+static tfsdClient clients[TFSD_MAX_CLIENTS];
+static int listenFd = -1;
+static char listenPath[TFSD_PATH_MAX];
+static volatile sig_atomic_t stopping;
+
+// serves the mounted file system on the socket of tfs_serveOpen until tfs_serveStop
+// or a TFSD_SHUTDOWN call, files left open by clients are closed, the file system stays mounted
+int tfs_serve(){
+    if (listenFd < 0){
+        printf("Error: no tfsd socket open\n");
+        return ERR_DISK_OPERATION;
+    }
+    stopping = 0;
+    struct pollfd pfds[1 + 2*TFSD_MAX_CLIENTS];
+    int owner[1 + 2*TFSD_MAX_CLIENTS];
+    int i;
+    while (!stopping){
+        int n = 0;
+        pfds[n].fd = listenFd;
+        pfds[n++].events = POLLIN;
+        for (i=0;i<TFSD_MAX_CLIENTS;i++){
+            if (!clients[i].ring)
+                continue;
+            owner[n] = i;
+            pfds[n].fd = clients[i].sock;
+            pfds[n++].events = POLLIN;
+            owner[n] = i;
+            pfds[n].fd = clients[i].submitFd;
+            pfds[n++].events = POLLIN;
+        }
+        if (poll(pfds, n, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (pfds[0].revents & POLLIN)
+            serveAccept(listenFd);
+
+        int batched = beginMountBatch() == 0;
+        for (i=1;i<n;i++){
+            tfsdClient *c = clients+owner[i];
+            if (!pfds[i].revents || c->gone)
+                continue;
+            if (pfds[i].fd == c->sock){
+                tfsdRequest req;
+                ssize_t got = recv(c->sock, &req, sizeof(req), 0);
+                if (got != sizeof(req)){
+                    c->gone = 1;
+                    continue;
+                }
+                c->reply.result = serveRequest(c, &req, &c->reply);
+                c->replying = 1;
+                continue;
+            }
+
+            // entries are copied out of the shared memory before they are checked
+            // the counters bounding the loop are the server's own, the client may write the ring
+            uint64_t count;
+            if (read(c->submitFd, &count, sizeof(count)) < 0)
+                perror("read");
+            uint32_t submitted = __atomic_load_n(&c->ring->submitted, __ATOMIC_ACQUIRE);
+            while (c->taken != submitted && c->taken - c->completed < TFSD_RING_ENTRIES){
+                int slot = c->taken % TFSD_RING_ENTRIES;
+                tfsdEntry e = c->ring->entries[slot];
+                c->ring->entries[slot].result = serveEntry(c, &e, c->ring->data[slot]);
+                c->taken++;
+            }
+        }
+
+        // a failed batch fails every call of the pass
+        int failed = batched && endMountBatch() < 0;
+        for (i=0;i<TFSD_MAX_CLIENTS;i++){
+            tfsdClient *c = clients+i;
+            if (!c->ring)
+                continue;
+            if (failed){
+                uint32_t e;
+                for (e=c->completed;e!=c->taken;e++)
+                    c->ring->entries[e % TFSD_RING_ENTRIES].result = ERR_DISK_OPERATION;
+                c->reply.result = ERR_DISK_OPERATION;
+            }
+            if (c->taken != c->completed){
+                uint64_t one = 1;
+                c->completed = c->taken;
+                __atomic_store_n(&c->ring->completed, c->completed, __ATOMIC_RELEASE);
+                if (write(c->completeFd, &one, sizeof(one)) < 0)
+                    perror("write");
+            }
+            if (c->replying && send(c->sock, &c->reply, sizeof(c->reply), MSG_NOSIGNAL) != sizeof(c->reply))
+                c->gone = 1;
+            c->replying = 0;
+            if (c->gone)
+                serveDrop(c);
+        }
+    }
+
+    for (i=0;i<TFSD_MAX_CLIENTS;i++){
+        if (clients[i].ring)
+            serveDrop(clients+i);
+    }
+    close(listenFd);
+    listenFd = -1;
+    unlink(listenPath);
+    return 0;
+}
+
+// makes tfs_serve return, safe to call from a signal handler
+void tfs_serveStop(){
+    stopping = 1;
+}
+
+// creates the socket tfs_serve listens on, only the owner's processes may connect
+// clients can connect as soon as it returns, so a process can start serving after a fork
+int tfs_serveOpen(char *socketPath){
+    if (!socketPath)
+        socketPath = TFSD_SOCKET;
+    if (listenFd >= 0){
+        printf("Error: tfsd socket already open\n");
+        return ERR_DISK_OPERATION;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)){
+        printf("Error: socket path too long\n");
+        return ERR_FILENAME;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+    if (fd < 0){
+        perror("socket");
+        return ERR_DISK_OPERATION;
+    }
+    unlink(socketPath);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || chmod(socketPath, 0600) < 0
+        || listen(fd, TFSD_MAX_CLIENTS) < 0){
+        perror("bind");
+        close(fd);
+        return ERR_DISK_OPERATION;
+    }
+    listenFd = fd;
+    strcpy(listenPath, socketPath);
+    return 0;
+}
+
+// accepts a client, sends it the ring memory and both eventfds with its greeting
+int serveAccept(int listenFd){
+    int sock = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0){
+        perror("accept");
+        return ERR_DISK_OPERATION;
+    }
+    tfsdReply greeting;
+    memset(&greeting, 0, sizeof(greeting));
+    int i = 0;
+    while (i < TFSD_MAX_CLIENTS && clients[i].ring)
+        i++;
+    if (i == TFSD_MAX_CLIENTS){
+        printf("Error: too many clients\n");
+        greeting.result = ERR_NO_MEMORY;
+        send(sock, &greeting, sizeof(greeting), MSG_NOSIGNAL);
+        close(sock);
+        return ERR_NO_MEMORY;
+    }
+
+    tfsdClient *c = clients+i;
+    memset(c, 0, sizeof(tfsdClient));
+    c->sock = sock;
+    c->submitFd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    c->completeFd = eventfd(0, EFD_CLOEXEC);
+    int memFd = memfd_create("tfsd-ring", MFD_CLOEXEC);
+    if (memFd >= 0 && ftruncate(memFd, sizeof(tfsdRing)) == 0){
+        c->ring = mmap(NULL, sizeof(tfsdRing), PROT_READ|PROT_WRITE, MAP_SHARED, memFd, 0);
+        if (c->ring == MAP_FAILED)
+            c->ring = NULL;
+    }
+    int fds[TFSD_GREETING_FDS] = {memFd, c->submitFd, c->completeFd};
+    if (!c->ring || c->submitFd < 0 || c->completeFd < 0 || sendFds(sock, &greeting, fds) < 0){
+        perror("tfsd client setup");
+        if (memFd >= 0)
+            close(memFd);
+        if (c->ring)
+            munmap(c->ring, sizeof(tfsdRing));
+        if (c->submitFd >= 0)
+            close(c->submitFd);
+        if (c->completeFd >= 0)
+            close(c->completeFd);
+        close(sock);
+        memset(c, 0, sizeof(tfsdClient));
+        return ERR_DISK_OPERATION;
+    }
+    close(memFd);
+    return 0;
+}
+
+// sends the greeting with the ring memory and eventfds attached
+int sendFds(int sock, tfsdReply *reply, int *fds){
+    char control[CMSG_SPACE(TFSD_GREETING_FDS*sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {reply, sizeof(tfsdReply)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(TFSD_GREETING_FDS*sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, TFSD_GREETING_FDS*sizeof(int));
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(tfsdReply))
+        return ERR_DISK_OPERATION;
+    return 0;
+}
+
+// closes the files a client left open and releases its connection
+void serveDrop(tfsdClient *c){
+    int i;
+    for (i=0;i<c->nFds;i++)
+        tfs_closeFile(c->fds[i]);
+    free(c->fds);
+    free(c->wBuffer);
+    munmap(c->ring, sizeof(tfsdRing));
+    close(c->sock);
+    close(c->submitFd);
+    close(c->completeFd);
+    memset(c, 0, sizeof(tfsdClient));
+}
+
+// returns 1 if the client opened fd, a client can't use another client's files
+int ownsFd(tfsdClient *c, fileDescriptor fd){
+    int i;
+    for (i=0;i<c->nFds;i++){
+        if (c->fds[i] == fd)
+            return 1;
+    }
+    return 0;
+}
+
+// runs a call sent over the socket, fills reply and returns the call's result
+int serveRequest(tfsdClient *c, tfsdRequest *req, tfsdReply *reply){
+    req->path[TFSD_PATH_MAX-1] = '\0';
+    req->path2[TFSD_PATH_MAX-1] = '\0';
+    memset(reply, 0, sizeof(tfsdReply));
+    int op = req->op;
+    if (op == TFSD_OPEN){
+        if (c->nFds == c->maxFds){
+            int maxFds = c->maxFds ? 2*c->maxFds : FT_SIZE_INC;
+            fileDescriptor *fds = realloc(c->fds, maxFds * sizeof(fileDescriptor));
+            if (!fds){
+                perror("realloc");
+                return ERR_NO_MEMORY;
+            }
+            c->fds = fds;
+            c->maxFds = maxFds;
+        }
+        fileDescriptor fd = tfs_openFile(req->path);
+        if (fd >= 0)
+            c->fds[c->nFds++] = fd;
+        return fd;
+    }
+    else if (op == TFSD_STAT)
+        return tfs_stat(req->path, &reply->st);
+    else if (op == TFSD_CREATE_DIR)
+        return tfs_createDir(req->path);
+    else if (op == TFSD_REMOVE_DIR)
+        return tfs_removeDir(req->path);
+    else if (op == TFSD_REMOVE_ALL)
+        return tfs_removeAll(req->path);
+    else if (op == TFSD_MOVE)
+        return tfs_move(req->path, req->path2);
+    else if (op == TFSD_DISK_STATS)
+        return tfs_diskStats(&reply->stats);
+    else if (op == TFSD_SHUTDOWN){
+        stopping = 1;
+        return 0;
+    }
+
+    if (!ownsFd(c, req->fd))
+        return ERR_FD_NOT_FOUND;
+    if (op == TFSD_CLOSE){
+        int i = 0;
+        while (c->fds[i] != req->fd)
+            i++;
+        c->fds[i] = c->fds[--c->nFds];
+        return tfs_closeFile(req->fd);
+    }
+    else if (op == TFSD_DELETE)
+        return tfs_deleteFile(req->fd);
+    else if (op == TFSD_SEEK)
+        return tfs_seek(req->fd, req->arg);
+    else if (op == TFSD_FSYNC)
+        return tfs_fsync(req->fd);
+    else if (op == TFSD_RENAME)
+        return tfs_rename(req->fd, req->path);
+    else if (op == TFSD_FSTAT)
+        return tfs_fstat(req->fd, &reply->st);
+    printf("Error: unknown tfsd call %d\n", op);
+    return ERR_DISK_OPERATION;
+}
+
+// runs a ring entry on its data slot and returns the call's result
+// a write larger than a slot arrives as TFSD_WRITE_PART entries and a final TFSD_WRITE
+int serveEntry(tfsdClient *c, tfsdEntry *e, char *data){
+    if (e->size < 0 || e->size > TFSD_SLOT_SIZE){
+        printf("Error: invalid tfsd entry size\n");
+        return ERR_FILE_SIZE_LIMIT;
+    }
+    if (e->op == TFSD_READ || e->op == TFSD_READ_BYTE){
+        if (!ownsFd(c, e->fd))
+            return ERR_FD_NOT_FOUND;
+        if (e->op == TFSD_READ_BYTE)
+            return tfs_readByte(e->fd, data);
+        return tfs_read(e->fd, data, e->size);
+    }
+    if (e->op != TFSD_WRITE && e->op != TFSD_WRITE_PART){
+        printf("Error: unknown tfsd call %d\n", e->op);
+        return ERR_DISK_OPERATION;
+    }
+
+    if (!c->wError && !ownsFd(c, e->fd))
+        c->wError = ERR_FD_NOT_FOUND;
+    if (!c->wError && e->size){
+        char *wBuffer = realloc(c->wBuffer, c->wSize + e->size);
+        if (!wBuffer){
+            perror("realloc");
+            c->wError = ERR_NO_MEMORY;
+        }
+        else{
+            c->wBuffer = wBuffer;
+            memcpy(c->wBuffer + c->wSize, data, e->size);
+            c->wSize += e->size;
+        }
+    }
+    if (e->op == TFSD_WRITE_PART)
+        return c->wError;
+
+    int retVal = c->wError ? c->wError : tfs_writeFile(e->fd, c->wBuffer ? c->wBuffer : "", c->wSize);
+    c->wSize = 0;
+    c->wError = 0;
+    return retVal;
+}
@@ -0,0 +1,104 @@
+#ifndef TFSSERVER_H
+#define TFSSERVER_H
+
+#include <stdint.h>
+
+#include "libTinyFS.h"
+
+// one process owns the mount and serves other processes over a Unix socket
+// calls that name files go over the socket, file content goes through a ring of
+// entries in memory shared with each client, so it isn't copied through the socket
+#define TFSD_SOCKET "tfsd.sock"
+#define TFSD_MAX_CLIENTS 64
+#define TFSD_RING_ENTRIES 32        // entries a client can have queued, a power of two
+#define TFSD_SLOT_SIZE 16384        // content bytes carried by one entry
+#define TFSD_PATH_MAX (MAX_FILENAME+1)
+#define TFSD_GREETING_FDS 3         // ring memory, submit eventfd and complete eventfd
+
+// calls sent over the socket, one reply each
+#define TFSD_OPEN 0
+#define TFSD_CLOSE 1
+#define TFSD_DELETE 2
+#define TFSD_SEEK 3
+#define TFSD_FSYNC 4
+#define TFSD_CREATE_DIR 5
+#define TFSD_REMOVE_DIR 6
+#define TFSD_REMOVE_ALL 7
+#define TFSD_RENAME 8
+#define TFSD_MOVE 9
+#define TFSD_STAT 10
+#define TFSD_FSTAT 11
+#define TFSD_DISK_STATS 12
+#define TFSD_SHUTDOWN 13
+
+// calls queued on the ring
+#define TFSD_READ 14
+#define TFSD_READ_BYTE 15
+#define TFSD_WRITE 16
+#define TFSD_WRITE_PART 17          // write content continued by the next entry
+
+// call sent over the socket
+struct tfsdRequest_s{
+    int op;                     // TFSD_OPEN ... TFSD_SHUTDOWN
+    int fd;
+    int arg;                    // seek offset
+    char path[TFSD_PATH_MAX];
+    char path2[TFSD_PATH_MAX];  // new path of TFSD_MOVE
+} typedef tfsdRequest;
+
+// reply to a call, also sent when a client connects
+struct tfsdReply_s{
+    int result;
+    tfsStat st;                 // TFSD_STAT and TFSD_FSTAT
+    diskStats stats;            // TFSD_DISK_STATS
+} typedef tfsdReply;
+
+// call queued on the ring, its content is in the data slot with the same index
+struct tfsdEntry_s{
+    int op;                     // TFSD_READ ... TFSD_WRITE_PART
+    int fd;
+    int size;                   // bytes to read or written into the slot
+    int result;                 // set by the server before the entry is completed
+} typedef tfsdEntry;
+
+// memory shared by a client and the server, counters run freely and wrap
+// the client queues entries and signals one eventfd, the server completes
+// them in order and signals the other, each counter has its own cache line
+struct tfsdRing_s{
+    uint32_t submitted __attribute__((aligned(64)));    // written by the client
+    uint32_t completed __attribute__((aligned(64)));    // written by the server
+    tfsdEntry entries[TFSD_RING_ENTRIES] __attribute__((aligned(64)));
+    char data[TFSD_RING_ENTRIES][TFSD_SLOT_SIZE];
+} typedef tfsdRing;
+
+// server side of a connection
+struct tfsdClient_s{
+    int sock;
+    int submitFd;               // eventfd the client signals after queueing entries
+    int completeFd;             // eventfd the server signals after completing entries
+    tfsdRing *ring;
+    uint32_t taken;             // entries run, completed when the pass is on disk
+    uint32_t completed;         // entries completed, only published to the ring, never read back
+    fileDescriptor *fds;        // files this client opened, closed when it goes away
+    int nFds;
+    int maxFds;
+    char *wBuffer;              // content of TFSD_WRITE_PART entries so far
+    int wSize;
+    int wError;                 // first error of those entries
+    int replying;               // a reply waits for the end of the pass
+    tfsdReply reply;
+    int gone;
+} typedef tfsdClient;
+
+int tfs_serveOpen(char *socketPath);
+int tfs_serve();
+void tfs_serveStop();
+
+int serveAccept(int listenFd);
+int sendFds(int sock, tfsdReply *reply, int *fds);
+void serveDrop(tfsdClient *c);
+int serveRequest(tfsdClient *c, tfsdRequest *req, tfsdReply *reply);
+int serveEntry(tfsdClient *c, tfsdEntry *e, char *data);
+int ownsFd(tfsdClient *c, fileDescriptor fd);
+
+#endif
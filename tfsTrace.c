@@ -0,0 +1,670 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "TinyFS_errno.h"
+#include "tfsTrace.h"
+
+#define TRACE_MAX_STRING 4096
+#define TRACE_MAX_COUNT (1<<20)
+
+// name and argument signature of each op, indexed by TRACE_ op
+static char *traceOps[TRACE_OPS][2] = {
+    {"mkfs", "si"}, {"mkfsFeatures", "sii"}, {"mount", "s"}, {"unmount", ""},
+    {"openFile", "s"}, {"closeFile", "f"}, {"writeFile", "fi"}, {"deleteFile", "f"},
+    {"readByte", "f"}, {"read", "fi"}, {"seek", "fi"}, {"fsync", "f"},
+    {"createDir", "s"}, {"removeDir", "s"}, {"removeAll", "s"}, {"readdir", ""},
+    {"rename", "fs"}, {"stat", "s"}, {"fstat", "f"}, {"statBulk", "n"},
+    {"defrag", "ii"}, {"setCompression", "fi"}, {"setDedup", "ii"}, {"snapshot", "s"},
+    {"deleteSnapshot", "s"}, {"mountSnapshot", "ss"}, {"copy", "ss"}, {"export", "f"},
+    {"import", "is"}, {"batch", "b"}, {"move", "ss"}, {"diskStats", ""},
+    {"setDiskFlags", "i"}, {"fallocate", "fi"}, {"ftruncate", "fi"},
+    {"setStripe", "i"}, {"setDiskModel", "m"}
+};
+
+// trace being recorded, NULL when not tracing
+static FILE *traceFile;
+static uint64_t lastStart;
+static int envChecked;
+
+// starts recording calls made through the trace_ functions to filename
+// setting TFS_TRACE to a file name in the environment does the same on the first call
+int tfs_traceStart(char *filename){
+    if (traceFile){
+        printf("Error: already tracing\n");
+        return ERR_DISK_OPERATION;
+    }
+    envChecked = 1;
+    traceFile = fopen(filename, "wb");
+    if (!traceFile){
+        perror("fopen");
+        return ERR_DISK_OPERATION;
+    }
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), traceFile);
+    putc(TRACE_VERSION, traceFile);
+    lastStart = 0;
+    return 0;
+}
+
+int tfs_traceStop(){
+    if (!traceFile){
+        printf("Error: not tracing\n");
+        return ERR_DISK_OPERATION;
+    }
+    int err = fclose(traceFile);
+    traceFile = NULL;
+    if (err){
+        perror("fclose");
+        return ERR_DISK_OPERATION;
+    }
+    return 0;
+}
+
+int trace_mkfs(char *filename, int nBytes){
+    uint64_t start = traceClock();
+    int result = tfs_mkfs(filename, nBytes);
+    traceRecord rec = {TRACE_MKFS};
+    rec.strs[0] = filename;
+    rec.args[0] = nBytes;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_mkfsFeatures(char *filename, int nBytes, int features){
+    uint64_t start = traceClock();
+    int result = tfs_mkfsFeatures(filename, nBytes, features);
+    traceRecord rec = {TRACE_MKFS_FEATURES};
+    rec.strs[0] = filename;
+    rec.args[0] = nBytes;
+    rec.args[1] = features;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_mount(char *diskname){
+    uint64_t start = traceClock();
+    int result = tfs_mount(diskname);
+    traceRecord rec = {TRACE_MOUNT};
+    rec.strs[0] = diskname;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+// the trace is flushed at each unmount, so it is complete up to there if the program dies
+int trace_unmount(void){
+    uint64_t start = traceClock();
+    int result = tfs_unmount();
+    traceRecord rec = {TRACE_UNMOUNT};
+    traceEnd(&rec, start, result);
+    if (traceFile)
+        fflush(traceFile);
+    return result;
+}
+
+fileDescriptor trace_openFile(char *name){
+    uint64_t start = traceClock();
+    int result = tfs_openFile(name);
+    traceRecord rec = {TRACE_OPEN};
+    rec.strs[0] = name;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_closeFile(fileDescriptor FD){
+    uint64_t start = traceClock();
+    int result = tfs_closeFile(FD);
+    traceRecord rec = {TRACE_CLOSE};
+    rec.args[0] = FD;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_writeFile(fileDescriptor FD, char *buffer, int size){
+    uint64_t start = traceClock();
+    int result = tfs_writeFile(FD, buffer, size);
+    traceRecord rec = {TRACE_WRITE};
+    rec.args[0] = FD;
+    rec.args[1] = size;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_deleteFile(fileDescriptor FD){
+    uint64_t start = traceClock();
+    int result = tfs_deleteFile(FD);
+    traceRecord rec = {TRACE_DELETE};
+    rec.args[0] = FD;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_readByte(fileDescriptor FD, char *buffer){
+    uint64_t start = traceClock();
+    int result = tfs_readByte(FD, buffer);
+    traceRecord rec = {TRACE_READ_BYTE};
+    rec.args[0] = FD;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_read(fileDescriptor FD, char *buffer, int size){
+    uint64_t start = traceClock();
+    int result = tfs_read(FD, buffer, size);
+    traceRecord rec = {TRACE_READ};
+    rec.args[0] = FD;
+    rec.args[1] = size;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_seek(fileDescriptor FD, int offset){
+    uint64_t start = traceClock();
+    int result = tfs_seek(FD, offset);
+    traceRecord rec = {TRACE_SEEK};
+    rec.args[0] = FD;
+    rec.args[1] = offset;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_fsync(fileDescriptor FD){
+    uint64_t start = traceClock();
+    int result = tfs_fsync(FD);
+    traceRecord rec = {TRACE_FSYNC};
+    rec.args[0] = FD;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_createDir(char *dirName){
+    uint64_t start = traceClock();
+    int result = tfs_createDir(dirName);
+    traceRecord rec = {TRACE_CREATE_DIR};
+    rec.strs[0] = dirName;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_removeDir(char *dirName){
+    uint64_t start = traceClock();
+    int result = tfs_removeDir(dirName);
+    traceRecord rec = {TRACE_REMOVE_DIR};
+    rec.strs[0] = dirName;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_removeAll(char *dirName){
+    uint64_t start = traceClock();
+    int result = tfs_removeAll(dirName);
+    traceRecord rec = {TRACE_REMOVE_ALL};
+    rec.strs[0] = dirName;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_readdir(){
+    uint64_t start = traceClock();
+    int result = tfs_readdir();
+    traceRecord rec = {TRACE_READDIR};
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_rename(fileDescriptor FD, char *newName){
+    uint64_t start = traceClock();
+    int result = tfs_rename(FD, newName);
+    traceRecord rec = {TRACE_RENAME};
+    rec.args[0] = FD;
+    rec.strs[0] = newName;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_stat(char *name, tfsStat *st){
+    uint64_t start = traceClock();
+    int result = tfs_stat(name, st);
+    traceRecord rec = {TRACE_STAT};
+    rec.strs[0] = name;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_fstat(fileDescriptor FD, tfsStat *st){
+    uint64_t start = traceClock();
+    int result = tfs_fstat(FD, st);
+    traceRecord rec = {TRACE_FSTAT};
+    rec.args[0] = FD;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_statBulk(char **names, int count, tfsStat *st){
+    uint64_t start = traceClock();
+    int result = tfs_statBulk(names, count, st);
+    traceRecord rec = {TRACE_STAT_BULK};
+    rec.count = count;
+    rec.names = names;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_defrag(int moveBudget, int msBudget){
+    uint64_t start = traceClock();
+    int result = tfs_defrag(moveBudget, msBudget);
+    traceRecord rec = {TRACE_DEFRAG};
+    rec.args[0] = moveBudget;
+    rec.args[1] = msBudget;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_setCompression(fileDescriptor FD, int on){
+    uint64_t start = traceClock();
+    int result = tfs_setCompression(FD, on);
+    traceRecord rec = {TRACE_SET_COMPRESSION};
+    rec.args[0] = FD;
+    rec.args[1] = on;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_setDedup(int on, int budget){
+    uint64_t start = traceClock();
+    int result = tfs_setDedup(on, budget);
+    traceRecord rec = {TRACE_SET_DEDUP};
+    rec.args[0] = on;
+    rec.args[1] = budget;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_snapshot(char *name){
+    uint64_t start = traceClock();
+    int result = tfs_snapshot(name);
+    traceRecord rec = {TRACE_SNAPSHOT};
+    rec.strs[0] = name;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_deleteSnapshot(char *name){
+    uint64_t start = traceClock();
+    int result = tfs_deleteSnapshot(name);
+    traceRecord rec = {TRACE_DELETE_SNAPSHOT};
+    rec.strs[0] = name;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_mountSnapshot(char *diskname, char *name){
+    uint64_t start = traceClock();
+    int result = tfs_mountSnapshot(diskname, name);
+    traceRecord rec = {TRACE_MOUNT_SNAPSHOT};
+    rec.strs[0] = diskname;
+    rec.strs[1] = name;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_copy(char *src, char *dst){
+    uint64_t start = traceClock();
+    int result = tfs_copy(src, dst);
+    traceRecord rec = {TRACE_COPY};
+    rec.strs[0] = src;
+    rec.strs[1] = dst;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_export(fileDescriptor FD, int hostfd){
+    uint64_t start = traceClock();
+    int result = tfs_export(FD, hostfd);
+    traceRecord rec = {TRACE_EXPORT};
+    rec.args[0] = FD;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+// records the bytes imported when hostfd can seek, 0 otherwise
+int trace_import(int hostfd, char *path){
+    off_t from = lseek(hostfd, 0, SEEK_CUR);
+    uint64_t start = traceClock();
+    int result = tfs_import(hostfd, path);
+    traceRecord rec = {TRACE_IMPORT};
+    off_t to = lseek(hostfd, 0, SEEK_CUR);
+    rec.args[0] = from >= 0 && to > from ? to-from : 0;
+    rec.strs[0] = path;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_batch(tfsBatchOp *ops, int count){
+    uint64_t start = traceClock();
+    int result = tfs_batch(ops, count);
+    traceRecord rec = {TRACE_BATCH};
+    rec.count = count;
+    rec.ops = ops;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_move(char *oldPath, char *newPath){
+    uint64_t start = traceClock();
+    int result = tfs_move(oldPath, newPath);
+    traceRecord rec = {TRACE_MOVE};
+    rec.strs[0] = oldPath;
+    rec.strs[1] = newPath;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_diskStats(diskStats *stats){
+    uint64_t start = traceClock();
+    int result = tfs_diskStats(stats);
+    traceRecord rec = {TRACE_DISK_STATS};
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_setDiskFlags(int flags){
+    uint64_t start = traceClock();
+    int result = tfs_setDiskFlags(flags);
+    traceRecord rec = {TRACE_SET_DISK_FLAGS};
+    rec.args[0] = flags;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_fallocate(fileDescriptor FD, int size){
+    uint64_t start = traceClock();
+    int result = tfs_fallocate(FD, size);
+    traceRecord rec = {TRACE_FALLOCATE};
+    rec.args[0] = FD;
+    rec.args[1] = size;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_ftruncate(fileDescriptor FD, int newSize){
+    uint64_t start = traceClock();
+    int result = tfs_ftruncate(FD, newSize);
+    traceRecord rec = {TRACE_FTRUNCATE};
+    rec.args[0] = FD;
+    rec.args[1] = newSize;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_setStripe(int blocks){
+    uint64_t start = traceClock();
+    int result = tfs_setStripe(blocks);
+    traceRecord rec = {TRACE_SET_STRIPE};
+    rec.args[0] = blocks;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+int trace_setDiskModel(diskModel *model){
+    uint64_t start = traceClock();
+    int result = tfs_setDiskModel(model);
+    traceRecord rec = {TRACE_SET_DISK_MODEL};
+    rec.model = model;
+    traceEnd(&rec, start, result);
+    return result;
+}
+
+// HELPER FUNCTIONS -----------------------------------------------------------
+
+char *traceOpName(int op){
+    if (op < 0 || op >= TRACE_OPS)
+        return "unknown";
+    return traceOps[op][0];
+}
+
+char *traceSignature(int op){
+    if (op < 0 || op >= TRACE_OPS)
+        return NULL;
+    return traceOps[op][1];
+}
+
+// monotonic time in nanoseconds
+uint64_t traceClock(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// finishes a record with the call's timing and result and appends it to the trace
+void traceEnd(traceRecord *rec, uint64_t start, int result){
+    if (!traceFile && !envChecked){
+        envChecked = 1;
+        char *filename = getenv("TFS_TRACE");
+        if (filename)
+            tfs_traceStart(filename);
+    }
+    if (!traceFile)
+        return;
+    rec->latency = traceClock()-start;
+    rec->gap = lastStart ? start-lastStart : 0;
+    rec->result = result;
+    lastStart = start;
+    if (writeTraceRecord(traceFile, rec) < 0){
+        printf("Error: trace write failed, tracing stopped\n");
+        fclose(traceFile);
+        traceFile = NULL;
+    }
+}
+
+// 7 bits per byte, low bits first, high bit set on every byte but the last
+static void putVarint(FILE *f, uint64_t v){
+    while (v >= 0x80){
+        putc((v & 0x7f) | 0x80, f);
+        v >>= 7;
+    }
+    putc(v, f);
+}
+
+// signed values are zigzag coded, so small negative error codes stay one byte
+static void putSigned(FILE *f, int v){
+    putVarint(f, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+// length + 1, or 0 for NULL
+static void putString(FILE *f, char *s){
+    if (!s){
+        putVarint(f, 0);
+        return;
+    }
+    int len = strlen(s);
+    putVarint(f, len+1);
+    fwrite(s, 1, len, f);
+}
+
+static int getVarint(FILE *f, uint64_t *v){
+    *v = 0;
+    int shift;
+    for (shift=0;shift<64;shift+=7){
+        int c = getc(f);
+        if (c == EOF)
+            return -1;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+static int getSigned(FILE *f, int *v){
+    uint64_t z;
+    if (getVarint(f, &z) < 0)
+        return -1;
+    *v = (int)((uint32_t)z >> 1) ^ -(int)(z & 1);
+    return 0;
+}
+
+static int getString(FILE *f, char **s){
+    uint64_t len;
+    *s = NULL;
+    if (getVarint(f, &len) < 0 || len > TRACE_MAX_STRING)
+        return -1;
+    if (len == 0)
+        return 0;
+    *s = malloc(len);
+    if (!*s || fread(*s, 1, len-1, f) < len-1)
+        return -1;
+    (*s)[len-1] = '\0';
+    return 0;
+}
+
+int writeTraceRecord(FILE *f, traceRecord *rec){
+    char *sig = traceSignature(rec->op);
+    if (!sig)
+        return ERR_FILENAME;
+    putc(rec->op, f);
+    putVarint(f, rec->gap);
+    putVarint(f, rec->latency);
+    putSigned(f, rec->result);
+    int nArgs = 0, nStrs = 0, i;
+    for (;*sig;sig++){
+        if (*sig == 'i' || *sig == 'f')
+            putSigned(f, rec->args[nArgs++]);
+        else if (*sig == 's')
+            putString(f, rec->strs[nStrs++]);
+        else if (*sig == 'n'){
+            putVarint(f, rec->count);
+            for (i=0;i<rec->count;i++)
+                putString(f, rec->names[i]);
+        }
+        else if (*sig == 'b'){
+            putVarint(f, rec->count);
+            for (i=0;i<rec->count;i++){
+                putc(rec->ops[i].op, f);
+                putString(f, rec->ops[i].path);
+                putString(f, rec->ops[i].newName);
+            }
+        }
+        else if (*sig == 'm'){
+            putVarint(f, rec->model != NULL);
+            if (rec->model){
+                putVarint(f, rec->model->latencyNs);
+                putVarint(f, rec->model->seekNs);
+                putVarint(f, rec->model->seekBlockNs);
+                putVarint(f, rec->model->bytesPerSec);
+                putSigned(f, rec->model->queueDepth);
+                putSigned(f, rec->model->sleep);
+            }
+        }
+    }
+    if (ferror(f))
+        return ERR_DISK_OPERATION;
+    return 0;
+}
+
+// checks the magic and version at the start of a trace
+int readTraceHeader(FILE *f){
+    char magic[sizeof(TRACE_MAGIC)];
+    int len = strlen(TRACE_MAGIC);
+    if (fread(magic, 1, len, f) < len || memcmp(magic, TRACE_MAGIC, len) || getc(f) != TRACE_VERSION){
+        printf("Error: not a tinyFS trace\n");
+        return ERR_FILENAME;
+    }
+    return 0;
+}
+
+// reads the next record, its strings are allocated and freed by freeTraceRecord
+// returns ERR_EOF after the last record
+int readTraceRecord(FILE *f, traceRecord *rec){
+    memset(rec, 0, sizeof(traceRecord));
+    int op = getc(f);
+    if (op == EOF)
+        return ERR_EOF;
+    rec->op = op;
+    char *sig = traceSignature(op);
+    if (!sig || getVarint(f, &rec->gap) < 0 || getVarint(f, &rec->latency) < 0 || getSigned(f, &rec->result) < 0){
+        printf("Error: corrupt trace record\n");
+        return ERR_FS_INTEGRITY;
+    }
+    int nArgs = 0, nStrs = 0, i;
+    uint64_t count;
+    for (;*sig;sig++){
+        int err = 0;
+        if (*sig == 'i' || *sig == 'f')
+            err = getSigned(f, &rec->args[nArgs++]);
+        else if (*sig == 's')
+            err = getString(f, &rec->strs[nStrs++]);
+        else if (*sig == 'n' || *sig == 'b'){
+            err = getVarint(f, &count);
+            if (!err && count > TRACE_MAX_COUNT)
+                err = -1;
+            if (!err){
+                rec->count = count;
+                if (*sig == 'n')
+                    rec->names = calloc(count ? count : 1, sizeof(char *));
+                else
+                    rec->ops = calloc(count ? count : 1, sizeof(tfsBatchOp));
+                if (!rec->names && !rec->ops)
+                    err = -1;
+            }
+            for (i=0;!err && i<rec->count;i++){
+                if (rec->names)
+                    err = getString(f, &rec->names[i]);
+                else{
+                    rec->ops[i].op = getc(f);
+                    err = getString(f, &rec->ops[i].path);
+                    if (!err)
+                        err = getString(f, &rec->ops[i].newName);
+                }
+            }
+        }
+        else if (*sig == 'm'){
+            uint64_t present, v[4];
+            err = getVarint(f, &present);
+            if (!err && present){
+                rec->model = calloc(1, sizeof(diskModel));
+                err = !rec->model;
+                for (i=0;!err && i<4;i++)
+                    err = getVarint(f, &v[i]);
+                if (!err)
+                    err = getSigned(f, &rec->model->queueDepth);
+                if (!err)
+                    err = getSigned(f, &rec->model->sleep);
+                if (!err){
+                    rec->model->latencyNs = v[0];
+                    rec->model->seekNs = v[1];
+                    rec->model->seekBlockNs = v[2];
+                    rec->model->bytesPerSec = v[3];
+                }
+            }
+        }
+        if (err){
+            printf("Error: corrupt trace record\n");
+            freeTraceRecord(rec);
+            return ERR_FS_INTEGRITY;
+        }
+    }
+    return 0;
+}
+
+void freeTraceRecord(traceRecord *rec){
+    int i;
+    for (i=0;i<TRACE_MAX_ARGS;i++)
+        free(rec->strs[i]);
+    for (i=0;i<rec->count;i++){
+        if (rec->names)
+            free(rec->names[i]);
+        if (rec->ops){
+            free(rec->ops[i].path);
+            free(rec->ops[i].newName);
+        }
+    }
+    free(rec->names);
+    free(rec->ops);
+    free(rec->model);
+    memset(rec, 0, sizeof(traceRecord));
+}
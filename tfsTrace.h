@@ -0,0 +1,162 @@
+#ifndef TFSTRACE_H
+#define TFSTRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "libTinyFS.h"
+
+// a trace file starts with the magic and a version byte, then one record per call:
+// op byte, varint gap and latency in nanoseconds, zigzag varint result, then the
+// arguments of the op's signature in order
+#define TRACE_MAGIC "TFSTRACE"
+#define TRACE_VERSION 1
+#define TRACE_MAX_ARGS 3
+
+// signature characters: i integer, f file descriptor, s string,
+// n tfs_statBulk names, b tfs_batch operations, m tfs_setDiskModel model
+#define TRACE_MKFS 0
+#define TRACE_MKFS_FEATURES 1
+#define TRACE_MOUNT 2
+#define TRACE_UNMOUNT 3
+#define TRACE_OPEN 4
+#define TRACE_CLOSE 5
+#define TRACE_WRITE 6
+#define TRACE_DELETE 7
+#define TRACE_READ_BYTE 8
+#define TRACE_READ 9
+#define TRACE_SEEK 10
+#define TRACE_FSYNC 11
+#define TRACE_CREATE_DIR 12
+#define TRACE_REMOVE_DIR 13
+#define TRACE_REMOVE_ALL 14
+#define TRACE_READDIR 15
+#define TRACE_RENAME 16
+#define TRACE_STAT 17
+#define TRACE_FSTAT 18
+#define TRACE_STAT_BULK 19
+#define TRACE_DEFRAG 20
+#define TRACE_SET_COMPRESSION 21
+#define TRACE_SET_DEDUP 22
+#define TRACE_SNAPSHOT 23
+#define TRACE_DELETE_SNAPSHOT 24
+#define TRACE_MOUNT_SNAPSHOT 25
+#define TRACE_COPY 26
+#define TRACE_EXPORT 27
+#define TRACE_IMPORT 28
+#define TRACE_BATCH 29
+#define TRACE_MOVE 30
+#define TRACE_DISK_STATS 31
+#define TRACE_SET_DISK_FLAGS 32
+#define TRACE_FALLOCATE 33
+#define TRACE_FTRUNCATE 34
+#define TRACE_SET_STRIPE 35
+#define TRACE_SET_DISK_MODEL 36
+#define TRACE_OPS 37
+
+// one recorded call, file content isn't recorded, only its size
+struct traceRecord_s{
+    int op;                     // TRACE_MKFS ... TRACE_SET_DISK_MODEL
+    uint64_t gap;               // nanoseconds since the previous call started
+    uint64_t latency;           // nanoseconds the call took
+    int result;                 // what the call returned
+    int args[TRACE_MAX_ARGS];   // integer and file descriptor arguments in order
+    char *strs[TRACE_MAX_ARGS]; // string arguments in order, NULL if the caller passed NULL
+    int count;                  // entries of a tfs_statBulk or tfs_batch
+    char **names;               // tfs_statBulk names
+    tfsBatchOp *ops;            // tfs_batch operations
+    diskModel *model;           // tfs_setDiskModel model, NULL if the caller passed NULL
+} typedef traceRecord;
+
+int tfs_traceStart(char *filename);
+int tfs_traceStop();
+
+// recording versions of the tfs_ calls, compile with -DTFS_TRACE to use them in place of the tfs_ calls
+int trace_mkfs(char *filename, int nBytes);
+int trace_mkfsFeatures(char *filename, int nBytes, int features);
+int trace_mount(char *diskname);
+int trace_unmount(void);
+fileDescriptor trace_openFile(char *name);
+int trace_closeFile(fileDescriptor FD);
+int trace_writeFile(fileDescriptor FD, char *buffer, int size);
+int trace_deleteFile(fileDescriptor FD);
+int trace_readByte(fileDescriptor FD, char *buffer);
+int trace_read(fileDescriptor FD, char *buffer, int size);
+int trace_seek(fileDescriptor FD, int offset);
+int trace_fsync(fileDescriptor FD);
+int trace_createDir(char *dirName);
+int trace_removeDir(char *dirName);
+int trace_removeAll(char *dirName);
+int trace_readdir();
+int trace_rename(fileDescriptor FD, char *newName);
+int trace_stat(char *name, tfsStat *st);
+int trace_fstat(fileDescriptor FD, tfsStat *st);
+int trace_statBulk(char **names, int count, tfsStat *st);
+int trace_defrag(int moveBudget, int msBudget);
+int trace_setCompression(fileDescriptor FD, int on);
+int trace_setDedup(int on, int budget);
+int trace_snapshot(char *name);
+int trace_deleteSnapshot(char *name);
+int trace_mountSnapshot(char *diskname, char *name);
+int trace_copy(char *src, char *dst);
+int trace_export(fileDescriptor FD, int hostfd);
+int trace_import(int hostfd, char *path);
+int trace_batch(tfsBatchOp *ops, int count);
+int trace_move(char *oldPath, char *newPath);
+int trace_diskStats(diskStats *stats);
+int trace_setDiskFlags(int flags);
+int trace_fallocate(fileDescriptor FD, int size);
+int trace_ftruncate(fileDescriptor FD, int newSize);
+int trace_setStripe(int blocks);
+int trace_setDiskModel(diskModel *model);
+
+#ifdef TFS_TRACE
+#define tfs_mkfs trace_mkfs
+#define tfs_mkfsFeatures trace_mkfsFeatures
+#define tfs_mount trace_mount
+#define tfs_unmount trace_unmount
+#define tfs_openFile trace_openFile
+#define tfs_closeFile trace_closeFile
+#define tfs_writeFile trace_writeFile
+#define tfs_deleteFile trace_deleteFile
+#define tfs_readByte trace_readByte
+#define tfs_read trace_read
+#define tfs_seek trace_seek
+#define tfs_fsync trace_fsync
+#define tfs_createDir trace_createDir
+#define tfs_removeDir trace_removeDir
+#define tfs_removeAll trace_removeAll
+#define tfs_readdir trace_readdir
+#define tfs_rename trace_rename
+#define tfs_stat trace_stat
+#define tfs_fstat trace_fstat
+#define tfs_statBulk trace_statBulk
+#define tfs_defrag trace_defrag
+#define tfs_setCompression trace_setCompression
+#define tfs_setDedup trace_setDedup
+#define tfs_snapshot trace_snapshot
+#define tfs_deleteSnapshot trace_deleteSnapshot
+#define tfs_mountSnapshot trace_mountSnapshot
+#define tfs_copy trace_copy
+#define tfs_export trace_export
+#define tfs_import trace_import
+#define tfs_batch trace_batch
+#define tfs_move trace_move
+#define tfs_diskStats trace_diskStats
+#define tfs_setDiskFlags trace_setDiskFlags
+#define tfs_fallocate trace_fallocate
+#define tfs_ftruncate trace_ftruncate
+#define tfs_setStripe trace_setStripe
+#define tfs_setDiskModel trace_setDiskModel
+#endif
+
+char *traceOpName(int op);
+char *traceSignature(int op);
+int readTraceHeader(FILE *f);
+int readTraceRecord(FILE *f, traceRecord *rec);
+void freeTraceRecord(traceRecord *rec);
+int writeTraceRecord(FILE *f, traceRecord *rec);
+uint64_t traceClock();
+void traceEnd(traceRecord *rec, uint64_t start, int result);
+
+#endif
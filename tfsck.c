@@ -0,0 +1,545 @@
+/* tinyFS file system checker
+ * usage: tfsck [-r] [-d] [-j threads] diskname
+ *
+ * Reads the whole disk in large sequential chunks, then checks the tree
+ * under the root directory and every snapshot root with worker threads, one
+ * root subtree at a time:
+ *  - every block reachable from ROOT_BLOCK or a snapshot has the right type,
+ *    data blocks of raw data disks have no header and are only known by their links
+ *  - no block is referenced twice, except data blocks on disks that used dedup
+ *    and blocks frozen by a snapshot
+ *  - file sizes match the number of data blocks linked from the inode,
+ *    files with reserved blocks may link more
+ *  - entries of hashed directories can be found from their name's home slot
+ *  - the free chain only holds free blocks, and every other block is reachable
+ * With -r the problems are repaired and the free chain is rebuilt from all
+ * unreachable blocks. With -d the disk is read with O_DIRECT, so checking a
+ * disk doesn't fill the host page cache.
+ *
+ * tinyFS disks are at most MAX_BLOCKS blocks of BLOCKSIZE bytes, under 64 KB,
+ * so the whole image is kept in memory. The chunked reads and worker threads
+ * are the shape a checker for multi-GB images would take, at this size a
+ * check takes milliseconds either way.
+ *
+ * exit status: 0 clean, 1 errors repaired, 4 errors left, 8 operational error
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "libDisk.h"
+#include "TinyFS_errno.h"
+#include "crc32c.h"
+
+#define FSCK_CHUNK_BLOCKS 64
+#define FSCK_MAX_THREADS 16
+
+static unsigned char *image;            // whole disk, BLOCKSIZE bytes per block
+static unsigned char dirty[MAX_BLOCKS]; // blocks changed by repairs
+static unsigned char badCrc[MAX_BLOCKS];// blocks that failed checksum verification
+static int refs[MAX_BLOCKS];            // references from the tree, updated atomically
+static int nBlocks;
+static int repair;
+static int shared;                      // data blocks may be linked from several files
+static int rawData;                     // data blocks have no header
+static unsigned char isData[MAX_BLOCKS];// blocks linked from a file inode
+static unsigned char *frozen;           // superblock bitmap of blocks shared with snapshots
+static int errors;
+static pthread_mutex_t reportLock = PTHREAD_MUTEX_INITIALIZER;
+
+// work queue of root directory entries, snapshot roots add theirs
+static int rootLinks[MAX_BLOCKS];
+static char rootPaths[MAX_BLOCKS][LEN_I_NAME+2];
+static int nRootLinks;
+static int nextRootLink;
+
+// prints a problem and counts it
+static void report(const char *fmt, ...){
+    va_list args;
+    pthread_mutex_lock(&reportLock);
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    errors++;
+    pthread_mutex_unlock(&reportLock);
+}
+
+static unsigned char *getBlock(int b){
+    return image + b*BLOCKSIZE;
+}
+
+// reads the disk in chunks, falls back to single blocks to find checksum failures
+static int readImage(int disk){
+    int b;
+    for (b=0;b<nBlocks;b+=FSCK_CHUNK_BLOCKS){
+        int count = nBlocks-b < FSCK_CHUNK_BLOCKS ? nBlocks-b : FSCK_CHUNK_BLOCKS;
+        if (!readBlocks(disk, b, count, getBlock(b)))
+            continue;
+
+        int i;
+        for (i=b;i<b+count;i++){
+            if (!readBlock(disk, i, getBlock(i)))
+                continue;
+            setDiskVerify(disk, 0);
+            if (readBlock(disk, i, getBlock(i)))
+                return -1;
+            setDiskVerify(disk, 1);
+            badCrc[i] = 1;
+        }
+    }
+    return 0;
+}
+
+// claims a block for a reference, returns 1 if it was already referenced
+static int claimBlock(int b){
+    return __atomic_fetch_add(&refs[b], 1, __ATOMIC_RELAXED) > 0;
+}
+
+// returns 1 if a snapshot shares the block
+static int blockFrozen(int b){
+    return (frozen[b/8] >> (b%8)) & 1;
+}
+
+// clears the content of a file inode
+static void emptyFile(unsigned char *inode){
+    setInodeSize(inode, 0);
+    inode[OFFSET_I_FLAGS] &= ~(FLAG_I_INLINE|FLAG_I_COMPRESSED);
+    memset(inode+OFFSET_I_LINKS, 0, BLOCKSIZE-OFFSET_I_LINKS);
+}
+
+// checks that every entry of a hashed directory is reached by probing from its home slot
+// a directory that fails is repaired by dropping the hashed flag, lookups then scan every slot
+static void checkHashedDir(int dirIdx, char *path){
+    unsigned char *dir = getBlock(dirIdx);
+    if (!(dir[OFFSET_I_FLAGS] & FLAG_I_HASHED))
+        return;
+    unsigned char *links = dir+OFFSET_I_LINKS;
+    int i;
+    for (i=0;i<DIR_SLOTS;i++){
+        if (!links[i] || links[i] >= nBlocks)
+            continue;
+        char name[LEN_I_NAME+1];
+        memset(name, 0, LEN_I_NAME+1);
+        memcpy(name, getBlock(links[i])+OFFSET_I_NAME, LEN_I_NAME);
+        int slot = crc32c(0, name, strlen(name)) % DIR_SLOTS;
+        while (slot != i && links[slot])
+            slot = (slot+1) % DIR_SLOTS;
+        if (slot != i){
+            report("%s: entry %s is not on its hash probe path\n", path, name);
+            if (repair){
+                dir[OFFSET_I_FLAGS] &= ~FLAG_I_HASHED;
+                dirty[dirIdx] = 1;
+            }
+            return;
+        }
+    }
+}
+
+// checks an inode and everything under it
+// only called by the thread that claimed the inode, so repairs to it don't race
+static void checkInode(int inodeIdx, char *path){
+    unsigned char *inode = getBlock(inodeIdx);
+    char name[LEN_I_NAME+1];
+    memset(name, 0, LEN_I_NAME+1);
+    memcpy(name, inode+OFFSET_I_NAME, LEN_I_NAME);
+
+    char fullPath[MAX_FILENAME+1];
+    snprintf(fullPath, sizeof(fullPath), "%s%s%s", path, strcmp(path, "/") ? "/" : "", name);
+
+    uint32_t size = getInodeSize(inode);
+
+    if (inode[OFFSET_I_FLAGS] & FLAG_I_INLINE){
+        if (inode[OFFSET_I_FLAGS] & FLAG_I_COMPRESSED){
+            uint32_t zSize = getZSize(inode+OFFSET_I_LINKS);
+            if (zSize+LEN_Z_SIZE > MAX_INLINE_SIZE){
+                report("%s: inline compressed length %u too large\n", fullPath, zSize);
+                if (repair){
+                    emptyFile(inode);
+                    dirty[inodeIdx] = 1;
+                }
+            }
+        }
+        else if (size > MAX_INLINE_SIZE){
+            report("%s: inline size %u too large\n", fullPath, size);
+            if (repair){
+                size = MAX_INLINE_SIZE;
+                setInodeSize(inode, size);
+                dirty[inodeIdx] = 1;
+            }
+        }
+        return;
+    }
+
+    int linkCount = 0;
+    int hole = 0;
+    int i;
+    for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+        int b = inode[i+OFFSET_I_LINKS];
+        if (!b){
+            hole = 1;
+            continue;
+        }
+
+        // validate the link itself
+        // frozen inodes seen before were checked through another root
+        const char *problem = NULL;
+        int seen = 0;
+        if (b >= nBlocks || b == ROOT_BLOCK)
+            problem = "invalid block";
+        else if (inode[OFFSET_I_DIR] && getBlock(b)[OFFSET_TYPE] != TYPE_I)
+            problem = "directory entry is not an inode";
+        else if (!inode[OFFSET_I_DIR] && !rawData && getBlock(b)[OFFSET_TYPE] != TYPE_D)
+            problem = "file link is not a data block";
+        else if ((seen = claimBlock(b)) && !blockFrozen(b) && (inode[OFFSET_I_DIR] || !shared))
+            problem = "block referenced more than once";
+
+        if (problem){
+            report("%s: link %d to block %d: %s\n", fullPath, i, b, problem);
+            if (repair){
+                inode[i+OFFSET_I_LINKS] = 0;
+                dirty[inodeIdx] = 1;
+            }
+            hole = 1;
+            continue;
+        }
+
+        if (hole && !inode[OFFSET_I_DIR])
+            report("%s: file has a hole before link %d\n", fullPath, i);
+        linkCount++;
+        if (!inode[OFFSET_I_DIR])
+            __atomic_store_n(&isData[b], 1, __ATOMIC_RELAXED);
+
+        if (inode[OFFSET_I_DIR] && !seen)
+            checkInode(b, fullPath);
+        else if (badCrc[b])
+            report("%s: data block %d failed its checksum\n", fullPath, b);
+    }
+
+    if (inode[OFFSET_I_DIR]){
+        checkHashedDir(inodeIdx, fullPath);
+        return;
+    }
+
+    // file size must match the data blocks it links to
+    // compressed files are sized by the stream length in their first data block
+    int dataOffset = rawData ? 0 : OFFSET_D_DATA;
+    int payload = BLOCKSIZE-dataOffset;
+    uint32_t storedSize = size;
+    int compressed = inode[OFFSET_I_FLAGS] & FLAG_I_COMPRESSED;
+    if (compressed){
+        storedSize = 0;
+        if (inode[OFFSET_I_LINKS] && inode[OFFSET_I_LINKS] < nBlocks){
+            storedSize = getZSize(getBlock(inode[OFFSET_I_LINKS])+dataOffset);
+            storedSize += LEN_Z_SIZE;
+        }
+    }
+    // files with reserved blocks may link more blocks than their content needs
+    int expected = (storedSize + payload-1) / payload;
+    if ((inode[OFFSET_I_FLAGS] & FLAG_I_RESERVED) && linkCount > expected)
+        expected = linkCount;
+    if (expected != linkCount || hole){
+        if (expected != linkCount)
+            report("%s: %s %u needs %d data blocks, inode links %d\n", fullPath,
+                compressed ? "compressed length" : "size", storedSize, expected, linkCount);
+        if (repair && compressed && expected != linkCount){
+            // a truncated stream can't be decompressed, drop the content
+            for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+                if (inode[i+OFFSET_I_LINKS])
+                    __atomic_fetch_sub(&refs[inode[i+OFFSET_I_LINKS]], 1, __ATOMIC_RELAXED);
+            }
+            emptyFile(inode);
+            dirty[inodeIdx] = 1;
+        }
+        else if (repair){
+            // pack links, drop links past the size, shrink size past the links
+            unsigned char links[BLOCKSIZE-OFFSET_I_LINKS];
+            int n = 0;
+            for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+                int b = inode[i+OFFSET_I_LINKS];
+                if (b && n < expected)
+                    links[n++] = b;
+                else if (b)
+                    __atomic_fetch_sub(&refs[b], 1, __ATOMIC_RELAXED);
+            }
+            memset(inode+OFFSET_I_LINKS, 0, BLOCKSIZE-OFFSET_I_LINKS);
+            memcpy(inode+OFFSET_I_LINKS, links, n);
+            if (n < expected){
+                size = n*payload;
+                setInodeSize(inode, size);
+            }
+            dirty[inodeIdx] = 1;
+        }
+    }
+}
+
+// worker thread, takes root directory entries until none are left
+static void *checkWorker(void *arg){
+    while (1){
+        int i = __atomic_fetch_add(&nextRootLink, 1, __ATOMIC_RELAXED);
+        if (i >= nRootLinks)
+            break;
+        checkInode(rootLinks[i], rootPaths[i]);
+    }
+    return NULL;
+}
+
+// checks the entries of a root directory and queues them for the workers
+static void queueRoot(int rootIdx, char *path){
+    unsigned char *root = getBlock(rootIdx);
+    int i;
+    for (i=0;(i+OFFSET_I_LINKS)<BLOCKSIZE;i++){
+        int b = root[i+OFFSET_I_LINKS];
+        if (!b)
+            continue;
+        const char *problem = NULL;
+        if (b >= nBlocks || b == ROOT_BLOCK)
+            problem = "invalid block";
+        else if (getBlock(b)[OFFSET_TYPE] != TYPE_I)
+            problem = "directory entry is not an inode";
+        else if (claimBlock(b)){
+            if (blockFrozen(b))
+                continue;
+            problem = "block referenced more than once";
+        }
+        if (problem){
+            report("%s: link %d to block %d: %s\n", path, i, b, problem);
+            if (repair){
+                root[i+OFFSET_I_LINKS] = 0;
+                dirty[rootIdx] = 1;
+            }
+            continue;
+        }
+        rootLinks[nRootLinks] = b;
+        strcpy(rootPaths[nRootLinks++], path);
+    }
+    checkHashedDir(rootIdx, path);
+}
+
+// checks the snapshot table and queues the entries of every snapshot root
+static void queueSnapshots(){
+    unsigned char *superblock = getBlock(0);
+    int i;
+    for (i=0;i<MAX_SNAPSHOTS;i++){
+        unsigned char *entry = superblock + OFFSET_S_SNAPS + i*LEN_S_SNAP;
+        int b = entry[LEN_I_NAME];
+        if (!b)
+            continue;
+        char path[LEN_I_NAME+2];
+        memset(path, 0, sizeof(path));
+        path[0] = '@';
+        memcpy(path+1, entry, LEN_I_NAME);
+
+        const char *problem = NULL;
+        if (b >= nBlocks || b == ROOT_BLOCK)
+            problem = "invalid block";
+        else if (getBlock(b)[OFFSET_TYPE] != TYPE_I || !getBlock(b)[OFFSET_I_DIR])
+            problem = "root is not a directory";
+        else if (!blockFrozen(b))
+            problem = "root is not frozen";
+        else if (claimBlock(b))
+            problem = "block referenced more than once";
+        if (problem){
+            report("%s: snapshot root %d: %s\n", path, b, problem);
+            if (repair){
+                memset(entry, 0, LEN_S_SNAP);
+                dirty[0] = 1;
+            }
+            continue;
+        }
+        queueRoot(b, path);
+    }
+}
+
+// checks the free chain against the tree, returns number of free blocks
+static int checkFreeChain(){
+    unsigned char onChain[MAX_BLOCKS];
+    memset(onChain, 0, MAX_BLOCKS);
+    int count = 0;
+    int b = getBlock(0)[OFFSET_S_FREE];
+    while (b){
+        if (b >= nBlocks || b == ROOT_BLOCK){
+            report("free chain: invalid block %d\n", b);
+            break;
+        }
+        if (onChain[b]){
+            report("free chain: loops back to block %d\n", b);
+            break;
+        }
+        onChain[b] = 1;
+        count++;
+        if (refs[b])
+            report("free chain: block %d is in use\n", b);
+        else if (getBlock(b)[OFFSET_TYPE] != TYPE_F)
+            report("free chain: block %d is not marked free\n", b);
+        b = getBlock(b)[OFFSET_LINK];
+    }
+
+    for (b=ROOT_BLOCK+1;b<nBlocks;b++){
+        if (!refs[b] && !onChain[b])
+            report("block %d is neither in use nor free\n", b);
+    }
+    return count;
+}
+
+// rebuilds the free chain in ascending order from all unreferenced blocks
+static void rebuildFreeChain(){
+    unsigned char *superblock = getBlock(0);
+    int prev = 0;
+    int b;
+    for (b=nBlocks-1;b>ROOT_BLOCK;b--){
+        if (refs[b])
+            continue;
+        superblock[OFFSET_S_FROZEN + b/8] &= ~(1 << (b%8));
+        unsigned char *block = getBlock(b);
+        memset(block, 0, BLOCKSIZE);
+        block[OFFSET_TYPE] = TYPE_F;
+        block[OFFSET_MAGIC] = 0x44;
+        block[OFFSET_LINK] = prev;
+        dirty[b] = 1;
+        prev = b;
+    }
+    superblock[OFFSET_S_FREE] = prev;
+    dirty[0] = 1;
+}
+
+int main(int argc, char **argv){
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    int flags = 0;
+    while ((opt = getopt(argc, argv, "rdj:")) != -1){
+        if (opt == 'r')
+            repair = 1;
+        else if (opt == 'd')
+            flags |= DISK_DIRECT;
+        else if (opt == 'j')
+            threads = atoi(optarg);
+        else{
+            printf("usage: %s [-r] [-d] [-j threads] diskname\n", argv[0]);
+            return 8;
+        }
+    }
+    if (optind >= argc){
+        printf("usage: %s [-r] [-d] [-j threads] diskname\n", argv[0]);
+        return 8;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (threads > FSCK_MAX_THREADS)
+        threads = FSCK_MAX_THREADS;
+
+    int disk = openDiskFlags(argv[optind], 0, flags);
+    if (disk < 0)
+        return 8;
+
+    // superblock
+    unsigned char superblock[BLOCKSIZE];
+    setDiskVerify(disk, 0);
+    if (readBlock(disk, 0, superblock)){
+        closeDisk(disk);
+        return 8;
+    }
+    setDiskVerify(disk, 1);
+    if (superblock[OFFSET_S_STRIPE] && setDiskStripe(disk, superblock[OFFSET_S_STRIPE]) < 0){
+        closeDisk(disk);
+        return 8;
+    }
+    uint32_t size = getSuperSize(superblock);
+    if (superblock[OFFSET_TYPE] != TYPE_S || superblock[OFFSET_MAGIC] != 0x44 || size < 2 || size > MAX_BLOCKS){
+        printf("%s: superblock is damaged, cannot check\n", argv[optind]);
+        closeDisk(disk);
+        return 4;
+    }
+    nBlocks = size;
+    shared = superblock[OFFSET_S_FEATURES] & FEATURE_S_SHARED;
+    rawData = superblock[OFFSET_S_FEATURES] & FEATURE_S_RAW_DATA;
+
+    image = malloc(nBlocks*BLOCKSIZE);
+    if (!image){
+        perror("malloc");
+        closeDisk(disk);
+        return 8;
+    }
+    if (readImage(disk) < 0){
+        closeDisk(disk);
+        free(image);
+        return 8;
+    }
+
+    if (getBlock(ROOT_BLOCK)[OFFSET_TYPE] != TYPE_I || !getBlock(ROOT_BLOCK)[OFFSET_I_DIR]){
+        printf("%s: root directory is damaged, cannot check\n", argv[optind]);
+        closeDisk(disk);
+        free(image);
+        return 4;
+    }
+
+    // check root subtrees in parallel
+    frozen = getBlock(0)+OFFSET_S_FROZEN;
+    refs[ROOT_BLOCK] = 1;
+    queueRoot(ROOT_BLOCK, "/");
+    queueSnapshots();
+    if (threads > nRootLinks)
+        threads = nRootLinks ? nRootLinks : 1;
+    // without any worker thread the subtrees are checked on this one
+    pthread_t workers[FSCK_MAX_THREADS];
+    int started = 0;
+    int t;
+    for (t=0;t<threads;t++){
+        if (pthread_create(workers+started, NULL, checkWorker, NULL) == 0)
+            started++;
+    }
+    if (!started)
+        checkWorker(NULL);
+    for (t=0;t<started;t++)
+        pthread_join(workers[t], NULL);
+
+    // the tree tells which blocks are raw data, every other block has a header
+    // data block checksum failures were reported with their file
+    int b;
+    for (b=0;b<nBlocks;b++){
+        unsigned char *block = getBlock(b);
+        int data = rawData ? isData[b] : block[OFFSET_TYPE] == TYPE_D;
+        if (!(rawData && data) && block[OFFSET_MAGIC] != 0x44)
+            report("block %d: magic number not found\n", b);
+        if (badCrc[b] && !data)
+            report("block %d: failed its checksum\n", b);
+        if (repair && badCrc[b])
+            dirty[b] = 1;
+    }
+
+    int freeCount = checkFreeChain();
+    int used = 0;
+    for (b=0;b<nBlocks;b++){
+        if (refs[b])
+            used++;
+    }
+    printf("%s: %d blocks, %d in use, %d free, %d problems\n", argv[optind], nBlocks, used+1, freeCount, errors);
+
+    if (repair && errors){
+        rebuildFreeChain();
+        int written = 0;
+        for (b=0;b<nBlocks;b++){
+            if (!dirty[b])
+                continue;
+            if (writeBlock(disk, b, getBlock(b))){
+                closeDisk(disk);
+                free(image);
+                return 8;
+            }
+            written++;
+        }
+        printf("%s: repaired, %d blocks rewritten\n", argv[optind], written);
+    }
+
+    closeDisk(disk);
+    free(image);
+    if (!errors)
+        return 0;
+    return repair ? 1 : 4;
+}
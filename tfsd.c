@@ -0,0 +1,71 @@
+/* tinyFS server daemon
+ * usage: tfsd [-f bytes] [-D hdd|ssd|nvme] [-s socket] diskname
+ *
+ * Mounts a disk and serves it to other processes on a Unix socket, so they
+ * share one open file table and one set of caches. Clients use the tfsc_
+ * calls of tfsClient.h. With -f the disk is formatted first, with -D it is
+ * timed on a simulated device. Runs until interrupted or until a client
+ * calls tfsc_shutdown, then unmounts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "libDisk.h"
+#include "TinyFS_errno.h"
+#include "tfsServer.h"
+
+static void onSignal(int sig){
+    tfs_serveStop();
+}
+
+int main(int argc, char **argv){
+    char *socketPath = TFSD_SOCKET;
+    int format = 0;
+    diskModel model;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:D:s:")) != -1){
+        if (opt == 'f')
+            format = atoi(optarg);
+        else if (opt == 'D'){
+            if (getDiskModel(optarg, &model) < 0)
+                return 1;
+            tfs_setDiskModel(&model);
+        }
+        else if (opt == 's')
+            socketPath = optarg;
+        else{
+            printf("usage: %s [-f bytes] [-D hdd|ssd|nvme] [-s socket] diskname\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc){
+        printf("usage: %s [-f bytes] [-D hdd|ssd|nvme] [-s socket] diskname\n", argv[0]);
+        return 1;
+    }
+    char *disk = argv[optind];
+    if ((format && tfs_mkfs(disk, format) < 0) || tfs_mount(disk) < 0)
+        return 1;
+
+    // poll is interrupted instead of restarted, so the loop sees the stop
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (tfs_serveOpen(socketPath) < 0){
+        tfs_unmount();
+        return 1;
+    }
+    printf("serving %s on %s\n", disk, socketPath);
+    fflush(stdout);
+    int retVal = tfs_serve();
+    tfs_unmount();
+    return retVal < 0;
+}
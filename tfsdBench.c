@@ -0,0 +1,189 @@
+/* tfsd throughput benchmark
+ * usage: tfsdBench [-c clients] [-n calls] [-b bytes] [-D hdd|ssd|nvme]
+ *
+ * Runs 1, 2, 4 ... up to clients processes against one tfsd, each writing,
+ * reading back and checking its own file, and reports calls per second,
+ * content throughput and block I/O of the disk, next to one process making
+ * the same calls on the library directly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "tinyFS.h"
+#include "libTinyFS.h"
+#include "libDisk.h"
+#include "TinyFS_errno.h"
+#include "tfsClient.h"
+
+#define BENCH_DISK "tfsdBench.dsk"
+#define BENCH_DISK_SIZE (MAX_BLOCKS*BLOCKSIZE)
+#define BENCH_SOCKET "tfsdBench.sock"
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// writes, reads back and checks a file calls times through either interface, returns the failures
+static int workload(int client, int calls, int bytes, int served){
+    char *buffer = malloc(bytes);
+    char *out = malloc(bytes);
+    char name[16];
+    int i, bad = 0;
+    sprintf(name, "/c%d", client);
+    fileDescriptor fd = served ? tfsc_openFile(name) : tfs_openFile(name);
+    for (i=0;i<calls;i++){
+        memset(buffer, 'a' + (client+i)%26, bytes);
+        int got;
+        if (served){
+            tfsc_writeFile(fd, buffer, bytes);
+            tfsc_seek(fd, 0);
+            got = tfsc_read(fd, out, bytes);
+        }
+        else{
+            tfs_writeFile(fd, buffer, bytes);
+            tfs_seek(fd, 0);
+            got = tfs_read(fd, out, bytes);
+        }
+        if (got != bytes || memcmp(buffer, out, bytes))
+            bad++;
+    }
+    if (served)
+        tfsc_closeFile(fd);
+    else
+        tfs_closeFile(fd);
+    free(buffer);
+    free(out);
+    return bad;
+}
+
+static void report(char *mode, int clients, int calls, int bytes, double seconds, diskStats *stats, int bad){
+    long total = (long)clients * calls;
+    printf("%-7s %8d %12.0f %10.2f %10ld %10ld %6d\n", mode, clients, 3*total / seconds,
+        2.0*total*bytes / seconds / 1e6, stats->reads, stats->writes, bad);
+}
+
+static void benchDirect(int calls, int bytes){
+    diskStats stats;
+    tfs_mkfs(BENCH_DISK, BENCH_DISK_SIZE);
+    tfs_mount(BENCH_DISK);
+    double start = now();
+    int bad = workload(0, calls, bytes, 0);
+    double seconds = now()-start;
+    tfs_diskStats(&stats);
+    tfs_unmount();
+    report("direct", 1, calls, bytes, seconds, &stats, bad);
+}
+
+// the server and every client are separate processes, clients start together
+static void benchServed(int clients, int calls, int bytes){
+    int ready[2], go[2];
+    if (pipe(ready) < 0){
+        perror("pipe");
+        return;
+    }
+    tfs_mkfs(BENCH_DISK, BENCH_DISK_SIZE);
+    pid_t server = fork();
+    if (server == 0){
+        close(ready[0]);
+        if (tfs_mount(BENCH_DISK) < 0 || tfs_serveOpen(BENCH_SOCKET) < 0)
+            _exit(1);
+        close(ready[1]);
+        tfs_serve();
+        tfs_unmount();
+        _exit(0);
+    }
+    close(ready[1]);
+    char c;
+    if (read(ready[0], &c, 1) != 0){
+        printf("Error: tfsd didn't start\n");
+        return;
+    }
+    close(ready[0]);
+
+    // go is made after the server is forked, it must not hold the write end open
+    if (pipe(go) < 0){
+        perror("pipe");
+        return;
+    }
+    pid_t *pids = malloc(clients * sizeof(pid_t));
+    int i;
+    for (i=0;i<clients;i++){
+        pids[i] = fork();
+        if (pids[i] == 0){
+            close(go[1]);
+            if (tfsc_connect(BENCH_SOCKET) < 0 || read(go[0], &c, 1) != 0)
+                _exit(255);
+            int bad = workload(i, calls, bytes, 1);
+            tfsc_disconnect();
+            _exit(bad > 254 ? 254 : bad);
+        }
+    }
+    close(go[0]);
+    double start = now();
+    close(go[1]);
+    int status, bad = 0;
+    for (i=0;i<clients;i++){
+        waitpid(pids[i], &status, 0);
+        bad += WIFEXITED(status) ? WEXITSTATUS(status) : 255;
+    }
+    double seconds = now()-start;
+    free(pids);
+
+    diskStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (tfsc_connect(BENCH_SOCKET) == 0){
+        tfsc_diskStats(&stats);
+        tfsc_shutdown();
+    }
+    waitpid(server, &status, 0);
+    report("tfsd", clients, calls, bytes, seconds, &stats, bad);
+}
+
+int main(int argc, char **argv){
+    int maxClients = 8;
+    int calls = 2000;
+    int bytes = 4096;
+    diskModel model;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:b:D:")) != -1){
+        if (opt == 'c')
+            maxClients = atoi(optarg);
+        else if (opt == 'n')
+            calls = atoi(optarg);
+        else if (opt == 'b')
+            bytes = atoi(optarg);
+        else if (opt == 'D'){
+            if (getDiskModel(optarg, &model) < 0)
+                return 1;
+            tfs_setDiskModel(&model);
+        }
+        else{
+            printf("usage: %s [-c clients] [-n calls] [-b bytes] [-D hdd|ssd|nvme]\n", argv[0]);
+            return 1;
+        }
+    }
+    // every client's file has to fit on the disk at once
+    int fileBlocks = (bytes + BLOCKSIZE-OFFSET_D_DATA-1) / (BLOCKSIZE-OFFSET_D_DATA) + 1;
+    if (maxClients < 1 || calls < 1 || bytes < 1 || bytes > MAX_FILE_SIZE
+        || maxClients * fileBlocks > MAX_BLOCKS - 2 - maxClients){
+        printf("Error: %d clients with %d byte files don't fit on the disk\n", maxClients, bytes);
+        return 1;
+    }
+
+    printf("%-7s %8s %12s %10s %10s %10s %6s\n", "mode", "clients", "calls/s", "MB/s",
+        "reads", "writes", "bad");
+    benchDirect(calls, bytes);
+    int clients;
+    for (clients=1;clients<=maxClients;clients*=2)
+        benchServed(clients, calls, bytes);
+    unlink(BENCH_DISK);
+    unlink(BENCH_DISK ".crc");
+    return 0;
+}
@@ -5,10 +5,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <signal.h>
 
 #include "tinyFS.h"
 #include "libTinyFS.h"
 #include "TinyFS_errno.h"
+#include "tfsAsync.h"
+#include "tfsTrace.h"
+#include "tfsServer.h"
+#include "tfsClient.h"
 
 // read, write, seek
 void test_RW(){
@@ -108,6 +119,1338 @@ void test_dir(){
     tfs_unmount();
 }
 
+// stat, fstat, bulk stat
+void test_stat(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 100*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+
+    char buffer[1000];
+    memset(buffer, 'x', 1000);
+    tfs_createDir("/docs");
+    fileDescriptor fd = tfs_openFile("/docs/a");
+    tfs_writeFile(fd, buffer, 1000);
+    tfs_openFile("/b");
+
+    tfsStat st;
+    tfs_stat("/docs/a", &st);
+    printf("%s size %u dir %d\n", st.name, st.size, st.isdir);   // a size 1000 dir 0
+    tfs_fstat(fd, &st);
+    printf("%s size %u dir %d\n", st.name, st.size, st.isdir);   // a size 1000 dir 0
+    tfs_writeFile(fd, buffer, 10);
+    tfs_rename(fd, "c");
+    tfs_fstat(fd, &st);
+    printf("%s size %u dir %d\n", st.name, st.size, st.isdir);   // c size 10 dir 0
+
+    char *names[] = {"/b", "/docs", "/nope", "/"};
+    tfsStat sts[4];
+    int found = tfs_statBulk(names, 4, sts);                    // /nope should fail
+    printf("found %d\n", found);                                // found 3
+    int i;
+    for (i=0;i<4;i++){
+        if (sts[i].inodeBlock > 0)
+            printf("%s size %u dir %d\n", sts[i].name, sts[i].size, sts[i].isdir);
+    }
+
+    // with a cold cache the root is read, then its children /docs and /b, which aren't
+    // consecutive blocks, then /docs/c, each level in ascending block order
+    tfs_unmount();
+    tfs_mount(DEFAULT_DISK_NAME);
+    diskStats before, after;
+    tfs_diskStats(&before);
+    char *deep[] = {"/docs/c", "/b", "/docs"};
+    printf("%d\n", tfs_statBulk(deep, 3, sts));                 // 3
+    tfs_diskStats(&after);
+    printf("%ld\n", after.readCalls-before.readCalls);          // 4
+    printf("%u\n", sts[0].size);                                // 10
+    fd = tfs_openFile("/docs/c");
+
+    tfs_deleteFile(fd);
+    tfs_stat("/docs/c", &st);                                   // should fail
+
+    tfs_unmount();
+}
+
+// small files stored in the inode, promoted to data blocks when they grow
+void test_inline(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 12*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+
+    char buffer[1000];
+    memset(buffer, 's', 1000);
+    buffer[MAX_INLINE_SIZE-1] = 'e';
+    buffer[900] = 'b';
+
+    // 10 free blocks, each inline file only costs its inode
+    char name[3] = "f0";
+    int i;
+    for (i=0;i<8;i++){
+        name[1] = '0'+i;
+        fileDescriptor fd = tfs_openFile(name);
+        if (tfs_writeFile(fd, buffer, MAX_INLINE_SIZE) < 0)
+            printf("inline write %d failed\n", i);
+    }
+
+    fileDescriptor fd = tfs_openFile("f0");
+    char c[2];
+    c[1] = '\0';
+    tfs_seek(fd, MAX_INLINE_SIZE-1);
+    tfs_readByte(fd, c);    // e
+    printf("%s", c);
+    tfs_readByte(fd, c);    // should fail
+    printf("\n");
+
+    // grow into data blocks, then shrink back
+    tfs_deleteFile(tfs_openFile("f7"));
+    tfs_deleteFile(tfs_openFile("f6"));
+    tfs_writeFile(fd, buffer, 1000);
+    tfs_seek(fd, 900);
+    tfs_readByte(fd, c);    // b
+    printf("%s", c);
+    tfs_writeFile(fd, buffer+999, 1);
+    tfs_readByte(fd, c);    // s
+    printf("%s\n", c);
+
+    tfs_unmount();
+}
+
+// sequential and random reads through the readahead buffer
+void test_readahead(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 100*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+
+    int size = 40*BLOCKSIZE;
+    char buffer[40*BLOCKSIZE];
+    int i;
+    for (i=0;i<size;i++)
+        buffer[i] = i % 251;
+
+    // fragment the free list so data blocks are not all consecutive
+    fileDescriptor gapFD = tfs_openFile("gap");
+    tfs_writeFile(gapFD, buffer, 3*BLOCKSIZE);
+    fileDescriptor aFD = tfs_openFile("afile");
+    tfs_writeFile(aFD, buffer, 5*BLOCKSIZE);
+    tfs_deleteFile(gapFD);
+    tfs_writeFile(aFD, buffer, size);
+
+    fileDescriptor bFD = tfs_openFile("afile");
+    char c;
+    int errors = 0;
+    for (i=0;i<size;i++){
+        if (tfs_readByte(bFD, &c) < 0 || c != buffer[i])
+            errors++;
+    }
+    printf("sequential read errors: %d\n", errors);  // 0
+
+    int offsets[] = {9000, 17, 5000, 5001, 252, 251, 10239};
+    errors = 0;
+    for (i=0;i<7;i++){
+        tfs_seek(bFD, offsets[i]);
+        if (tfs_readByte(bFD, &c) < 0 || c != buffer[offsets[i]])
+            errors++;
+    }
+    printf("random read errors: %d\n", errors);      // 0
+
+    // rewriting through another descriptor drops prefetched data
+    buffer[0] = 'n';
+    tfs_writeFile(aFD, buffer, size);
+    tfs_seek(bFD, 0);
+    tfs_readByte(bFD, &c);      // n
+    printf("%c\n", c);
+
+    tfs_unmount();
+}
+
+// buffered writes are allocated and written on fsync/close
+void test_writeback(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 20*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+
+    char buffer[20*BLOCKSIZE];
+    memset(buffer, 'w', 20*BLOCKSIZE);
+
+    fileDescriptor aFD = tfs_openFile("afile");
+    tfs_writeFile(aFD, buffer, 1000);
+    tfs_writeFile(aFD, buffer, 2000);   // replaces buffered content
+    tfsStat st;
+    tfs_fstat(aFD, &st);
+    printf("buffered size %u\n", st.size);     // 2000
+    if (tfs_fsync(aFD) == 0)
+        printf("synced\n");
+
+    // 18 free blocks, afile uses 9 and bfile's 10 data blocks don't fit
+    fileDescriptor bFD = tfs_openFile("bfile");
+    tfs_writeFile(bFD, buffer, 2500);
+    tfs_fsync(bFD);                     // should fail
+    tfs_closeFile(bFD);                 // should fail
+    tfs_stat("bfile", &st);
+    printf("bfile size %u\n", st.size);        // 0
+
+    tfs_closeFile(aFD);
+    tfs_stat("afile", &st);
+    printf("afile size %u\n", st.size);        // 2000
+
+    tfs_unmount();
+}
+
+// block checksums catch corruption of the image file
+void test_checksum(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 20*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    char buffer[1000];
+    memset(buffer, 'c', 1000);
+    fileDescriptor fd = tfs_openFile("afile");
+    tfs_writeFile(fd, buffer, 1000);
+    tfs_unmount();
+
+    if (tfs_mount(DEFAULT_DISK_NAME) == 0){
+        printf("clean mount\n");
+        tfs_unmount();
+    }
+
+    // flip one byte of file data behind the file system's back
+    FILE *image = fopen(DEFAULT_DISK_NAME, "r+b");
+    fseek(image, 3*BLOCKSIZE+100, SEEK_SET);
+    fputc('X', image);
+    fclose(image);
+
+    tfs_mount(DEFAULT_DISK_NAME);   // should fail
+}
+
+// defragmenting keeps content and open files intact
+void test_defrag(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 60*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+
+    char buffer[3000];
+    int i;
+    for (i=0;i<3000;i++)
+        buffer[i] = 'a' + i % 26;
+
+    // interleave files and leave holes behind
+    tfs_createDir("/dir");
+    fileDescriptor fds[6];
+    char name[8] = "/dir/f0";
+    for (i=0;i<6;i++){
+        name[6] = '0'+i;
+        fds[i] = tfs_openFile(name);
+        tfs_writeFile(fds[i], buffer, 600);
+        tfs_fsync(fds[i]);
+    }
+    tfs_deleteFile(fds[1]);
+    tfs_deleteFile(fds[3]);
+    tfs_writeFile(fds[0], buffer, 3000);
+    tfs_fsync(fds[0]);
+
+    int remaining = tfs_defrag(2, 0);
+    printf("after 2 moves: %s\n", remaining > 0 ? "incomplete" : "done");   // incomplete
+    remaining = tfs_defrag(0, 0);
+    printf("remaining: %d\n", remaining);     // 0
+
+    int errors = 0;
+    char c;
+    for (i=0;i<3000;i++){
+        if (tfs_readByte(fds[0], &c) < 0 || c != buffer[i])
+            errors++;
+    }
+    tfs_seek(fds[5], 599);
+    if (tfs_readByte(fds[5], &c) < 0 || c != buffer[599])
+        errors++;
+    printf("read errors: %d\n", errors);      // 0
+    tfs_unmount();
+
+    // a block dropped from the free chain stays out of it, reclaiming it is tfsck's job
+    unsigned char super[BLOCKSIZE], block[BLOCKSIZE];
+    int disk = openDisk(DEFAULT_DISK_NAME, 0);
+    readBlock(disk, 0, super);
+    int leaked = super[OFFSET_S_FREE];
+    readBlock(disk, leaked, block);
+    super[OFFSET_S_FREE] = block[OFFSET_LINK];
+    writeBlock(disk, 0, super);
+    closeDisk(disk);
+    tfs_mount(DEFAULT_DISK_NAME);
+    printf("remaining: %d\n", tfs_defrag(0, 0));   // 0
+    tfs_unmount();
+    disk = openDisk(DEFAULT_DISK_NAME, 0);
+    readBlock(disk, 0, super);
+    int b = super[OFFSET_S_FREE];
+    int found = 0;
+    while (b){
+        found |= b == leaked;
+        readBlock(disk, b, block);
+        b = block[OFFSET_LINK];
+    }
+    closeDisk(disk);
+    printf("leaked block on free chain: %d\n", found);   // 0
+}
+
+// compressed files are transparent to readers and can exceed MAX_FILE_SIZE
+void test_compress(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+
+    int size = 200000;
+    char *buffer = malloc(size);
+    int i;
+    for (i=0;i<size;i++)
+        buffer[i] = "hello world from (a) file "[i % 26];
+
+    fileDescriptor aFD = tfs_openFile("afile");
+    printf("%d\n", tfs_writeFile(aFD, buffer, size));   // -6, too big uncompressed
+    tfs_setCompression(aFD, 1);
+    printf("%d\n", tfs_writeFile(aFD, buffer, size));   // 0
+    tfs_closeFile(aFD);
+
+    tfs_unmount();
+    tfs_mount(DEFAULT_DISK_NAME);
+    aFD = tfs_openFile("afile");
+    tfsStat st;
+    tfs_fstat(aFD, &st);
+    printf("size %u\n", st.size);                    // 200000
+    char c;
+    int errors = 0;
+    for (i=0;i<size;i++){
+        if (tfs_readByte(aFD, &c) < 0 || c != buffer[i])
+            errors++;
+    }
+    tfs_seek(aFD, 12345);
+    if (tfs_readByte(aFD, &c) < 0 || c != buffer[12345])
+        errors++;
+    printf("read errors: %d\n", errors);             // 0
+
+    // random content doesn't compress and is stored as is
+    for (i=0;i<3000;i++)
+        buffer[i] = rand();
+    tfs_writeFile(aFD, buffer, 3000);
+    tfs_seek(aFD, 2999);
+    tfs_readByte(aFD, &c);
+    printf("%d\n", c == buffer[2999]);              // 1
+
+    // turning compression off rewrites compressed content in plain form
+    fileDescriptor bFD = tfs_openFile("bfile");
+    tfs_setCompression(bFD, 1);
+    tfs_writeFile(bFD, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 40);
+    tfs_setCompression(bFD, 0);
+    tfs_seek(bFD, 39);
+    tfs_readByte(bFD, &c);
+    printf("%c\n", c);                              // a
+    tfs_setCompression(aFD, 0);
+    tfs_setCompression(aFD, 1);
+    errors = 0;
+    for (i=0;i<3000;i++){
+        tfs_seek(aFD, i);
+        if (tfs_readByte(aFD, &c) < 0 || c != buffer[i])
+            errors++;
+    }
+    printf("read errors: %d\n", errors);             // 0
+
+    // content shorter than a match plus the trailing literals is kept as literals
+    tfs_setCompression(bFD, 1);
+    tfs_writeFile(bFD, "abcdefg", 7);
+    tfs_fsync(bFD);
+    tfs_seek(bFD, 6);
+    tfs_readByte(bFD, &c);
+    printf("%c\n", c);                              // g
+
+    free(buffer);
+    tfs_unmount();
+}
+
+// identical data blocks are stored once and freed with their last link
+void test_dedup(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    tfs_setDedup(1, 0);
+
+    char buffer[3000];
+    memset(buffer, 'x', 3000);
+    buffer[2999] = 'y';
+    int freeStart = countFreeBlocks();
+
+    // 12 data blocks, 11 of them the same
+    fileDescriptor aFD = tfs_openFile("afile");
+    tfs_writeFile(aFD, buffer, 3000);
+    tfs_closeFile(aFD);
+    printf("%d\n", freeStart-countFreeBlocks());    // 3, inode and 2 data blocks
+    fileDescriptor bFD = tfs_openFile("bfile");
+    tfs_writeFile(bFD, buffer, 3000);
+    tfs_closeFile(bFD);
+    printf("%d\n", freeStart-countFreeBlocks());    // 4, bfile only needs an inode
+
+    // the index and link counts are rebuilt on mount
+    tfs_unmount();
+    tfs_mount(DEFAULT_DISK_NAME);
+    fileDescriptor cFD = tfs_openFile("/cfile");
+    tfs_writeFile(cFD, buffer, 1000);
+    tfs_closeFile(cFD);
+    printf("%d\n", freeStart-countFreeBlocks());    // 6, cfile's last block is new
+
+    aFD = tfs_openFile("afile");
+    tfs_deleteFile(aFD);
+    printf("%d\n", freeStart-countFreeBlocks());    // 5
+    tfs_defrag(0, 0);
+    bFD = tfs_openFile("bfile");
+    char c;
+    int i, errors = 0;
+    for (i=0;i<3000;i++){
+        if (tfs_readByte(bFD, &c) < 0 || c != buffer[i])
+            errors++;
+    }
+    printf("read errors: %d\n", errors);             // 0
+
+    tfs_deleteFile(bFD);
+    tfs_deleteFile(tfs_openFile("/cfile"));
+    printf("%d\n", freeStart-countFreeBlocks());    // 0
+
+    // with dedup off new blocks are always written
+    tfs_setDedup(0, 0);
+    aFD = tfs_openFile("afile");
+    tfs_writeFile(aFD, buffer, 3000);
+    tfs_closeFile(aFD);
+    printf("%d\n", freeStart-countFreeBlocks());    // 13
+
+    tfs_unmount();
+}
+
+void test_snapshot(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    char buffer[600];
+    memset(buffer, 'a', 600);
+    tfs_createDir("/dir");
+    fileDescriptor aFD = tfs_openFile("/dir/afile");
+    tfs_writeFile(aFD, buffer, 600);
+    tfs_closeFile(aFD);
+    fileDescriptor bFD = tfs_openFile("bfile");
+    tfs_writeFile(bFD, "old", 3);
+    tfs_closeFile(bFD);
+    int freeStart = countFreeBlocks();
+
+    // only the root inode is copied
+    printf("%d\n", tfs_snapshot("snap"));                   // 0
+    printf("%d\n", freeStart-countFreeBlocks());            // 1
+    printf("%d\n", tfs_snapshot("snap"));                   // -10
+
+    // changes copy the inode and the directories above it
+    memset(buffer, 'b', 600);
+    aFD = tfs_openFile("/dir/afile");
+    tfs_writeFile(aFD, buffer, 600);
+    tfs_closeFile(aFD);
+    printf("%d\n", freeStart-countFreeBlocks());            // 6, root copy, dir, afile and 3 data blocks
+    tfs_deleteFile(tfs_openFile("bfile"));
+    fileDescriptor cFD = tfs_openFile("cfile");
+    tfs_closeFile(cFD);
+
+    char c;
+    aFD = tfs_openFile("/dir/afile");
+    tfs_readByte(aFD, &c);
+    printf("%c\n", c);                                      // b
+    tfsStat st;
+    printf("%d\n", tfs_stat("bfile", &st));                 // -4
+
+    // the snapshot still has the old content and is read only
+    tfs_mountSnapshot(DEFAULT_DISK_NAME, "snap");
+    aFD = tfs_openFile("/dir/afile");
+    tfs_readByte(aFD, &c);
+    printf("%c\n", c);                                      // a
+    bFD = tfs_openFile("bfile");
+    tfs_readByte(bFD, &c);
+    printf("%c\n", c);                                      // o
+    printf("%d\n", tfs_stat("cfile", &st));                 // -4
+    printf("%d\n", tfs_writeFile(bFD, "new", 3));           // -14
+    printf("%d\n", tfs_openFile("dfile"));                  // -14
+
+    // deleting the snapshot frees what only it used
+    tfs_mount(DEFAULT_DISK_NAME);
+    printf("%d\n", tfs_deleteSnapshot("snap"));             // 0
+    printf("%d\n", freeStart-countFreeBlocks());            // 0, cfile replaced bfile
+    tfs_unmount();
+    printf("%d\n", tfs_mountSnapshot(DEFAULT_DISK_NAME, "snap"));   // -4
+}
+
+void test_copy(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    char buffer[3000];
+    int i;
+    for (i=0;i<3000;i++)
+        buffer[i] = 'a' + i%26;
+    fileDescriptor aFD = tfs_openFile("afile");
+    tfs_writeFile(aFD, buffer, 3000);
+    tfs_fsync(aFD);
+    int freeStart = countFreeBlocks();
+
+    // the copy shares the data blocks
+    printf("%d\n", tfs_copy("afile", "/bfile"));            // 0
+    printf("%d\n", freeStart-countFreeBlocks());            // 1
+    tfs_writeFile(aFD, "new", 3);
+    tfs_closeFile(aFD);
+    printf("%d\n", freeStart-countFreeBlocks());            // 1, bfile keeps the data blocks
+    printf("%d\n", tfs_copy("nofile", "cfile"));           // -4
+
+    // export to a host file and import it back
+    int hostfd = open("tinyFSCopy.tmp", O_CREAT|O_RDWR|O_TRUNC, S_IRUSR|S_IWUSR);
+    fileDescriptor bFD = tfs_openFile("bfile");
+    printf("%d\n", tfs_export(bFD, hostfd));               // 0
+    lseek(hostfd, 0, SEEK_SET);
+    printf("%d\n", tfs_import(hostfd, "/cfile"));           // 0
+    close(hostfd);
+    unlink("tinyFSCopy.tmp");
+
+    fileDescriptor cFD = tfs_openFile("cfile");
+    char c;
+    int errors = 0;
+    for (i=0;i<3000;i++){
+        if (tfs_readByte(bFD, &c) < 0 || c != buffer[i])
+            errors++;
+        if (tfs_readByte(cFD, &c) < 0 || c != buffer[i])
+            errors++;
+    }
+    printf("read errors: %d\n", errors);                   // 0
+    printf("%d\n", tfs_readByte(cFD, &c));                 // -8
+
+    tfs_unmount();
+}
+
+void test_batch(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    int freeStart = countFreeBlocks();
+
+    // a tenant tree in one batch
+    char names[10][16];
+    tfsBatchOp ops[14];
+    int i;
+    ops[0].op = BATCH_MKDIR;
+    ops[0].path = "/tenant";
+    for (i=0;i<10;i++){
+        sprintf(names[i], "/tenant/f%d", i);
+        ops[i+1].op = BATCH_CREATE;
+        ops[i+1].path = names[i];
+    }
+    ops[11].op = BATCH_RENAME;
+    ops[11].path = "/tenant/f0";
+    ops[11].newName = "first";
+    ops[12].op = BATCH_DELETE;
+    ops[12].path = "/tenant/f9";
+    ops[13].op = BATCH_CREATE;
+    ops[13].path = "/nodir/file";
+    printf("%d\n", tfs_batch(ops, 14));                    // -4
+    printf("%d %d\n", ops[12].result, ops[13].result);     // 0 -4
+    printf("%d\n", freeStart-countFreeBlocks());           // 10, tenant and 9 files
+
+    // everything reached the disk
+    tfs_unmount();
+    tfs_mount(DEFAULT_DISK_NAME);
+    tfsStat st;
+    printf("%d\n", tfs_stat("/tenant/first", &st));         // 0
+    printf("%d\n", tfs_stat("/tenant/f9", &st));            // -4
+    printf("%d\n", tfs_stat("/tenant/f8", &st));            // 0
+    tfs_unmount();
+}
+
+void test_move(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    tfs_createDir("/a");
+    tfs_createDir("/b");
+    fileDescriptor fd = tfs_openFile("/a/longname");
+    tfs_writeFile(fd, "data", 4);
+    tfsStat st;
+
+    // move across directories, the open descriptor follows
+    printf("%d\n", tfs_move("/a/longname", "/b/x"));        // 0
+    printf("%d\n", tfs_stat("/a/longname", &st));           // -4
+    tfs_fstat(fd, &st);
+    printf("%s %d\n", st.name, st.size);                    // x 4
+    printf("%d\n", tfs_rename(fd, "y"));                    // 0
+    printf("%d\n", tfs_stat("/b/y", &st));                  // 0
+
+    // an existing file is replaced, directories are not
+    fileDescriptor tmpFD = tfs_openFile("/b/tmp");
+    tfs_writeFile(tmpFD, "new data", 8);
+    tfs_closeFile(tmpFD);
+    int freeBefore = countFreeBlocks();
+    printf("%d\n", tfs_move("/b/tmp", "/b/y"));             // 0
+    printf("%d\n", countFreeBlocks()-freeBefore);           // 1
+    tfs_stat("/b/y", &st);
+    printf("%d\n", st.size);                                // 8
+    printf("%d\n", tfs_move("/b/y", "/a"));                 // -12
+    printf("%d\n", tfs_move("/a", "/a/sub"));               // -10
+
+    // directories move with everything under them
+    printf("%d\n", tfs_move("/b", "/a/b"));                 // 0
+    printf("%d\n", tfs_stat("/a/b/y", &st));                // 0
+    tfs_unmount();
+}
+
+void test_hashdir(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 200*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    tfs_createDir("/d");
+    char name[16];
+    int i;
+    for (i=0;i<150;i++){
+        sprintf(name, "/d/f%d", i);
+        tfs_closeFile(tfs_openFile(name));
+    }
+
+    // deletes move later links back, nothing gets lost behind a gap
+    for (i=0;i<150;i+=3){
+        sprintf(name, "/d/f%d", i);
+        tfs_deleteFile(tfs_openFile(name));
+    }
+    tfs_unmount();
+    tfs_mount(DEFAULT_DISK_NAME);
+    tfsStat st;
+    int errors = 0;
+    for (i=0;i<150;i++){
+        sprintf(name, "/d/f%d", i);
+        if ((tfs_stat(name, &st) < 0) != (i%3 == 0))
+            errors++;
+    }
+    printf("lookup errors: %d\n", errors);                 // 0
+
+    // a lookup probes a few slots instead of every entry
+    tfs_unmount();
+    tfs_mount(DEFAULT_DISK_NAME);
+    diskStats before, after;
+    tfs_diskStats(&before);
+    tfs_stat("/d/f100", &st);
+    tfs_diskStats(&after);
+    printf("%d\n", after.reads-before.reads < 10);         // 1
+    tfs_unmount();
+}
+
+void test_layout(){
+    tfs_mkfs(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    unsigned char block[BLOCKSIZE];
+    int disk = openDisk(DEFAULT_DISK_NAME, 0);
+    readBlock(disk, 0, block);
+    superLayout *super = (superLayout *)block;
+    printf("%d %d\n", super->type, super->magic);          // 1 68
+    printf("%u\n", getSuperSize(block));                   // 40
+    int root = super->root;
+    printf("%d %d\n", root, super->freeHead);              // 1 2
+
+    readBlock(disk, root, block);
+    inodeLayout *inode = (inodeLayout *)block;
+    printf("%d %c %d\n", inode->type, inode->name[0], inode->dir);    // 2 / 1
+    printf("%d\n", (inode->flags & FLAG_I_HASHED) != 0);   // 1
+
+    // sizes are little endian whatever the host order
+    setInodeSize(block, 0x123456);
+    printf("%02x %02x %02x\n", block[OFFSET_I_SIZE], block[OFFSET_I_SIZE+1], block[OFFSET_I_SIZE+2]);  // 56 34 12
+    printf("%x\n", getInodeSize(block));                   // 123456
+    closeDisk(disk);
+}
+
+void test_rawdata(){
+    char buffer[4*BLOCKSIZE], out[4*BLOCKSIZE];
+    int i;
+    for (i=0;i<4*BLOCKSIZE;i++)
+        buffer[i] = 'a' + i%26;
+    // file bytes that look like an inode header stay file bytes
+    buffer[0] = TYPE_I;
+    buffer[1] = 0x44;
+
+    // bulk reads on the default format go through the readahead buffer
+    tfs_mkfs(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    int freeStart = countFreeBlocks();
+    fileDescriptor fd = tfs_openFile("afile");
+    tfs_writeFile(fd, buffer, 4*BLOCKSIZE);
+    tfs_closeFile(fd);
+    printf("%d\n", freeStart-countFreeBlocks());            // 6, inode and 5 data blocks
+    fd = tfs_openFile("afile");
+    printf("%d\n", tfs_read(fd, out, sizeof(out)));        // 1024
+    printf("%d\n", memcmp(buffer, out, sizeof(out)));      // 0
+    tfs_unmount();
+
+    // raw data blocks hold BLOCKSIZE file bytes each
+    printf("%d\n", tfs_mkfsFeatures(DEFAULT_DISK_NAME, 40*BLOCKSIZE, FEATURE_S_RAW_DATA));   // 0
+    tfs_mount(DEFAULT_DISK_NAME);
+    fd = tfs_openFile("afile");
+    tfs_writeFile(fd, buffer, 4*BLOCKSIZE);
+    tfs_closeFile(fd);
+    printf("%d\n", freeStart-countFreeBlocks());            // 5, inode and 4 data blocks
+    tfs_unmount();
+
+    // whole blocks are read straight into the buffer, one disk call per run of blocks
+    tfs_mount(DEFAULT_DISK_NAME);
+    fd = tfs_openFile("afile");
+    diskStats before, after;
+    tfs_diskStats(&before);
+    printf("%d\n", tfs_read(fd, out, sizeof(out)));        // 1024
+    tfs_diskStats(&after);
+    printf("%d\n", memcmp(buffer, out, sizeof(out)));      // 0
+    printf("%ld\n", after.readCalls-before.readCalls);    // 2, inode and the data blocks
+    tfs_seek(fd, 100);
+    printf("%d\n", tfs_read(fd, out, 600));               // 600
+    printf("%d\n", memcmp(buffer+100, out, 600));         // 0
+    tfs_seek(fd, 1000);
+    printf("%d\n", tfs_read(fd, out, 600));               // 24
+    printf("%d\n", tfs_read(fd, out, 600));               // -8
+
+    // a deleted snapshot frees the data blocks of files only it reached
+    tfs_closeFile(fd);
+    tfs_snapshot("s");
+    tfs_deleteFile(tfs_openFile("afile"));
+    tfs_deleteSnapshot("s");
+    printf("%d\n", countFreeBlocks() == freeStart);       // 1
+    tfs_unmount();
+}
+
+void test_direct(){
+    // 40 blocks are two and a half aligned chunks, the last half goes through the page cache
+    unsigned char block[BLOCKSIZE], check[3*BLOCKSIZE];
+    int disk = openDiskFlags(DEFAULT_DISK_NAME, 40*BLOCKSIZE, DISK_DIRECT);
+    int b;
+    for (b=0;b<40;b++){
+        memset(block, b, BLOCKSIZE);
+        writeBlock(disk, b, block);
+    }
+    // a write across a chunk boundary keeps the other blocks of both chunks
+    memset(check, 'x', sizeof(check));
+    printf("%d\n", writeBlocks(disk, 15, 3, check));     // 0
+    closeDisk(disk);
+    struct stat st;
+    stat(DEFAULT_DISK_NAME, &st);
+    printf("%ld\n", (long)st.st_size);                    // 10240
+
+    disk = openDisk(DEFAULT_DISK_NAME, 0);
+    int errors = 0;
+    for (b=0;b<40;b++){
+        readBlock(disk, b, block);
+        if (block[0] != (b >= 15 && b < 18 ? 'x' : b) || block[BLOCKSIZE-1] != block[0])
+            errors++;
+    }
+    printf("block errors: %d\n", errors);                 // 0
+    closeDisk(disk);
+
+    // a file system on a direct disk reads back through the page cache unchanged
+    char buffer[3000], out[3000];
+    int i;
+    for (i=0;i<3000;i++)
+        buffer[i] = 'a' + i%26;
+    tfs_setDiskFlags(DISK_DIRECT);
+    tfs_mkfs(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    fileDescriptor fd = tfs_openFile("afile");
+    tfs_writeFile(fd, buffer, 3000);
+    tfs_closeFile(fd);
+    tfs_unmount();
+    tfs_setDiskFlags(0);
+    tfs_mount(DEFAULT_DISK_NAME);
+    fd = tfs_openFile("afile");
+    printf("%d\n", tfs_read(fd, out, 3000));              // 3000
+    printf("%d\n", memcmp(buffer, out, 3000));            // 0
+    tfs_unmount();
+    printf("%d\n", tfs_setDiskFlags(8));                  // -2
+}
+
+void test_memdisk(){
+    char buffer[3000], out[3000];
+    int i;
+    for (i=0;i<3000;i++)
+        buffer[i] = 'a' + i%26;
+
+    // a memory disk is used by name like a disk file, but no file is created
+    unlink("tinyFSMem");
+    tfs_setDiskFlags(DISK_MEMORY|DISK_HUGE);
+    printf("%d\n", tfs_mkfs("tinyFSMem", 40*BLOCKSIZE));   // 0
+    printf("%d\n", tfs_mount("tinyFSMem"));                // 0
+    fileDescriptor fd = tfs_openFile("afile");
+    tfs_writeFile(fd, buffer, 3000);
+    tfs_closeFile(fd);
+    tfs_unmount();
+    printf("%d\n", access("tinyFSMem", F_OK));             // -1
+
+    // save it to a file, mount the file, load the file back into a second memory disk
+    printf("%d\n", saveMemoryDisk("tinyFSMem", "tinyFSMem.dsk")); // 0
+    printf("%d\n", dropMemoryDisk("tinyFSMem"));           // 0
+    printf("%d\n", tfs_mount("tinyFSMem"));                // -2
+    tfs_setDiskFlags(0);
+    tfs_mount("tinyFSMem.dsk");
+    fd = tfs_openFile("afile");
+    printf("%d\n", tfs_read(fd, out, 3000));              // 3000
+    printf("%d\n", memcmp(buffer, out, 3000));            // 0
+    tfs_unmount();
+
+    printf("%d\n", loadMemoryDisk("copy", "tinyFSMem.dsk", 0));   // 0
+    unlink("tinyFSMem.dsk");
+    unlink("tinyFSMem.dsk.crc");
+    tfs_setDiskFlags(DISK_MEMORY);
+    tfs_mount("copy");
+    fd = tfs_openFile("afile");
+    memset(out, 0, 3000);
+    printf("%d\n", tfs_read(fd, out, 3000));              // 3000
+    printf("%d\n", memcmp(buffer, out, 3000));            // 0
+    printf("%d\n", dropMemoryDisk("copy"));               // -1, still mounted
+    tfs_unmount();
+    printf("%d\n", dropMemoryDisk("copy"));               // 0
+    tfs_setDiskFlags(0);
+}
+
+// counts completions that succeeded into the int given at submission
+static void countDone(tfsCompletion *c){
+    if (c->result >= 0)
+        (*(int *)c->arg)++;
+}
+
+// keeps the result of a completion in the int given at submission
+static void keepResult(tfsCompletion *c){
+    *(int *)c->arg = c->result;
+}
+
+// polls the eventfd until the call with token completes, returns its result
+static int waitAsync(int efd, int token){
+    tfsCompletion done[8];
+    struct pollfd pfd = {efd, POLLIN, 0};
+    while (1){
+        poll(&pfd, 1, -1);
+        int n = tfs_asyncPoll(done, 8);
+        int i;
+        for (i=0;i<n;i++){
+            if (done[i].token == token)
+                return done[i].result;
+        }
+    }
+}
+
+void test_async(){
+    char buffer[3000], out[3000];
+    int i;
+    for (i=0;i<3000;i++)
+        buffer[i] = 'a' + i%26;
+    tfs_mkfs(DEFAULT_DISK_NAME, DEFAULT_DISK_SIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+
+    // calls run in submission order, callbacks run inside tfs_asyncPoll
+    int efd = tfs_asyncInit();
+    printf("%d\n", efd > 0);                              // 1
+    printf("%d\n", tfs_asyncInit());                      // -2
+    int opened = 0;
+    char name[16];
+    tfs_asyncCreateDir("/d", countDone, &opened);
+    for (i=0;i<20;i++){
+        sprintf(name, "/d/f%d", i);
+        tfs_asyncOpen(name, countDone, &opened);
+    }
+    tfsStat st;
+    int token = tfs_asyncStat("/d", &st, NULL, NULL);
+    printf("%d\n", waitAsync(efd, token));                // 0
+    printf("%d\n", opened);                               // 21
+    printf("%d\n", st.isdir);                             // 1
+
+    // a write and a read of the same file queued back to back
+    fileDescriptor fd = waitAsync(efd, tfs_asyncOpen("/d/big", NULL, NULL));
+    tfs_asyncWrite(fd, buffer, 3000, NULL, NULL);
+    printf("%d\n", waitAsync(efd, tfs_asyncRead(fd, out, 3000, NULL, NULL)));   // 3000
+    printf("%d\n", memcmp(buffer, out, 3000));            // 0
+    printf("%d\n", waitAsync(efd, tfs_asyncClose(fd, NULL, NULL)));            // 0
+
+    tfs_asyncMove("/d/big", "/big", NULL, NULL);
+    printf("%d\n", waitAsync(efd, tfs_asyncRemoveAll("/d", NULL, NULL)));      // 0
+    printf("%d\n", waitAsync(efd, tfs_asyncStat("/d", &st, NULL, NULL)));      // -4
+
+    // after shutdown the synchronous calls see what the engine did
+    printf("%d\n", tfs_asyncShutdown());                  // 0
+    printf("%d\n", tfs_asyncOpen("/x", NULL, NULL));      // -2
+    tfs_stat("/big", &st);
+    printf("%u\n", st.size);                              // 3000
+    tfs_unmount();
+
+    // a file fills the blocks up to 15, writes past them fail, so a group that creates
+    // files can't end its batch, a slow cold read first lets the opens queue up as one group
+    tfs_mkfs(DEFAULT_DISK_NAME, 100*BLOCKSIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    fd = tfs_openFile("/filler");
+    tfs_writeFile(fd, buffer, 3000);
+    tfs_closeFile(fd);
+    tfs_unmount();
+    diskModel slow = {50000000, 0, 0, 0, 0, 1};
+    tfs_setDiskModel(&slow);
+    tfs_mount(DEFAULT_DISK_NAME);
+    tfs_setDiskModel(NULL);
+    fd = tfs_openFile("/filler");
+    struct rlimit limit, small;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    small = limit;
+    small.rlim_cur = 15*BLOCKSIZE;
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &small);
+    efd = tfs_asyncInit();
+    tfs_asyncRead(fd, out, 3000, NULL, NULL);
+    int first = 0;
+    tfs_asyncOpen("/a", keepResult, &first);
+    printf("%d\n", waitAsync(efd, tfs_asyncOpen("/b", NULL, NULL)));    // -2
+    printf("%d\n", first);                               // -2
+    tfs_asyncShutdown();
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, SIG_DFL);
+
+    // the descriptor the failed open got is closed again
+    printf("%d\n", tfs_closeFile(fd+1));                  // -5
+    tfs_unmount();
+}
+
+void test_trace(){
+    char buffer[1000];
+    memset(buffer, 'a', 1000);
+    printf("%d\n", tfs_traceStart("tinyFSTrace.tmp"));   // 0
+    trace_setStripe(16);
+    diskModel model;
+    getDiskModel("ssd", &model);
+    trace_setDiskModel(&model);
+    trace_setDiskModel(NULL);
+    trace_mkfs(DEFAULT_DISK_NAME, DEFAULT_DISK_SIZE);
+    trace_mount(DEFAULT_DISK_NAME);
+    trace_createDir("/d");
+    fileDescriptor fd = trace_openFile("/d/afile");
+    trace_fallocate(fd, 2000);
+    trace_writeFile(fd, buffer, 1000);
+    trace_seek(fd, 990);
+    trace_read(fd, buffer, 20);
+    trace_ftruncate(fd, 500);
+    char *names[] = {"/d", "/x"};
+    tfsStat sts[2];
+    trace_statBulk(names, 2, sts);
+    tfsBatchOp ops[] = {{BATCH_CREATE, "/b"}, {BATCH_RENAME, "/b", "c"}};
+    trace_batch(ops, 2);
+    trace_deleteFile(fd);
+    trace_unmount();
+    printf("%d\n", tfs_traceStop());                      // 0
+
+    // each record holds the call's arguments and result, file content isn't recorded
+    // setStripe 0 16, setDiskModel 0 80000 32, setDiskModel 0 -, mkfs 0 tinyFSDisk 10240 ... openFile 1 /d/afile, fallocate 0 1 2000, writeFile 0 1 1000, seek 0 1 990,
+    // read 10 1 20, ftruncate 0 1 500, statBulk 1 /d /x, batch 0 0:/b:- 3:/b:c, deleteFile 0 1, unmount 0
+    FILE *f = fopen("tinyFSTrace.tmp", "rb");
+    printf("%d\n", readTraceHeader(f));                   // 0
+    traceRecord rec;
+    int err;
+    while ((err = readTraceRecord(f, &rec)) == 0){
+        printf("%s %d", traceOpName(rec.op), rec.result);
+        char *sig = traceSignature(rec.op);
+        int nArgs = 0, nStrs = 0, i;
+        for (;*sig;sig++){
+            if (*sig == 'i' || *sig == 'f')
+                printf(" %d", rec.args[nArgs++]);
+            else if (*sig == 's')
+                printf(" %s", rec.strs[nStrs++]);
+            else if (*sig == 'n'){
+                for (i=0;i<rec.count;i++)
+                    printf(" %s", rec.names[i]);
+            }
+            else if (*sig == 'b'){
+                for (i=0;i<rec.count;i++)
+                    printf(" %d:%s:%s", rec.ops[i].op, rec.ops[i].path, rec.ops[i].newName ? rec.ops[i].newName : "-");
+            }
+            else if (*sig == 'm' && rec.model)
+                printf(" %ld %d", rec.model->latencyNs, rec.model->queueDepth);
+            else if (*sig == 'm')
+                printf(" -");
+        }
+        printf("\n");
+        freeTraceRecord(&rec);
+    }
+    printf("%d\n", err);                                  // -8
+    fclose(f);
+    unlink("tinyFSTrace.tmp");
+}
+
+void test_devmodel(){
+    // 1 us per call, 5 us plus 10 ns per block to seek, 1 ns per byte, 4 calls in flight
+    diskModel model = {1000, 5000, 10, 1000000000, 4, 0};
+    unsigned char blocks[4*BLOCKSIZE];
+    memset(blocks, 0, sizeof(blocks));
+    int disk = openDisk(DEFAULT_DISK_NAME, 40*BLOCKSIZE);
+    printf("%d\n", setDiskModel(disk, &model));          // 0
+    writeBlock(disk, 0, blocks);                        // 1000+256
+    writeBlock(disk, 1, blocks);                        // 1000+256, sequential
+    writeBlock(disk, 10, blocks);                       // 1000+5000+80+256
+    readBlocks(disk, 0, 4, blocks);                     // 1000+5000+110+1024
+    diskStats stats;
+    getDiskStats(disk, &stats);
+    printf("%ld\n", stats.deviceNs);                     // 15982
+
+    // the five runs of a batch flush pay the call latency twice
+    beginDiskBatch(disk);
+    int b;
+    for (b=20;b<30;b+=2)
+        writeBlock(disk, b, blocks);
+    endDiskBatch(disk);
+    getDiskStats(disk, &stats);
+    printf("%ld\n", stats.deviceNs);                     // 44462
+    setDiskModel(disk, NULL);
+    writeBlock(disk, 39, blocks);
+    getDiskStats(disk, &stats);
+    printf("%ld\n", stats.deviceNs);                     // 44462
+    model.seekNs = -1;
+    printf("%d\n", setDiskModel(disk, &model));          // -1
+    closeDisk(disk);
+
+    // a file system on a simulated disk drive
+    printf("%d\n", getDiskModel("tape", &model));        // -1
+    getDiskModel("hdd", &model);
+    tfs_setDiskModel(&model);
+    tfs_mkfs(DEFAULT_DISK_NAME, DEFAULT_DISK_SIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    fileDescriptor fd = tfs_openFile("afile");
+    tfs_writeFile(fd, (char *)blocks, 1000);
+    tfs_closeFile(fd);
+    tfs_diskStats(&stats);
+    printf("%d\n", stats.deviceNs >= stats.writeCalls*model.latencyNs);   // 1
+    tfs_unmount();
+    tfs_setDiskModel(NULL);
+}
+
+void test_stripe(){
+    char buffer[3000], out[3000];
+    int i;
+    for (i=0;i<3000;i++)
+        buffer[i] = 'a' + i%26;
+    char *names = "tinyFSStripeA,tinyFSStripeB,tinyFSStripeC";
+
+    // three files of 64 blocks hold 100 blocks in stripes of 4
+    printf("%d\n", tfs_setStripe(3));                     // -2
+    tfs_setStripe(4);
+    printf("%d\n", tfs_mkfs(names, 100*BLOCKSIZE));       // 0
+    struct stat st;
+    stat("tinyFSStripeB", &st);
+    printf("%ld\n", (long)st.st_size);                    // 16384
+    tfs_mount(names);
+    fileDescriptor fd = tfs_openFile("afile");
+    tfs_writeFile(fd, buffer, 3000);
+    tfs_closeFile(fd);
+    tfs_unmount();
+    tfs_setStripe(DISK_STRIPE_BLOCKS);
+
+    // the unit is kept in the superblock, so the disk mounts with the default unit set
+    printf("%d\n", tfs_mount(names));                     // 0
+    fd = tfs_openFile("afile");
+    printf("%d\n", tfs_read(fd, out, 3000));              // 3000
+    printf("%d\n", memcmp(buffer, out, 3000));            // 0
+    tfs_unmount();
+
+    // block 4 is the first block of the second file, block 13 the second block of the first file's second stripe
+    unsigned char block[BLOCKSIZE], member[BLOCKSIZE];
+    int disk = openDisk(names, 0);
+    printf("%d\n", setDiskStripe(disk, 4));               // 1
+    int single = openDisk("tinyFSStripeB", 0);
+    readBlock(disk, 4, block);
+    readBlock(single, 0, member);
+    printf("%d\n", memcmp(block, member, BLOCKSIZE));     // 0
+    closeDisk(single);
+    single = openDisk("tinyFSStripeA", 0);
+    readBlock(disk, 13, block);
+    readBlock(single, 5, member);
+    printf("%d\n", memcmp(block, member, BLOCKSIZE));     // 0
+    printf("%d\n", setDiskStripe(single, 4));             // 0
+    closeDisk(single);
+
+    // a batch flush issues its runs on all three files together, each run is still a write call
+    diskStats stats, after;
+    getDiskStats(disk, &stats);
+    memset(member, 'z', BLOCKSIZE);
+    beginDiskBatch(disk);
+    writeBlock(disk, 30, member);
+    writeBlock(disk, 34, member);
+    writeBlock(disk, 35, member);
+    writeBlock(disk, 39, member);
+    printf("%d\n", endDiskBatch(disk));                  // 0
+    getDiskStats(disk, &after);
+    printf("%ld\n", after.writeCalls - stats.writeCalls); // 3
+    single = openDisk("tinyFSStripeC", 0);
+    readBlock(single, 11, block);
+    printf("%d\n", memcmp(block, member, BLOCKSIZE));     // 0
+    closeDisk(single);
+    readBlock(disk, 39, block);
+    printf("%d\n", memcmp(block, member, BLOCKSIZE));     // 0
+    closeDisk(disk);
+    unlink("tinyFSStripeA");
+    unlink("tinyFSStripeA.stripe.crc");
+    unlink("tinyFSStripeB");
+    unlink("tinyFSStripeC");
+}
+
+// one server process shared by two client processes
+void test_tfsd(){
+    char buffer[40000], out[40000];
+    int i;
+    for (i=0;i<40000;i++)
+        buffer[i] = 'a' + i%26;
+    char *disk = "tinyFSDaemon";
+    char *sock = "tinyFSDaemon.sock";
+    tfs_mkfs(disk, MAX_BLOCKS*BLOCKSIZE);
+
+    // the server closes its end of the pipe once clients can connect, its messages are hidden
+    int ready[2];
+    char c;
+    if (pipe(ready) < 0)
+        return;
+    fflush(stdout);
+    pid_t server = fork();
+    if (server == 0){
+        close(ready[0]);
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+        if (tfs_mount(disk) < 0 || tfs_serveOpen(sock) < 0)
+            _exit(1);
+        close(ready[1]);
+        tfs_serve();
+        tfs_unmount();
+        _exit(0);
+    }
+    close(ready[1]);
+    printf("%d\n", (int)read(ready[0], &c, 1));           // 0
+    close(ready[0]);
+
+    // 40000 bytes go through the ring as three entries each way
+    printf("%d\n", tfsc_connect(sock));                   // 0
+    fileDescriptor fd = tfsc_openFile("/a");
+    printf("%d\n", fd >= 0);                              // 1
+    printf("%d\n", tfsc_writeFile(fd, buffer, 40000));    // 0
+    printf("%d\n", tfsc_seek(fd, 39990));                 // 0
+    printf("%d\n", tfsc_read(fd, out, 100));              // 10
+    printf("%d\n", tfsc_readByte(fd, out));               // -8
+    tfsc_seek(fd, 0);
+    printf("%d\n", tfsc_read(fd, out, 40000));            // 40000
+    printf("%d\n", memcmp(buffer, out, 40000));           // 0
+    tfsStat st;
+    tfsc_fstat(fd, &st);
+    printf("%u\n", st.size);                              // 40000
+
+    // another client can't use this client's descriptor
+    fflush(stdout);
+    pid_t other = fork();
+    if (other == 0){
+        tfsc_disconnect();
+        tfsc_connect(sock);
+        printf("%d\n", tfsc_closeFile(fd));               // -5
+        fileDescriptor b = tfsc_openFile("/b");
+        tfsc_writeFile(b, "from another process", 20);
+        tfsc_closeFile(b);
+        tfsc_disconnect();
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(other, NULL, 0);
+    printf("%d\n", tfsc_stat("/b", &st));                 // 0
+    printf("%u\n", st.size);                              // 20
+    fileDescriptor b = tfsc_openFile("/b");
+    printf("%d\n", tfsc_read(b, out, 100));               // 20
+    printf("%d\n", memcmp(out, "from another process", 20)); // 0
+
+    // files left open are closed before the server unmounts
+    printf("%d\n", tfsc_shutdown());                      // 0
+    int status;
+    waitpid(server, &status, 0);
+    printf("%d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1); // 0
+    tfs_mount(disk);
+    fd = tfs_openFile("/a");
+    printf("%d\n", tfs_read(fd, out, 40000));             // 40000
+    printf("%d\n", memcmp(buffer, out, 40000));           // 0
+    tfs_unmount();
+    unlink(disk);
+    unlink("tinyFSDaemon.crc");
+}
+
+// reads the data block links of a file on the unmounted default disk
+void readLinks(char *name, unsigned char *links, int *flags){
+    tfs_mount(DEFAULT_DISK_NAME);
+    tfsStat st;
+    tfs_stat(name, &st);
+    tfs_unmount();
+    unsigned char block[BLOCKSIZE];
+    int disk = openDisk(DEFAULT_DISK_NAME, 0);
+    readBlock(disk, st.inodeBlock, block);
+    closeDisk(disk);
+    memcpy(links, block+OFFSET_I_LINKS, DIR_SLOTS);
+    *flags = block[OFFSET_I_FLAGS];
+}
+
+void test_fallocate(){
+    char buffer[3000], out[3000];
+    int i;
+    for (i=0;i<3000;i++)
+        buffer[i] = 'a' + i%26;
+    unsigned char before[DIR_SLOTS], after[DIR_SLOTS];
+    int flags;
+
+    // 2000 bytes need 8 blocks, the free blocks after the root are one run
+    tfs_mkfs(DEFAULT_DISK_NAME, DEFAULT_DISK_SIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    fileDescriptor fd = tfs_openFile("log");
+    printf("%d\n", tfs_fallocate(fd, 100000));            // -6
+    printf("%d\n", tfs_fallocate(fd, 2000));              // 0
+    tfsStat st;
+    tfs_fstat(fd, &st);
+    printf("%u\n", st.size);                              // 0
+    tfs_unmount();
+    readLinks("log", before, &flags);
+    printf("%d %d %d\n", before[7]-before[0], before[8], (flags & FLAG_I_RESERVED) != 0); // 7 0 1
+
+    // a write within the reservation goes to the reserved blocks
+    tfs_mount(DEFAULT_DISK_NAME);
+    fd = tfs_openFile("log");
+    tfs_writeFile(fd, buffer, 1000);
+    tfs_closeFile(fd);
+    tfs_unmount();
+    readLinks("log", after, &flags);
+    printf("%d %d\n", memcmp(before, after, DIR_SLOTS), (flags & FLAG_I_RESERVED) != 0); // 0 1
+
+    // growing past it keeps the reserved blocks and adds more, the reservation is used up
+    tfs_mount(DEFAULT_DISK_NAME);
+    fd = tfs_openFile("log");
+    tfs_writeFile(fd, buffer, 3000);
+    tfs_seek(fd, 0);
+    printf("%d\n", tfs_read(fd, out, 3000));              // 3000
+    printf("%d\n", memcmp(buffer, out, 3000));            // 0
+    tfs_closeFile(fd);
+
+    // inline content moves into the reserved block, more blocks than are free can't be reserved
+    fd = tfs_openFile("small");
+    tfs_writeFile(fd, "hello", 5);
+    printf("%d\n", tfs_fallocate(fd, 600));               // 0
+    printf("%d\n", tfs_read(fd, out, 100));               // 5
+    printf("%d\n", memcmp(out, "hello", 5));              // 0
+    printf("%d\n", tfs_fallocate(fd, 60000));             // -6
+    tfs_closeFile(fd);
+    tfs_unmount();
+    readLinks("log", after, &flags);
+    printf("%d %d\n", memcmp(before, after, 8), (flags & FLAG_I_RESERVED) != 0); // 0 0
+    readLinks("small", after, &flags);
+    printf("%d %d\n", after[2] != 0, (flags & (FLAG_I_INLINE|FLAG_I_RESERVED)) == FLAG_I_RESERVED); // 1 1
+}
+
+void test_ftruncate(){
+    char buffer[3000], out[3000], zeros[500];
+    int i;
+    for (i=0;i<3000;i++)
+        buffer[i] = 'a' + i%26;
+    memset(zeros, 0, 500);
+    unsigned char before[DIR_SLOTS], after[DIR_SLOTS];
+    int flags;
+
+    tfs_mkfs(DEFAULT_DISK_NAME, DEFAULT_DISK_SIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    fileDescriptor fd = tfs_openFile("log");
+    tfs_writeFile(fd, buffer, 3000);
+    tfs_closeFile(fd);
+    tfs_unmount();
+    readLinks("log", before, &flags);
+
+    // shrinking keeps the blocks before the new end and frees the rest
+    tfs_mount(DEFAULT_DISK_NAME);
+    fd = tfs_openFile("log");
+    printf("%d\n", tfs_ftruncate(fd, 100000));            // -6
+    printf("%d\n", tfs_ftruncate(fd, 1000));              // 0
+    printf("%d\n", tfs_read(fd, out, 3000));              // 1000
+    printf("%d\n", memcmp(buffer, out, 1000));            // 0
+    tfs_closeFile(fd);
+    tfs_unmount();
+    readLinks("log", after, &flags);
+    printf("%d %d\n", memcmp(before, after, 4), after[4]); // 0 0
+
+    // growing adds zeros, also over the stale bytes left in the last block
+    tfs_mount(DEFAULT_DISK_NAME);
+    fd = tfs_openFile("log");
+    printf("%d\n", tfs_ftruncate(fd, 1500));              // 0
+    printf("%d\n", tfs_read(fd, out, 3000));              // 1500
+    printf("%d %d\n", memcmp(buffer, out, 1000), memcmp(zeros, out+1000, 500)); // 0 0
+
+    // buffered content is cut before it is written
+    tfs_writeFile(fd, "hello", 5);
+    printf("%d\n", tfs_ftruncate(fd, 2));                 // 0
+    tfs_seek(fd, 0);
+    printf("%d\n", tfs_read(fd, out, 100));               // 2
+    printf("%d\n", memcmp(out, "he", 2));                 // 0
+
+    // compressed content is stored again
+    tfs_setCompression(fd, 1);
+    tfs_writeFile(fd, buffer, 3000);
+    tfs_fsync(fd);
+    printf("%d\n", tfs_ftruncate(fd, 100));               // 0
+    tfs_seek(fd, 0);
+    printf("%d\n", tfs_read(fd, out, 3000));              // 100
+    printf("%d\n", memcmp(buffer, out, 100));             // 0
+    tfs_setCompression(fd, 0);
+    printf("%d\n", tfs_ftruncate(fd, 0));                 // 0
+    tfs_closeFile(fd);
+    tfs_unmount();
+    readLinks("log", after, &flags);
+    printf("%d %d\n", after[0], flags & FLAG_I_INLINE);   // 0 0
+}
+
+// runs ./tfsck with args on the default disk, keeps its output in out and returns its exit status
+// tfsck is built by make all next to the demo
+int runTfsck(char *args, char *out, int size){
+    char cmd[100];
+    snprintf(cmd, sizeof(cmd), "./tfsck %s %s 2>&1", args, DEFAULT_DISK_NAME);
+    fflush(stdout);
+    FILE *pipe = popen(cmd, "r");
+    if (!pipe)
+        return -1;
+    int n = fread(out, 1, size-1, pipe);
+    out[n > 0 ? n : 0] = '\0';
+    int status = pclose(pipe);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// tfsck finds a bad checksum, a block linked twice and a leaked block, and -r repairs them
+void test_tfsck(){
+    char buffer[3000], out[4096], leak[40];
+    int i;
+    for (i=0;i<3000;i++)
+        buffer[i] = 'a' + i%26;
+    tfs_mkfs(DEFAULT_DISK_NAME, DEFAULT_DISK_SIZE);
+    tfs_mount(DEFAULT_DISK_NAME);
+    fileDescriptor fd = tfs_openFile("a");
+    tfs_writeFile(fd, buffer, 3000);
+    tfs_closeFile(fd);
+    fd = tfs_openFile("b");
+    tfs_writeFile(fd, buffer, 3000);
+    tfs_closeFile(fd);
+    tfsStat a, b;
+    tfs_stat("a", &a);
+    tfs_stat("b", &b);
+    tfs_unmount();
+    printf("%d\n", runTfsck("", out, sizeof(out)));       // 0
+
+    // b links a's first block, the head of the free chain drops out of it
+    unsigned char aInode[BLOCKSIZE], bInode[BLOCKSIZE], super[BLOCKSIZE], block[BLOCKSIZE];
+    int disk = openDisk(DEFAULT_DISK_NAME, 0);
+    readBlock(disk, a.inodeBlock, aInode);
+    readBlock(disk, b.inodeBlock, bInode);
+    bInode[OFFSET_I_LINKS] = aInode[OFFSET_I_LINKS];
+    writeBlock(disk, b.inodeBlock, bInode);
+    readBlock(disk, 0, super);
+    int leaked = super[OFFSET_S_FREE];
+    readBlock(disk, leaked, block);
+    super[OFFSET_S_FREE] = block[OFFSET_LINK];
+    writeBlock(disk, 0, super);
+    closeDisk(disk);
+    snprintf(leak, sizeof(leak), "block %d is neither in use nor free", leaked);
+
+    // a data block of a changes behind the checksums
+    FILE *image = fopen(DEFAULT_DISK_NAME, "r+b");
+    fseek(image, aInode[OFFSET_I_LINKS+5]*BLOCKSIZE+100, SEEK_SET);
+    fputc('X', image);
+    fclose(image);
+
+    printf("%d\n", runTfsck("-j 1", out, sizeof(out)));   // 4
+    printf("%d\n", strstr(out, "failed its checksum") != NULL);             // 1
+    printf("%d\n", strstr(out, "block referenced more than once") != NULL); // 1
+    printf("%d\n", strstr(out, leak) != NULL);                              // 1
+
+    // repairs drop the second link and return unreachable blocks to the free chain
+    printf("%d\n", runTfsck("-r -j 1", out, sizeof(out))); // 1
+    printf("%d\n", strstr(out, "repaired") != NULL);        // 1
+    printf("%d\n", runTfsck("", out, sizeof(out)));        // 0
+    printf("%d\n", strstr(out, " 0 problems") != NULL);     // 1
+    printf("%d\n", tfs_mount(DEFAULT_DISK_NAME));          // 0
+    tfs_unmount();
+}
+
 int main ()
 {
     printf("test mount -------------------------------\n");
@@ -121,6 +1464,106 @@ int main ()
     printf("test dir -------------------------------\n");
     test_dir();
     printf("\n");
+
+    printf("test stat -------------------------------\n");
+    test_stat();
+    printf("\n");
+
+    printf("test inline -------------------------------\n");
+    test_inline();
+    printf("\n");
+
+    printf("test readahead -------------------------------\n");
+    test_readahead();
+    printf("\n");
+
+    printf("test writeback -------------------------------\n");
+    test_writeback();
+    printf("\n");
+
+    printf("test checksum -------------------------------\n");
+    test_checksum();
+    printf("\n");
+
+    printf("test defrag -------------------------------\n");
+    test_defrag();
+    printf("\n");
+
+    printf("test compress -------------------------------\n");
+    test_compress();
+    printf("\n");
+
+    printf("test dedup -------------------------------\n");
+    test_dedup();
+    printf("\n");
+
+    printf("test snapshot -------------------------------\n");
+    test_snapshot();
+    printf("\n");
+
+    printf("test copy -------------------------------\n");
+    test_copy();
+    printf("\n");
+
+    printf("test batch -------------------------------\n");
+    test_batch();
+    printf("\n");
+
+    printf("test move -------------------------------\n");
+    test_move();
+    printf("\n");
+
+    printf("test hashdir -------------------------------\n");
+    test_hashdir();
+    printf("\n");
+
+    printf("test layout -------------------------------\n");
+    test_layout();
+    printf("\n");
+
+    printf("test rawdata -------------------------------\n");
+    test_rawdata();
+    printf("\n");
+
+    printf("test direct -------------------------------\n");
+    test_direct();
+    printf("\n");
+
+    printf("test memdisk -------------------------------\n");
+    test_memdisk();
+    printf("\n");
+
+    printf("test async -------------------------------\n");
+    test_async();
+    printf("\n");
+
+    printf("test trace -------------------------------\n");
+    test_trace();
+    printf("\n");
+
+    printf("test devmodel -------------------------------\n");
+    test_devmodel();
+    printf("\n");
+
+    printf("test stripe -------------------------------\n");
+    test_stripe();
+    printf("\n");
+
+    printf("test tfsd -------------------------------\n");
+    test_tfsd();
+    printf("\n");
+
+    printf("test fallocate -------------------------------\n");
+    test_fallocate();
+    printf("\n");
+
+    printf("test ftruncate -------------------------------\n");
+    test_ftruncate();
+    printf("\n");
+
+    printf("test tfsck -------------------------------\n");
+    test_tfsck();
+    printf("\n");
     return 0;
 }
 